@@ -32,8 +32,58 @@
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TURTLE_HAVE_MMAP 1
+#endif
 
 #define MAX_POLYGON_VERTICES 128
+#define HASH_BLOCK_ROWS 64
+#define GAMMA_LINEAR_LEVELS 4096
+#define MAX_SUPERSAMPLE 16
+#define MITER_LIMIT 4.0
+#define STROKE_WINDOW 65536     // transformed strokes are clipped this far from the origin (or the view, if larger)
+#define TURTLE_SPRITE_CACHE 64
+#define TURTLE_FONT_WIDTH 5
+#define TURTLE_FONT_HEIGHT 7
+#define TURTLE_FONT_ADVANCE 6
+#define TURTLE_FONT_LINE 9
+#define TRACE_VERSION 1
+#define TRACE_RAW 0x40            // set in a record's first byte if its operands are stored as doubles
+#define TRACE_REPEAT 0x3F         // record that repeats the records before it
+#define TRACE_MAX_PERIOD 16       // most records a repeat can span
+#define TRACE_CHUNK_RECORDS 65536 // records the trace writer buffers before compressing them
+#define FIXED_SHIFT 8             // fraction bits of fixed-point positions (24.8, see Turtle::setFixedPoint())
+#define FIXED_ONE (1 << FIXED_SHIFT)
+#define FIXED_LIMIT (1 << 22)     // largest coordinate, in pixels, of a fixed-point line
+#define FIXED_VECTOR_SHIFT 16     // fraction bits of the fixed-point heading vector
+#define VECTOR_BUFFER (1 << 20)   // bytes of SVG or EPS text buffered before they are written out
+#define VECTOR_PATH_POINTS 4096   // most points in one path (PostScript interpreters limit path sizes)
+#define COVERAGE_BITS 12          // fraction bits anti-aliased fill coverage is rounded to before it becomes alpha
+
+// polygons covering at least this many pixels are filled by several threads
+#ifndef PARALLEL_FILL_PIXELS
+#define PARALLEL_FILL_PIXELS (1 << 20)
+#endif
+
+// smallest number of rows handed to one fill thread
+#ifndef PARALLEL_FILL_ROWS
+#define PARALLEL_FILL_ROWS 32
+#endif
 
 struct rgb {
     unsigned char red;
@@ -41,6 +91,23 @@ struct rgb {
     unsigned char blue;
 };
 
+enum turtleFillRule {
+    FILL_EVEN_ODD,      // a pixel is inside if a ray from it crosses the outline an odd number of times
+    FILL_NONZERO        // a pixel is inside if the outline winds around it a nonzero number of times
+};
+
+enum turtleLineJoin {
+    JOIN_ROUND,         // corners of thick strokes are rounded
+    JOIN_MITER,         // corners are sharp (beveled when longer than MITER_LIMIT pen widths)
+    JOIN_BEVEL          // corners are cut off
+};
+
+enum turtleLineCap {
+    CAP_BUTT,           // thick strokes end at their endpoints
+    CAP_ROUND,          // thick strokes end in a half circle
+    CAP_SQUARE          // thick strokes extend half the pen width past their endpoints
+};
+
 struct turtleState {
     double xpos;       // current position and heading
     double ypos;       // (uses floating-point numbers for
@@ -50,6 +117,130 @@ struct turtleState {
     rgb fillColor;  // current fill color
     bool pendown;     // currently drawing?
     bool filled;      // currently filling?
+    turtleFillRule fillRule;  // rule used to fill overlapping contours
+    double penWidth;  // stroke width in pixels
+    turtleLineJoin lineJoin;  // corner shape of thick strokes
+    turtleLineCap lineCap;    // end shape of thick strokes
+};
+
+struct turtleTransform {
+    double xx;            // maps world (turtle) coordinates to image coordinates:
+    double yx;            //   image x = xx * x + xy * y + x0
+    double xy;            //   image y = yx * x + yy * y + y0
+    double yy;
+    double x0;
+    double y0;
+};
+
+struct turtleMeasurement {
+    double minX;                    // bounding box of everything drawn, in image coordinates
+    double minY;                    //  (minX > maxX if nothing was drawn)
+    double maxX;
+    double maxY;
+    unsigned long long segments;    // lines: turtle path, edges closing polygons and drawLine()
+    unsigned long long fills;       // filled polygons and flood fills
+    unsigned long long circles;     // circles drawn or filled
+    double pixels;                  // estimated number of image pixels written
+};
+
+struct turtleBounds {
+    int left;             // pixels from (left,bottom) to (right,top), inclusive
+    int bottom;           //  (left > right if there are none)
+    int right;
+    int top;
+};
+
+struct strokeEnd {
+    double x;             // open end of the last thick segment, in field coordinates
+    double y;
+    double dx;            // unit direction of the last segment
+    double dy;
+    double halfWidth;     // half the pen width, in field pixels
+    rgb color;            // pen color of the stroke
+    turtleLineCap cap;    // cap to draw if the stroke does not continue
+};
+
+struct fixedLine {
+    bool steep;           // axes swapped, so that the line runs along x (from left to right)?
+    long long first;      // columns of the ends
+    long long last;
+    long long firstRow;   // rows of the ends
+    long long lastRow;
+    long long numerator;  // row of the line in column first + c, less firstRow, is
+    long long step;       //  floor((numerator + c * step) / denominator)
+    long long denominator;  // 0 if the line is a single column
+};
+
+struct turtleSnapshot {
+    turtleState turtle;   // everything that decides what the next command draws (see Turtle::saveState())
+    turtleState backup;
+    turtleTransform transform;
+    std::vector<turtleTransform> transformStack;
+    bool antialiasFill;
+    bool antialiasLines;
+    bool fixedPoint;      // positions in fixed point, with the heading vector forward() last used
+    double vectorHeading;
+    long long vectorX;
+    long long vectorY;
+    bool strokeOpen;
+    strokeEnd stroke;     // open thick stroke, in the field coordinates of
+    unsigned int scale;   //  this supersampling
+    int blockX;           //  and block offset
+    int blockY;
+    int polyVertexCount;  // polygon being filled
+    int contourCount;
+    unsigned long long polyHash;
+    std::vector<double> polyX;    // its vertices and contours, if saved
+    std::vector<double> polyY;
+    std::vector<int> contourEnd;
+};
+
+struct floodSpan {
+    int left;             // first column of the parent span
+    int right;            // last column of the parent span
+    int row;              // row to scan
+    int direction;        // +1 or -1: direction in which the scan is moving
+};
+
+struct coverageEdge {
+    double x0;            // lower endpoint, in field cell coordinates
+    double y0;            //  (pixel (column,row) covers [column,column+1) x [row,row+1))
+    double x1;            // upper endpoint
+    double y1;
+    double dxdy;          // inverse slope
+    double direction;     // +1 for edges going up, -1 for edges going down
+};
+
+struct gammaTables {
+    unsigned short toLinear[256];                 // sRGB component -> linear light (0..GAMMA_LINEAR_LEVELS-1)
+    unsigned char toSRGB[GAMMA_LINEAR_LEVELS];    // linear light -> sRGB component
+};
+
+struct spritePixel {
+    int column;           // position in the sprite
+    int row;
+    rgb color;            // color of the covering shapes
+    int alpha;            // coverage, 1 to 254
+};
+
+struct turtleSprite {
+    int width = 0;                      // size in field pixels
+    int height = 0;
+    int left = 0;                       // field offset of column 0 from the anchor pixel's block corner
+    int bottom = 0;                     // field offset of row 0 from the anchor pixel's block corner
+    std::vector<unsigned char> pixels;  // 3 bytes per pixel (rgb), row by row starting from the bottom row
+    std::vector<unsigned char> mask;    // 0xff for every byte of a covered pixel, 0 elsewhere
+    std::vector<int> rowFirst;          // first covered column of each row (width if the row is empty)
+    std::vector<int> rowLast;           // last covered column of each row (-1 if the row is empty)
+    std::vector<spritePixel> partial;   // partially covered (anti-aliased) pixels, blended instead of copied
+};
+
+struct turtleSpriteEntry {
+    bool valid;           // has the sprite been rendered?
+    int degrees;          // heading the sprite was rendered at
+    rgb strokeColor;      // colors the sprite was rendered with
+    rgb fillColor;
+    turtleSprite sprite;
 };
 
 struct BMPHeader {
@@ -70,505 +261,5137 @@ struct BMPHeader {
     int biClrImportant;   // number of important colors.  If 0, all colors are important
 };
 
-class Turtle {
-    turtleState mainTurtle{};
-    turtleState backupTurtle{};
+enum turtleOpcode {
+    OP_FORWARD,         // args: pixels
+    OP_BACKWARD,        // args: pixels
+    OP_STRAFE_LEFT,     // args: pixels
+    OP_STRAFE_RIGHT,    // args: pixels
+    OP_TURN_LEFT,       // args: angle
+    OP_TURN_RIGHT,      // args: angle
+    OP_SET_HEADING,     // args: angle
+    OP_GO_TO,           // args: x, y
+    OP_PEN_UP,
+    OP_PEN_DOWN,
+    OP_SET_PEN_COLOR,   // args: red, green, blue
+    OP_SET_FILL_COLOR,  // args: red, green, blue
+    OP_BEGIN_FILL,
+    OP_END_FILL,
+    OP_DOT,
+    OP_DRAW_PIXEL,      // args: x, y
+    OP_DRAW_LINE,       // args: x0, y0, x1, y1
+    OP_DRAW_CIRCLE,     // args: x, y, radius
+    OP_FILL_CIRCLE,     // args: x, y, radius
+    OP_DRAW_TURTLE,
+    OP_DRAW_INT,        // args: number, scale (0 draws nothing, like drawInt())
+    OP_BACKUP,
+    OP_RESTORE,
+    OP_RESET,
+    OP_FLOOD_FILL,      // args: x, y
+    OP_CLOSE_CONTOUR,
+    OP_SET_FILL_RULE,   // args: rule (turtleFillRule)
+    OP_SET_FILL_ANTIALIASING, // args: enabled (0 or 1)
+    OP_SET_LINE_ANTIALIASING, // args: enabled (0 or 1)
+    OP_SET_PEN_WIDTH,   // args: width
+    OP_SET_LINE_JOIN,   // args: join (turtleLineJoin)
+    OP_SET_LINE_CAP,    // args: cap (turtleLineCap)
+    OP_PUSH_TRANSFORM,
+    OP_POP_TRANSFORM,
+    OP_TRANSLATE,       // args: dx, dy
+    OP_ROTATE,          // args: angle
+    OP_SCALE,           // args: sx, sy
+    OP_RESET_TRANSFORM,
+    OP_CLEAR            // args: red, green, blue
+};
 
-    rgb *mainTurtleImage = nullptr;        // 2d pixel data field
+#define TURTLE_OPCODES (OP_CLEAR + 1)   // number of turtle opcodes
 
-    unsigned int mainFieldWidth = 0;           // size in pixels
-    unsigned int mainFieldHeight = 0;
+struct turtleCommand {
+    turtleOpcode op;      // operation to perform
+    double args[4];       // operands, meaning depends on op (unused ones are ignored)
+};
 
-    bool mainFieldSaveFrames = false;  // currently saving video frames?
-    int mainFieldFrameCount = 0;   // current video frame counter
-    int mainFieldFrameInterval = 10;  // pixels per frame
-    int mainFieldPixelCount = 0;   // total pixels drawn by turtle since
+/**
+ * Operand layout of each opcode in a binary trace, shared by turtleTraceWriter and turtleTraceReader.
+ * Operands are zigzag varints, except in records marked TRACE_RAW, which store them as 8-byte doubles.
+ * Coordinates are stored relative to the previous point of the trace, and colors relative to the previous
+ * color of the same kind, so drawings made of small steps and gradients take a byte or two per value.
+ */
+struct turtleTraceLayout {
+    int operands;         // number of operands
+    bool integers;        // does execute() truncate the operands to integers anyway?
+    int points;           // number of (x, y) pairs at the start of the operands, stored as deltas
+    bool color;           // are the operands a color (stored as byte deltas)?
+
+    static turtleTraceLayout of(int op) {
+        switch (op) {
+            case OP_FORWARD: case OP_BACKWARD: case OP_STRAFE_LEFT: case OP_STRAFE_RIGHT:
+            case OP_SET_FILL_RULE: case OP_SET_LINE_JOIN: case OP_SET_LINE_CAP:
+                return {1, true, 0, false};
+            case OP_TURN_LEFT: case OP_TURN_RIGHT: case OP_SET_HEADING: case OP_ROTATE:
+            case OP_SET_PEN_WIDTH: case OP_SET_FILL_ANTIALIASING: case OP_SET_LINE_ANTIALIASING:
+                return {1, false, 0, false};
+            case OP_GO_TO:
+                return {2, false, 1, false};
+            case OP_TRANSLATE: case OP_SCALE:
+                return {2, false, 0, false};
+            case OP_SET_PEN_COLOR: case OP_SET_FILL_COLOR:
+                return {3, true, 0, true};
+            case OP_DRAW_PIXEL: case OP_FLOOD_FILL:
+                return {2, true, 1, false};
+            case OP_DRAW_LINE:
+                return {4, true, 2, false};
+            case OP_DRAW_CIRCLE: case OP_FILL_CIRCLE:
+                return {3, true, 1, false};
+            case OP_DRAW_INT:
+                return {2, true, 0, false};
+            case OP_CLEAR:
+                return {3, true, 0, false};
+            default:
+                return {0, false, 0, false};
+        }
+    }
+};
 
-    // beginning of video
-    int mainTurtlePolyVertexCount = 0;       // polygon vertex count
-    double mainTurtlePolyX[MAX_POLYGON_VERTICES]{}; // polygon vertex x-coords
-    double mainTurtlePolyY[MAX_POLYGON_VERTICES]{}; // polygon vertex y-coords
+/**
+ * Writes turtle commands to a compact binary trace, to a file or to memory.
+ * The trace starts with "YTRC" and a version byte, followed by one record per command: the opcode byte and
+ * its operands (see turtleTraceLayout). Runs of repeated records are replaced by a TRACE_REPEAT record
+ * holding the period and the number of extra repetitions, found in chunks of TRACE_CHUNK_RECORDS records.
+ */
+class turtleTraceWriter {
+    FILE *file = nullptr;                   // output file, or nullptr to write to memory
+    std::vector<unsigned char> output;      // written bytes (memory traces only)
 
-    unsigned long long int numPixelsOutOfBounds;
+    std::vector<unsigned char> chunk;       // encoded records not yet compressed
+    std::vector<size_t> recordStart;        // offset of each record in chunk, plus the end
 
-    const int TURTLE_DIGITS[10][20] = {
-
-            {0, 1, 1, 0,       // 0
-                1, 0, 0, 1,
-                1, 0, 0, 1,
-                1, 0, 0, 1,
-                0, 1, 1, 0},
-
-            {0, 1, 1, 0,       // 1
-                0, 0, 1, 0,
-                0, 0, 1, 0,
-                0, 0, 1, 0,
-                0, 1, 1, 1},
-
-            {1, 1, 1, 0,       // 2
-                0, 0, 0, 1,
-                0, 1, 1, 0,
-                1, 0, 0, 0,
-                1, 1, 1, 1},
-
-            {1, 1, 1, 0,       // 3
-                0, 0, 0, 1,
-                0, 1, 1, 0,
-                0, 0, 0, 1,
-                1, 1, 1, 0},
-
-            {0, 1, 0, 1,       // 4
-                0, 1, 0, 1,
-                0, 1, 1, 1,
-                0, 0, 0, 1,
-                0, 0, 0, 1},
-
-            {1, 1, 1, 1,       // 5
-                1, 0, 0, 0,
-                1, 1, 1, 0,
-                0, 0, 0, 1,
-                1, 1, 1, 0},
-
-            {0, 1, 1, 0,       // 6
-                1, 0, 0, 0,
-                1, 1, 1, 0,
-                1, 0, 0, 1,
-                0, 1, 1, 0},
-
-            {1, 1, 1, 1,       // 7
-                0, 0, 0, 1,
-                0, 0, 1, 0,
-                0, 1, 0, 0,
-                0, 1, 0, 0},
-
-            {0, 1, 1, 0,       // 8
-                1, 0, 0, 1,
-                0, 1, 1, 0,
-                1, 0, 0, 1,
-                0, 1, 1, 0},
-
-            {0, 1, 1, 0,       // 9
-                1, 0, 0, 1,
-                0, 1, 1, 1,
-                0, 0, 0, 1,
-                0, 1, 1, 0},
+    double lastX = 0;                       // previous point, colors of the trace
+    double lastY = 0;
+    int lastColor[2][3] = {{0, 0, 0}, {0, 0, 0}};
+    bool complete = true;                   // false once something was drawn that has no command
 
-    };
 public:
-
     /**
-     * Initializes the 2d field that the turtle moves on.
-     * @param width field width
-     * @param height field height
+     * Starts a trace in memory, see getBytes().
      */
-    Turtle(unsigned int width, unsigned int height) {
-        numPixelsOutOfBounds = 0;
-
-        auto totalSize = sizeof(rgb) * width * height;
+    turtleTraceWriter() {
+        writeHeader();
+    }
 
-        // allocate new image and initialize it to white
-        mainTurtleImage = (rgb *) malloc(totalSize);
-        if (mainTurtleImage == nullptr) {
-            fprintf(stderr, "Can't allocate memory for turtle image.\n");
+    /**
+     * Starts a trace file, replacing any existing file.
+     * @param filename
+     */
+    explicit turtleTraceWriter(const char *filename) {
+        file = fopen(filename, "wb");
+        if (file == nullptr) {
+            fprintf(stderr, "Can't open %s for writing\n", filename);
             exit(EXIT_FAILURE);
         }
-        memset(mainTurtleImage, 255, totalSize);
-
-        // save field size for later
-        mainFieldWidth = width;
-        mainFieldHeight = height;
-
-        // disable video
-        mainFieldSaveFrames = false;
-
-        // reset turtle position and color
-        reset();
-
-        // create backup at the initial position
-        backup();
+        writeHeader();
     }
 
-    ~Turtle() {
-        cleanup();
+    turtleTraceWriter(const turtleTraceWriter &) = delete;
+    turtleTraceWriter &operator=(const turtleTraceWriter &) = delete;
+
+    ~turtleTraceWriter() {
+        close();
     }
 
     /**
-     * Resets the turtle's location, orientation, color, and pen status to the default values:
-     * center of the field (0,0), facing right (0 degrees), black stroke and green fill color, pen down.
+     * Appends a command to the trace.
+     * @param command
      */
-    void reset() {
-        // move turtle to middle of the field
-        mainTurtle.xpos = 0.0;
-        mainTurtle.ypos = 0.0;
-
-        // orient to the right (0 deg)
-        mainTurtle.heading = 0.0;
+    void write(const turtleCommand &command) {
+        double values[4];
+        turtleTraceLayout layout = turtleTraceLayout::of(command.op);
+        for (int i = 0; i < layout.operands; i++) {
+            values[i] = layout.integers ? (double) (int) command.args[i] : command.args[i];
+        }
+        if (command.op == OP_SET_FILL_ANTIALIASING || command.op == OP_SET_LINE_ANTIALIASING) {
+            values[0] = command.args[0] != 0 ? 1 : 0;
+        }
 
-        // default stroke color is black
-        mainTurtle.strokeColor.red = 0;
-        mainTurtle.strokeColor.green = 0;
-        mainTurtle.strokeColor.blue = 0;
+        // colors are stored as byte deltas, points as deltas from the previous point
+        double stored[4];
+        int *color = lastColor[command.op == OP_SET_FILL_COLOR];
+        for (int i = 0; i < layout.operands; i++) {
+            stored[i] = values[i];
+            if (layout.color) {
+                int value = (int) values[i] & 0xFF;
+                stored[i] = (signed char) (value - color[i]);
+                color[i] = value;
+            }
+        }
+        double baseX = lastX;
+        double baseY = lastY;
+        for (int k = 0; k < layout.points; k++) {
+            stored[2 * k] = values[2 * k] - baseX;
+            stored[2 * k + 1] = values[2 * k + 1] - baseY;
+            baseX = values[2 * k];
+            baseY = values[2 * k + 1];
+        }
 
-        // default fill color is black
-        mainTurtle.fillColor.red = 0;
-        mainTurtle.fillColor.green = 255;
-        mainTurtle.fillColor.blue = 0;
+        // deltas must be integers that give back the exact point when the reader adds them up
+        bool raw = false;
+        for (int i = 0; i < layout.operands; i++) {
+            raw = raw || !(stored[i] == floor(stored[i]) && fabs(stored[i]) < 9007199254740992.0);
+        }
+        for (int i = 0; i < 2 * layout.points; i++) {
+            raw = raw || stored[i] + (i < 2 ? (i == 0 ? lastX : lastY) : values[i - 2]) != values[i];
+        }
 
-        // default pen position is down
-        mainTurtle.pendown = true;
+        recordStart.push_back(chunk.size());
+        chunk.push_back((unsigned char) (command.op | (raw ? TRACE_RAW : 0)));
+        for (int i = 0; i < layout.operands; i++) {
+            if (raw) {
+                // absolute values: a raw record does not depend on the previous point
+                unsigned char bytes[8];
+                memcpy(bytes, &values[i], sizeof(bytes));
+                chunk.insert(chunk.end(), bytes, bytes + sizeof(bytes));
+            } else {
+                putVarint(chunk, zigzag((long long) stored[i]));
+            }
+        }
+        if (layout.points > 0) {
+            lastX = values[2 * layout.points - 2];
+            lastY = values[2 * layout.points - 1];
+        }
 
-        // default fill status is off
-        mainTurtle.filled = false;
-        mainTurtlePolyVertexCount = 0;
+        if (recordStart.size() >= TRACE_CHUNK_RECORDS) {
+            flushChunk();
+        }
     }
 
-
     /**
-     * Creates a backup of the current turtle.
-     * The backup can be restored by using restore().
-     * Useful in complex drawing situations.
+     * Notes that the recorded turtle drew something without a command, so replaying the trace will not
+     * give back the same image.
      */
-    void backup() {
-        backupTurtle = mainTurtle;
+    void markIncomplete() {
+        complete = false;
     }
 
-
     /**
-     * Restores the turtle from the backup.
+     * Tells whether the trace holds everything drawn while recording: false after drawText(), fillPixel()
+     * or a stamp. Such a trace must not stand in for the image, e.g. as a cache key.
+     * @return true if no drawing was left out
      */
-    void restore() {
-        mainTurtle = backupTurtle;
+    bool isComplete() const {
+        return complete;
     }
 
-
     /**
-     * Moves the turtle forward, drawing a straight line if the pen is down.
-     * @param pixels movement distance
+     * Writes out buffered records and closes the file. Called by the destructor; write no commands after it.
      */
-    void forward(int pixels) {
-        // calculate (x,y) movement vector from heading
-        double radians = mainTurtle.heading * M_PI / 180.0;
-        double dx = cos(radians) * pixels;
-        double dy = sin(radians) * pixels;
-
-        // delegate to another method to actually move
-        goTo(mainTurtle.xpos + dx, mainTurtle.ypos + dy);
+    void close() {
+        flushChunk();
+        if (file != nullptr) {
+            fclose(file);
+            file = nullptr;
+        }
     }
 
-
     /**
-     * Moves the turtle backward, drawing a straight line if the pen is down.
-     * @param pixels movement distance
+     * Returns the trace written so far (memory traces only). Buffered records are written out first.
+     * @return trace bytes
      */
-    void backward(int pixels) {
-        // opposite of "forward"
-        forward(-pixels);
+    const std::vector<unsigned char> &getBytes() {
+        flushChunk();
+        return output;
     }
 
     /**
-     * Moves the turtle left.
-     * @param pixels movement distance
+     * Appends an unsigned LEB128 varint.
+     * @param bytes
+     * @param value
      */
-    void strafeLeft(int pixels) {
-        turnLeft(90);
-        forward(pixels);
-        turnRight(90);
+    static void putVarint(std::vector<unsigned char> &bytes, unsigned long long value) {
+        while (value >= 0x80) {
+            bytes.push_back((unsigned char) (value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back((unsigned char) value);
     }
 
     /**
-     * Moves the turtle right.
-     * @param pixels movement distance
+     * Maps signed to unsigned integers so small magnitudes of either sign become small varints.
+     * @param value
+     * @return 2 * value for value >= 0, -2 * value - 1 otherwise
      */
-    void strafeRight(int pixels) {
-        turnRight(90);
-        forward(pixels);
-        turnLeft(90);
+    static unsigned long long zigzag(long long value) {
+        return ((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63);
     }
 
+private:
+    void writeHeader() {
+        const unsigned char header[5] = {'Y', 'T', 'R', 'C', TRACE_VERSION};
+        emit(header, sizeof(header));
+    }
 
-    /**
-     * Turns the turtle to the left by the specified number of degrees.
-     * @param angle
-     */
-    void turnLeft(double angle) {
-        // rotate turtle heading
-        mainTurtle.heading += angle;
-
-        // constrain heading to range: [0.0, 360.0)
-        if (mainTurtle.heading < 0.0) {
-            mainTurtle.heading += 360.0;
-        } else if (mainTurtle.heading >= 360.0) {
-            mainTurtle.heading -= 360.0;
+    void emit(const unsigned char *bytes, size_t count) {
+        if (count == 0) {
+            return;
+        }
+        if (file != nullptr) {
+            fwrite(bytes, 1, count, file);
+        } else {
+            size_t used = output.size();
+            output.resize(used + count);
+            memcpy(output.data() + used, bytes, count);
         }
     }
 
-
     /**
-     * Turns the turtle to the right by the specified number of degrees.
-     * @param angle
+     * Checks if two buffered records are encoded identically.
      */
-    void turnRight(double angle) {
-        // opposite of "turn left"
-        turnLeft(-angle);
+    bool sameRecord(size_t a, size_t b) const {
+        size_t length = recordStart[a + 1] - recordStart[a];
+        return length == recordStart[b + 1] - recordStart[b] &&
+               memcmp(&chunk[recordStart[a]], &chunk[recordStart[b]], length) == 0;
     }
 
-
     /**
-     * Sets the pen status to "up" (do not draw).
+     * Writes out the buffered records, replacing each longest run of a repeated block (of up to
+     * TRACE_MAX_PERIOD records) by the block followed by a TRACE_REPEAT record.
      */
-    void penUp() {
-        mainTurtle.pendown = false;
-    }
+    void flushChunk() {
+        size_t count = recordStart.size();
+        if (count == 0) {
+            return;
+        }
+        recordStart.push_back(chunk.size());
+
+        std::vector<unsigned char> repeat;
+        for (size_t i = 0; i < count;) {
+            size_t bestPeriod = 0;
+            size_t bestRepeats = 0;
+            for (size_t period = 1; period <= TRACE_MAX_PERIOD && i + 2 * period <= count; period++) {
+                size_t run = 0;
+                while (i + period + run < count && sameRecord(i + run, i + period + run)) {
+                    run++;
+                }
+                if ((run / period) * period > bestRepeats * bestPeriod) {
+                    bestPeriod = period;
+                    bestRepeats = run / period;
+                }
+            }
 
+            size_t blockBytes = bestPeriod == 0 ? 0 : recordStart[i + bestPeriod] - recordStart[i];
+            if (bestRepeats * blockBytes <= 3) {
+                emit(&chunk[recordStart[i]], recordStart[i + 1] - recordStart[i]);
+                i++;
+                continue;
+            }
 
-    /**
-     * Sets the pen status to "down" (draw).
-     */
-    void penDown() {
-        mainTurtle.pendown = true;
+            emit(&chunk[recordStart[i]], blockBytes);
+            repeat.assign(1, TRACE_REPEAT);
+            putVarint(repeat, bestPeriod);
+            putVarint(repeat, bestRepeats);
+            emit(repeat.data(), repeat.size());
+            i += bestPeriod * (bestRepeats + 1);
+        }
+
+        chunk.clear();
+        recordStart.clear();
     }
+};
 
+/**
+ * Reads the commands of a binary trace written by turtleTraceWriter, from memory or from a memory-mapped file.
+ * Records are decoded straight from the mapping as they are requested, repeats included.
+ */
+class turtleTraceReader {
+    const unsigned char *data = nullptr;    // trace bytes
+    size_t size = 0;
+    void *mapping = nullptr;                // memory mapping or buffer owned by the reader
+    size_t mappingSize = 0;
+    bool mapped = false;
+
+    size_t position = 5;                    // offset of the next record
+    double lastX = 0;                       // previous point, colors of the trace
+    double lastY = 0;
+    int lastColor[2][3] = {{0, 0, 0}, {0, 0, 0}};
+
+    size_t literalStart[TRACE_MAX_PERIOD]{};  // offsets of the latest records read from the trace itself
+    size_t literalCount = 0;                // records read since the last repeat
+    size_t repeatStart = 0;                 // block being repeated: first record,
+    size_t repeatEnd = 0;                   //  the repeat record,
+    unsigned long long repeatsLeft = 0;     //  and passes still to run
 
+public:
     /**
-     * Starts filling.
-     * Call this before drawing a polygon to activate the bookkeeping required to run the filling algorithm later.
+     * Reads a trace held in memory. The bytes must outlive the reader.
+     * @param bytes
+     * @param count
      */
-    void beginFill() {
-        mainTurtle.filled = true;
-        mainTurtlePolyVertexCount = 0;
+    turtleTraceReader(const unsigned char *bytes, size_t count) {
+        open(bytes, count);
     }
 
-
     /**
-     * Ends filling.
-     * Call this after drawing a polygon to trigger the fill algorithm.
-     * The filled polygon may have up to 128 sides.
+     * Reads a trace file, mapping it into memory where the platform allows.
+     * @param filename
      */
-    void endFill() {
-        // based on public-domain fill algorithm in C by Darel Rex Finley, 2007
-        //   from http://alienryderflex.com/polygon_fill/
+    explicit turtleTraceReader(const char *filename) {
+#ifdef TURTLE_HAVE_MMAP
+        int descriptor = ::open(filename, O_RDONLY);
+        struct stat status{};
+        if (descriptor < 0 || fstat(descriptor, &status) != 0) {
+            fprintf(stderr, "Can't open %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        mappingSize = (size_t) status.st_size;
+        if (mappingSize > 0) {
+            mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapping == MAP_FAILED) {
+                fprintf(stderr, "Can't map %s\n", filename);
+                exit(EXIT_FAILURE);
+            }
+            madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+            mapped = true;
+        }
+        ::close(descriptor);
+#else
+        FILE *file = fopen(filename, "rb");
+        if (file == nullptr) {
+            fprintf(stderr, "Can't open %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        fseek(file, 0, SEEK_END);
+        mappingSize = (size_t) ftell(file);
+        fseek(file, 0, SEEK_SET);
+        mapping = malloc(mappingSize + 1);
+        if (mapping == nullptr || fread(mapping, 1, mappingSize, file) != mappingSize) {
+            fprintf(stderr, "Can't read %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        fclose(file);
+#endif
+        open((const unsigned char *) mapping, mappingSize);
+    }
 
-        double nodeX[MAX_POLYGON_VERTICES];     // x-coords of polygon intercepts
-        int nodes;                              // size of nodeX
-        int x, y, i, j;                         // current pixel and loop indices
-        double temp;                            // temporary variable for sorting
+    turtleTraceReader(const turtleTraceReader &) = delete;
+    turtleTraceReader &operator=(const turtleTraceReader &) = delete;
 
-        //  loop through the rows of the image
-        for (y = -(mainFieldHeight / 2); y < mainFieldHeight / 2; y++) {
+    ~turtleTraceReader() {
+#ifdef TURTLE_HAVE_MMAP
+        if (mapped) {
+            munmap(mapping, mappingSize);
+        }
+#else
+        free(mapping);
+#endif
+    }
 
-            //  build a list of polygon intercepts on the current line
-            nodes = 0;
-            j = mainTurtlePolyVertexCount - 1;
-            for (i = 0; i < mainTurtlePolyVertexCount; i++) {
-                if ((mainTurtlePolyY[i] < (double) y &&
-                     mainTurtlePolyY[j] >= (double) y) ||
-                    (mainTurtlePolyY[j] < (double) y &&
-                     mainTurtlePolyY[i] >= (double) y)) {
-
-                    // intercept found; record it
-                    nodeX[nodes++] = (mainTurtlePolyX[i] +
-                                      ((double) y - mainTurtlePolyY[i]) /
-                                      (mainTurtlePolyY[j] - mainTurtlePolyY[i]) *
-                                      (mainTurtlePolyX[j] - mainTurtlePolyX[i]));
+    /**
+     * Checks that a trace held in memory can be read to the end, without exiting on a corrupt one
+     * as the reader does. Use it on traces from elsewhere before reading them.
+     * @param bytes
+     * @param count
+     * @return nullptr if the trace is sound, otherwise why it is corrupt
+     */
+    static const char *check(const unsigned char *bytes, size_t count) {
+        if (count < 5 || memcmp(bytes, "YTRC", 4) != 0 || bytes[4] != TRACE_VERSION) {
+            return "not a turtle trace";
+        }
+        size_t position = 5;
+        unsigned long long literals = 0;        // records since the last repeat
+        while (position < count) {
+            unsigned char head = bytes[position++];
+            if (head == TRACE_REPEAT) {
+                unsigned long long period, repeats;
+                if (!checkVarint(bytes, count, position, period) || !checkVarint(bytes, count, position, repeats)) {
+                    return "truncated record";
                 }
-                j = i;
-                if (nodes >= MAX_POLYGON_VERTICES) {
-                    fprintf(stderr, "Too many intercepts in fill algorithm!\n");
-                    exit(EXIT_FAILURE);
+                if (period == 0 || period > TRACE_MAX_PERIOD || period > literals) {
+                    return "repeat of records that are not there";
                 }
+                literals = 0;
+                continue;
             }
 
-            //  sort the nodes via simple insertion sort
-            for (i = 1; i < nodes; i++) {
-                temp = nodeX[i];
-                for (j = i; j > 0 && temp < nodeX[j - 1]; j--) {
-                    nodeX[j] = nodeX[j - 1];
-                }
-                nodeX[j] = temp;
+            int op = head & ~TRACE_RAW;
+            if (op >= TURTLE_OPCODES) {
+                return "unknown opcode";
             }
-
-            //  fill the pixels between node pairs
-            for (i = 0; i < nodes; i += 2) {
-                for (x = (int) floor(nodeX[i]) + 1; x < (int) ceil(nodeX[i + 1]); x++) {
-                    fillPixel(x, y);
+            const turtleTraceLayout &layout = layouts()[op];
+            if (head & TRACE_RAW) {
+                if (count - position < 8 * (size_t) layout.operands) {
+                    return "truncated record";
+                }
+                position += 8 * (size_t) layout.operands;
+            } else {
+                unsigned long long value;
+                for (int i = 0; i < layout.operands; i++) {
+                    if (!checkVarint(bytes, count, position, value)) {
+                        return "truncated record";
+                    }
                 }
             }
+            literals++;
         }
-
-        mainTurtle.filled = false;
-
-        // redraw polygon (filling is imperfect and can occasionally occlude sides)
-        for (i = 0; i < mainTurtlePolyVertexCount; i++) {
-            int x0 = (int) round(mainTurtlePolyX[i]);
-            int y0 = (int) round(mainTurtlePolyY[i]);
-            int x1 = (int) round(mainTurtlePolyX[(i + 1) %
-                                                 mainTurtlePolyVertexCount]);
-            int y1 = (int) round(mainTurtlePolyY[(i + 1) %
-                                                 mainTurtlePolyVertexCount]);
-            drawLine(x0, y0, x1, y1);
-        }
+        return nullptr;
     }
 
-
     /**
-     * Moves the turtle to the specified location, drawing a straight line if the pen is down.
-     * Takes integer coordinate parameters.
-     * @param x
-     * @param y
+     * Decodes the next command.
+     * @param command decoded command (output)
+     * @return false at the end of the trace
      */
-    void goTo(int x, int y) {
+    bool next(turtleCommand &command) {
+        while (true) {
+            if (repeatsLeft > 0 && position == repeatEnd) {
+                if (--repeatsLeft > 0) {
+                    position = repeatStart;
+                } else {
+                    position = repeatEnd;
+                    skipRecord();
+                }
+                continue;
+            }
+            if (position >= size) {
+                return false;
+            }
+
+            if (data[position] != TRACE_REPEAT) {
+                if (repeatsLeft == 0) {
+                    literalStart[literalCount++ % TRACE_MAX_PERIOD] = position;
+                }
+                decodeRecord(command);
+                return true;
+            }
+
+            // a repeat: run the block of records just before it again
+            if (repeatsLeft > 0) {
+                fail("repeat inside a repeated block");
+            }
+            repeatEnd = position;
+            position++;
+            unsigned long long period = getVarint();
+            unsigned long long repeats = getVarint();
+            if (period == 0 || period > TRACE_MAX_PERIOD || period > literalCount) {
+                fail("repeat of records that are not there");
+            }
+            repeatStart = literalStart[(literalCount - period) % TRACE_MAX_PERIOD];
+            literalCount = 0;
+            if (repeats > 0) {
+                repeatsLeft = repeats;
+                position = repeatStart;
+            }
+        }
+    }
+
+private:
+    void open(const unsigned char *bytes, size_t count) {
+        data = bytes;
+        size = count;
+        if (size < 5 || memcmp(data, "YTRC", 4) != 0 || data[4] != TRACE_VERSION) {
+            fail("not a turtle trace");
+        }
+    }
+
+    static void fail(const char *reason) {
+        fprintf(stderr, "Corrupt turtle trace: %s\n", reason);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long long getVarint() {
+        unsigned long long value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (position >= size) {
+                fail("truncated record");
+            }
+            unsigned char byte = data[position++];
+            value |= (unsigned long long) (byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+        fail("varint too long");
+        return 0;
+    }
+
+    /**
+     * Reads a varint for check(), failing instead of exiting at the end of the bytes or on a varint too long.
+     */
+    static bool checkVarint(const unsigned char *bytes, size_t count, size_t &position, unsigned long long &value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && position < count; shift += 7) {
+            unsigned char byte = bytes[position++];
+            value |= (unsigned long long) (byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void skipRecord() {
+        position++;
+        getVarint();
+        getVarint();
+    }
+
+    void decodeRecord(turtleCommand &command) {
+        unsigned char head = data[position++];
+        int op = head & ~TRACE_RAW;
+        if (op >= TURTLE_OPCODES) {
+            fail("unknown opcode");
+        }
+        const turtleTraceLayout &layout = layouts()[op];
+        command.op = (turtleOpcode) op;
+        command.args[0] = command.args[1] = command.args[2] = command.args[3] = 0;
+
+        if (head & TRACE_RAW) {
+            if (position + 8 * (size_t) layout.operands > size) {
+                fail("truncated record");
+            }
+            memcpy(command.args, data + position, 8 * (size_t) layout.operands);
+            position += 8 * (size_t) layout.operands;
+            if (layout.color) {
+                int *color = lastColor[op == OP_SET_FILL_COLOR];
+                for (int i = 0; i < 3; i++) {
+                    color[i] = (int) command.args[i] & 0xFF;
+                }
+            }
+        } else {
+            // a record has at most 4 varints of 10 bytes; away from the end they need no bounds checks
+            bool roomy = size - position >= 40;
+            for (int i = 0; i < layout.operands; i++) {
+                unsigned long long value = data[position];
+                if (value < 0x80 && roomy) {
+                    position++;
+                } else {
+                    value = roomy ? getVarintUnchecked() : getVarint();
+                }
+                command.args[i] = (double) (long long) ((value >> 1) ^ (0 - (value & 1)));
+            }
+            if (layout.color) {
+                int *color = lastColor[op == OP_SET_FILL_COLOR];
+                for (int i = 0; i < 3; i++) {
+                    color[i] = (color[i] + (int) command.args[i]) & 0xFF;
+                    command.args[i] = color[i];
+                }
+            }
+            if (layout.points > 0) {
+                command.args[0] += lastX;
+                command.args[1] += lastY;
+                if (layout.points > 1) {
+                    command.args[2] += command.args[0];
+                    command.args[3] += command.args[1];
+                }
+            }
+        }
+
+        if (layout.points > 0) {
+            lastX = command.args[2 * layout.points - 2];
+            lastY = command.args[2 * layout.points - 1];
+        }
+    }
+
+    unsigned long long getVarintUnchecked() {
+        unsigned long long value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            unsigned char byte = data[position++];
+            value |= (unsigned long long) (byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+        fail("varint too long");
+        return 0;
+    }
+
+    /**
+     * Returns the operand layouts of all opcodes, indexed by opcode.
+     */
+    static const turtleTraceLayout *layouts() {
+        struct layoutTable {
+            turtleTraceLayout layout[TURTLE_OPCODES];
+        };
+        static const layoutTable table = [] {
+            layoutTable result{};
+            for (int op = 0; op < TURTLE_OPCODES; op++) {
+                result.layout[op] = turtleTraceLayout::of(op);
+            }
+            return result;
+        }();
+        return table.layout;
+    }
+};
+
+enum turtleVectorFormat {
+    VECTOR_SVG,         // Scalable Vector Graphics
+    VECTOR_EPS          // Encapsulated PostScript
+};
+
+/**
+ * Writes what a turtle draws as an SVG or EPS drawing, to a file or to memory (see Turtle::setVectorOutput()).
+ * The drawing is as large as the image, with image pixel (x,y) centered at the same place as in saveBMP().
+ * Consecutive lines that share their ends and pen become one path, fills and circles are written as such,
+ * and coordinates are rounded to hundredths of a pixel, with path points stored relative to the previous one.
+ * Output is collected in a buffer and written out in blocks of VECTOR_BUFFER bytes.
+ */
+class turtleVectorWriter {
+    struct vectorStyle {
+        bool stroke;              // outline with the pen, or fill?
+        rgb color;
+        double width;             // pen width (strokes only)
+        turtleLineCap cap;
+        turtleLineJoin join;
+        turtleFillRule rule;      // fills only
+
+        bool operator==(const vectorStyle &other) const {
+            return stroke == other.stroke && color.red == other.color.red && color.green == other.color.green &&
+                   color.blue == other.color.blue && width == other.width && cap == other.cap &&
+                   join == other.join && rule == other.rule;
+        }
+    };
+
+    FILE *file = nullptr;                   // output file, or nullptr to write to memory
+    std::string filename;                   // its name, for errors
+    std::string output;                     // written text (memory output only)
+    std::string buffer;                     // text not yet written out
+    turtleVectorFormat format;
+    unsigned int width;
+    unsigned int height;
+    double originX;                         // drawing coordinates of image point (0,0)
+    double originY;
+
+    bool styled = false;                    // has a style been set?
+    vectorStyle style{};                    // style of the open SVG group, or color and pen of the PostScript state
+    bool pathOpen = false;                  // is a path of lines being written?
+    vectorStyle pathStyle{};                // its style
+    long long pathX = 0;                    // its last point, in hundredths of a pixel
+    long long pathY = 0;
+    int pathPoints = 0;
+    bool closed = false;
+
+    unsigned long long skipped = 0;         // flood fills, which can't be written
+
+public:
+    /**
+     * Starts a drawing in memory, see getText().
+     * @param format
+     * @param width image width in pixels
+     * @param height image height in pixels
+     */
+    turtleVectorWriter(turtleVectorFormat format, unsigned int width, unsigned int height)
+            : format(format), width(width), height(height) {
+        writeHeader();
+    }
+
+    /**
+     * Starts a drawing file, replacing any existing file.
+     * @param filename
+     * @param format
+     * @param width image width in pixels
+     * @param height image height in pixels
+     */
+    turtleVectorWriter(const char *filename, turtleVectorFormat format, unsigned int width, unsigned int height)
+            : filename(filename), format(format), width(width), height(height) {
+        file = fopen(filename, "wb");
+        if (file == nullptr) {
+            fprintf(stderr, "Can't open %s for writing\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        writeHeader();
+    }
+
+    turtleVectorWriter(const turtleVectorWriter &) = delete;
+    turtleVectorWriter &operator=(const turtleVectorWriter &) = delete;
+
+    ~turtleVectorWriter() {
+        close();
+    }
+
+    /**
+     * Adds a line drawn with the given pen, continuing the last path if it ends where the line starts.
+     * @param x0 image coordinates
+     * @param y0
+     * @param x1
+     * @param y1
+     * @param pen pen color, width, cap and join
+     * @param joined may the line join the previous one, as the turtle's path does?
+     */
+    void line(double x0, double y0, double x1, double y1, const turtleState &pen, bool joined) {
+        vectorStyle lineStyle = penStyle(pen);
+        long long startX = toX(x0);
+        long long startY = toY(y0);
+        if (!(pathOpen && joined && startX == pathX && startY == pathY && pathPoints < VECTOR_PATH_POINTS &&
+              pathStyle == lineStyle)) {
+            endPath();
+            setStyle(lineStyle);
+            if (format == VECTOR_SVG) {
+                put("<path d=\"M");
+                putNumber(startX);
+                put(' ');
+                putNumber(startY);
+                put('l');
+            } else {
+                putNumber(startX);
+                put(' ');
+                putNumber(startY);
+                put(" m");
+            }
+            pathOpen = true;
+            pathStyle = lineStyle;
+            pathPoints = 1;
+        }
+
+        long long endX = toX(x1);
+        long long endY = toY(y1);
+        if (format == VECTOR_EPS || pathPoints > 1) {
+            put(' ');
+        }
+        putNumber(endX - startX);
+        put(' ');
+        putNumber(endY - startY);
+        if (format == VECTOR_EPS) {
+            put(" r");
+        }
+        pathX = endX;
+        pathY = endY;
+        pathPoints++;
+    }
+
+    /**
+     * Adds a polygon of one or more closed contours, filled or outlined.
+     * @param xs vertices in image coordinates
+     * @param ys
+     * @param contourEnd index after the last vertex of each contour
+     * @param contours number of contours
+     * @param pen fill color and rule, or pen color, width and join
+     * @param outline outline with the pen instead of filling?
+     */
+    void polygon(const double *xs, const double *ys, const int *contourEnd, int contours, const turtleState &pen,
+                 bool outline) {
+        if (contours == 0) {
+            return;
+        }
+        endPath();
+        setStyle(outline ? penStyle(pen) : fillStyle(pen.fillColor, pen.fillRule));
+        put(format == VECTOR_SVG ? "<path d=\"" : "n");
+        int start = 0;
+        for (int c = 0; c < contours; c++) {
+            long long lastX = 0;
+            long long lastY = 0;
+            for (int i = start; i < contourEnd[c]; i++) {
+                long long x = toX(xs[i]);
+                long long y = toY(ys[i]);
+                if (i == start) {
+                    put(format == VECTOR_SVG ? "M" : " ");
+                    putNumber(x);
+                    put(' ');
+                    putNumber(y);
+                    put(format == VECTOR_SVG ? "l" : " m");
+                } else {
+                    if (format == VECTOR_EPS || i > start + 1) {
+                        put(' ');
+                    }
+                    putNumber(x - lastX);
+                    put(' ');
+                    putNumber(y - lastY);
+                    if (format == VECTOR_EPS) put(" r");
+                }
+                lastX = x;
+                lastY = y;
+            }
+            if (contourEnd[c] > start) {
+                put(format == VECTOR_SVG ? "z" : " h");
+            }
+            start = contourEnd[c];
+        }
+        if (format == VECTOR_SVG) {
+            put("\"/>\n");
+        } else {
+            put(outline ? " s\n" : pen.fillRule == FILL_EVEN_ODD ? " e\n" : " f\n");
+        }
+    }
+
+    /**
+     * Adds a circle, filled or outlined.
+     * @param x center in image coordinates
+     * @param y
+     * @param radius
+     * @param pen fill color, or pen color and width
+     * @param outline outline with the pen instead of filling?
+     */
+    void circle(double x, double y, double radius, const turtleState &pen, bool outline) {
+        endPath();
+        setStyle(outline ? penStyle(pen) : fillStyle(pen.fillColor, FILL_NONZERO));
+        long long r = (long long) floor(radius * 100 + 0.5);
+        if (format == VECTOR_SVG) {
+            put("<circle cx=\"");
+            putNumber(toX(x));
+            put("\" cy=\"");
+            putNumber(toY(y));
+            put("\" r=\"");
+            putNumber(r);
+            put("\"/>\n");
+        } else {
+            putNumber(toX(x));
+            put(' ');
+            putNumber(toY(y));
+            put(' ');
+            putNumber(r);
+            put(outline ? " o s\n" : " o f\n");
+        }
+    }
+
+    /**
+     * Fills whole image pixels, as drawn by drawPixel() and text.
+     * @param left corners of the pixels, inclusive
+     * @param bottom
+     * @param right
+     * @param top
+     * @param color
+     */
+    void pixels(int left, int bottom, int right, int top, rgb color) {
+        endPath();
+        setStyle(fillStyle(color, FILL_NONZERO));
+        long long x = toX(left - 0.5);
+        long long y = toY(format == VECTOR_SVG ? top + 0.5 : bottom - 0.5);
+        if (format == VECTOR_SVG) {
+            put("<rect x=\"");
+            putNumber(x);
+            put("\" y=\"");
+            putNumber(y);
+            put("\" width=\"");
+            putNumber((right - left + 1) * 100LL);
+            put("\" height=\"");
+            putNumber((top - bottom + 1) * 100LL);
+            put("\"/>\n");
+        } else {
+            putNumber(x);
+            put(' ');
+            putNumber(y);
+            put(' ');
+            putNumber((right - left + 1) * 100LL);
+            put(' ');
+            putNumber((top - bottom + 1) * 100LL);
+            put(" rectfill\n");
+        }
+    }
+
+    /**
+     * Paints the whole drawing in one color, as clear() does.
+     * @param color
+     */
+    void clear(rgb color) {
+        int left = -(int) (width / 2);
+        int bottom = -(int) (height / 2);
+        pixels(left, bottom, left + (int) width - 1, bottom + (int) height - 1, color);
+    }
+
+    /**
+     * Notes a flood fill, which depends on the pixels drawn before it and is left out of the drawing.
+     */
+    void skip() {
+        skipped++;
+    }
+
+    /**
+     * Returns the number of flood fills left out.
+     */
+    unsigned long long getSkipped() const {
+        return skipped;
+    }
+
+    /**
+     * Ends the drawing and closes the file. Called by the destructor; add nothing after it.
+     */
+    void close() {
+        if (closed) {
+            return;
+        }
+        endPath();
+        if (format == VECTOR_SVG) {
+            put(styled ? "</g>\n</svg>\n" : "</svg>\n");
+        } else {
+            put("showpage\n%%EOF\n");
+        }
+        flushBuffer();
+        if (file != nullptr) {
+            bool written = fclose(file) == 0;
+            file = nullptr;
+            if (!written) {
+                fprintf(stderr, "Could not write to file: %s\n", filename.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+        closed = true;
+    }
+
+    /**
+     * Returns the drawing written so far (memory output only). Buffered text is written out first.
+     * @return SVG or EPS text
+     */
+    const std::string &getText() {
+        flushBuffer();
+        return output;
+    }
+
+private:
+    void writeHeader() {
+        originX = (double) (width / 2) + 0.5;
+        originY = format == VECTOR_SVG ? (double) (height - height / 2) - 0.5 : (double) (height / 2) + 0.5;
+        char header[512];
+        if (format == VECTOR_SVG) {
+            snprintf(header, sizeof(header),
+                     "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%u\" height=\"%u\" viewBox=\"0 0 %u %u\" "
+                     "stroke-miterlimit=\"%g\">\n<rect width=\"%u\" height=\"%u\" fill=\"#fff\"/>\n",
+                     width, height, width, height, MITER_LIMIT, width, height);
+        } else {
+            // short names for the operators used by every path, and a color operator taking bytes
+            snprintf(header, sizeof(header),
+                     "%%!PS-Adobe-3.0 EPSF-3.0\n%%%%BoundingBox: 0 0 %u %u\n%%%%EndComments\n"
+                     "/n/newpath load def /m/moveto load def /r/rlineto load def /h/closepath load def\n"
+                     "/s/stroke load def /f/fill load def /e/eofill load def\n"
+                     "/o {n 0 360 arc} bind def /c {3 {255 div 3 1 roll} repeat setrgbcolor} bind def\n"
+                     "%g setmiterlimit 1 1 1 setrgbcolor 0 0 %u %u rectfill\n",
+                     width, height, MITER_LIMIT, width, height);
+        }
+        put(header);
+    }
+
+    /**
+     * Maps image coordinates to drawing coordinates, in hundredths of a pixel.
+     */
+    long long toX(double x) const {
+        return (long long) floor((originX + x) * 100 + 0.5);
+    }
+
+    long long toY(double y) const {
+        return (long long) floor((format == VECTOR_SVG ? originY - y : originY + y) * 100 + 0.5);
+    }
+
+    static vectorStyle penStyle(const turtleState &pen) {
+        // thin lines cover the pixels of their ends, like a square cap
+        bool thick = pen.penWidth > 1.0;
+        return {true, pen.strokeColor, thick ? pen.penWidth : 1.0, thick ? pen.lineCap : CAP_SQUARE,
+                thick ? pen.lineJoin : JOIN_MITER, FILL_NONZERO};
+    }
+
+    static vectorStyle fillStyle(rgb color, turtleFillRule rule) {
+        return {false, color, 0.0, CAP_BUTT, JOIN_MITER, rule};
+    }
+
+    /**
+     * Makes the given style current: opens an SVG group with it, or changes the PostScript graphics state.
+     */
+    void setStyle(const vectorStyle &next) {
+        if (styled && style == next) {
+            return;
+        }
+        char text[256];
+        if (format == VECTOR_SVG) {
+            static const char *caps[] = {"butt", "round", "square"};
+            static const char *joins[] = {"round", "miter", "bevel"};
+            if (next.stroke) {
+                snprintf(text, sizeof(text),
+                         "%s<g fill=\"none\" stroke=\"#%02x%02x%02x\" stroke-width=\"%g\" stroke-linecap=\"%s\" "
+                         "stroke-linejoin=\"%s\">\n", styled ? "</g>\n" : "", next.color.red, next.color.green,
+                         next.color.blue, next.width, caps[next.cap], joins[next.join]);
+            } else {
+                snprintf(text, sizeof(text), "%s<g fill=\"#%02x%02x%02x\"%s>\n", styled ? "</g>\n" : "",
+                         next.color.red, next.color.green, next.color.blue,
+                         next.rule == FILL_EVEN_ODD ? " fill-rule=\"evenodd\"" : "");
+            }
+            put(text);
+        } else {
+            // PostScript joins are 0 miter, 1 round, 2 bevel; caps 0 butt, 1 round, 2 square
+            static const int joins[] = {1, 0, 2};
+            bool pen = next.stroke && (!styled || style.width != next.width || style.cap != next.cap ||
+                                       style.join != next.join);
+            if (!styled || memcmp(&style.color, &next.color, sizeof(rgb)) != 0) {
+                snprintf(text, sizeof(text), "%d %d %d c%c", next.color.red, next.color.green, next.color.blue,
+                         pen ? ' ' : '\n');
+                put(text);
+            }
+            if (pen) {
+                snprintf(text, sizeof(text), "%g setlinewidth %d setlinecap %d setlinejoin\n", next.width,
+                         (int) next.cap, joins[next.join]);
+                put(text);
+            }
+            if (!next.stroke && styled) {
+                // fills leave the pen of the graphics state as it was
+                style.color = next.color;
+                return;
+            }
+        }
+        style = next;
+        styled = true;
+    }
+
+    /**
+     * Ends the open path of lines, if any.
+     */
+    void endPath() {
+        if (!pathOpen) {
+            return;
+        }
+        put(format == VECTOR_SVG ? "\"/>\n" : " s\n");
+        pathOpen = false;
+    }
+
+    /**
+     * Appends a number given in hundredths, without trailing zeros.
+     */
+    void putNumber(long long hundredths) {
+        char digits[32];
+        char *end = digits + sizeof(digits);
+        char *p = end;
+        unsigned long long value = hundredths < 0 ? 0ULL - (unsigned long long) hundredths : (unsigned long long) hundredths;
+        unsigned int fraction = (unsigned int) (value % 100);
+        value /= 100;
+        if (fraction != 0) {
+            if (fraction % 10 != 0) {
+                *--p = (char) ('0' + fraction % 10);
+            }
+            *--p = (char) ('0' + fraction / 10);
+            *--p = '.';
+        }
+        do {
+            *--p = (char) ('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        if (hundredths < 0) {
+            *--p = '-';
+        }
+        buffer.append(p, (size_t) (end - p));
+        if (buffer.size() >= VECTOR_BUFFER) {
+            flushBuffer();
+        }
+    }
+
+    void put(const char *text) {
+        buffer.append(text);
+        if (buffer.size() >= VECTOR_BUFFER) {
+            flushBuffer();
+        }
+    }
+
+    void put(char character) {
+        buffer.push_back(character);
+        if (buffer.size() >= VECTOR_BUFFER) {
+            flushBuffer();
+        }
+    }
+
+    void flushBuffer() {
+        if (buffer.empty()) {
+            return;
+        }
+        if (file != nullptr) {
+            if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+                fprintf(stderr, "Could not write to file: %s\n", filename.c_str());
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            output.append(buffer);
+        }
+        buffer.clear();
+    }
+};
+
+class Turtle {
+    turtleState mainTurtle{};
+    turtleState backupTurtle{};
+
+    rgb *mainTurtleImage = nullptr;        // 2d pixel data field
+
+    unsigned int mainFieldWidth = 0;           // size in pixels
+    unsigned int mainFieldHeight = 0;
+    unsigned int mainFieldScale = 1;           // field pixels per image pixel along each axis (supersampling)
+    int mainFieldBlockX = 0;                   // field coordinates of the block drawn for image pixel (0,0)
+    int mainFieldBlockY = 0;
+    int mainFieldOriginX = 0;                  // image pixel shown at the center of the image (see setOrigin())
+    int mainFieldOriginY = 0;
+    int mainFieldCenterX = 0;                  // storage column and row of field coordinate 0
+    int mainFieldCenterY = 0;
+
+    bool mainFieldSaveFrames = false;  // currently saving video frames?
+    int mainFieldFrameCount = 0;   // current video frame counter
+    int mainFieldFrameInterval = 10;  // pixels per frame
+    int mainFieldPixelCount = 0;   // total pixels drawn by turtle since
+
+    // beginning of video
+    int mainTurtlePolyVertexCount = 0;       // polygon vertex count
+    double mainTurtlePolyX[MAX_POLYGON_VERTICES]{}; // polygon vertex x-coords
+    double mainTurtlePolyY[MAX_POLYGON_VERTICES]{}; // polygon vertex y-coords
+    int mainTurtleContourCount = 0;          // number of closed contours
+    int mainTurtleContourEnd[MAX_POLYGON_VERTICES]{}; // vertex index one past the end of each contour
+    unsigned long long mainTurtlePolyHash = 0;   // hash of the vertices and contours so far (see hashState())
+
+    turtleTransform mainTurtleTransform{1, 0, 0, 1, 0, 0};     // world to image coordinates
+    std::vector<turtleTransform> mainTurtleTransformStack;     // transforms saved by pushTransform()
+    bool mainTurtleTransformed = false;                        // is mainTurtleTransform not the identity?
+
+    bool mainTurtleStrokeOpen = false;       // does a thick stroke end at mainTurtleStroke, waiting for its cap?
+    strokeEnd mainTurtleStroke{};            // open end of the current thick stroke
+    std::vector<double> mainTurtleShapeX;    // contours of the thick stroke piece being filled
+    std::vector<double> mainTurtleShapeY;
+    std::vector<int> mainTurtleShapeEnd;
+
+    std::vector<turtleSpriteEntry> mainFieldTurtleSprites;  // rendered drawTurtle() sprites, direct-mapped
+    std::vector<unsigned char> mainFieldTintRow;            // pen color repeated across a sprite row, for stampMask()
+
+    unsigned long long int numPixelsOutOfBounds;
+
+    bool mainFieldReferenceMode = false;  // use the original (unoptimized) rasterizers?
+    bool mainTurtleFixed = false;         // keep positions in fixed point (see setFixedPoint())?
+    double mainTurtleVectorHeading = NAN; // heading the fixed-point heading vector was computed for
+    long long mainTurtleVectorX = 0;      // unit vector along that heading, FIXED_VECTOR_SHIFT fraction bits
+    long long mainTurtleVectorY = 0;
+    unsigned int mainFieldThreads = 0;    // worker threads for parallel work (0 = one per core)
+    bool mainFieldAntialiasFill = false;  // fill polygons with smooth (anti-aliased) edges?
+    bool mainFieldAntialiasLines = false; // draw smooth (anti-aliased) lines?
+    bool mainFieldMeasuring = false;      // only measure what would be drawn?
+    turtleTraceWriter *mainTurtleRecorder = nullptr;  // trace that records the commands, if any
+    turtleMeasurement mainFieldMeasurement{};  // what was drawn since measuring started
+    turtleVectorWriter *mainFieldVector = nullptr;  // drawing that measured primitives are written to, if any
+    int mainFieldClipLeft = 0;            // drawing is limited to these field columns and rows (see setClip())
+    int mainFieldClipBottom = 0;
+    int mainFieldClipRight = -1;
+    int mainFieldClipTop = -1;
+    bool mainFieldClipped = false;        // is the clip smaller than the field?
+    bool mainFieldWindow = false;         // is the image a window on a larger one (see setOrigin())?
+    turtleBounds mainFieldTouched{0, 0, -1, -1};  // field pixels drawing may have written (see takeTouched())
+
+public:
+
+    /**
+     * Initializes the 2d field that the turtle moves on.
+     * With supersampling, every image pixel is drawn as a block of supersample x supersample field pixels,
+     * and saveBMP() writes the average of each block.
+     * @param width image width
+     * @param height image height
+     * @param supersample field pixels per image pixel along each axis (1 to MAX_SUPERSAMPLE)
+     */
+    Turtle(unsigned int width, unsigned int height, unsigned int supersample = 1) {
+        numPixelsOutOfBounds = 0;
+
+        if (supersample < 1 || supersample > MAX_SUPERSAMPLE) {
+            fprintf(stderr, "Supersampling factor must be between 1 and %d.\n", MAX_SUPERSAMPLE);
+            exit(EXIT_FAILURE);
+        }
+
+        // image pixel (0,0) is the block whose corner lies where the unsupersampled field center would be
+        mainFieldScale = supersample;
+        mainFieldBlockX = (int) (width / 2 * supersample) - (int) (width * supersample / 2);
+        mainFieldBlockY = (int) (height / 2 * supersample) - (int) (height * supersample / 2);
+        width *= supersample;
+        height *= supersample;
+
+        auto totalSize = sizeof(rgb) * width * height;
+
+        // allocate new image and initialize it to white
+        mainTurtleImage = (rgb *) malloc(totalSize);
+        if (mainTurtleImage == nullptr) {
+            fprintf(stderr, "Can't allocate memory for turtle image.\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(mainTurtleImage, 255, totalSize);
+
+        // save field size for later
+        mainFieldWidth = width;
+        mainFieldHeight = height;
+        mainFieldCenterX = (int) (width / 2);
+        mainFieldCenterY = (int) (height / 2);
+        resetClip();
+
+        // disable video
+        mainFieldSaveFrames = false;
+
+        // reset turtle position and color
+        reset();
+
+        // create backup at the initial position
+        backup();
+    }
+
+    ~Turtle() {
+        cleanup();
+    }
+
+    /**
+     * Resets the turtle's location, orientation, color, and pen status to the default values:
+     * center of the field (0,0), facing right (0 degrees), black stroke and green fill color, pen down.
+     */
+    void reset() {
+        if (recordCommand(OP_RESET)) return;
+        // move turtle to middle of the field
+        mainTurtle.xpos = 0.0;
+        mainTurtle.ypos = 0.0;
+
+        // orient to the right (0 deg)
+        mainTurtle.heading = 0.0;
+
+        // default stroke color is black
+        mainTurtle.strokeColor.red = 0;
+        mainTurtle.strokeColor.green = 0;
+        mainTurtle.strokeColor.blue = 0;
+
+        // default fill color is black
+        mainTurtle.fillColor.red = 0;
+        mainTurtle.fillColor.green = 255;
+        mainTurtle.fillColor.blue = 0;
+
+        // default pen position is down
+        mainTurtle.pendown = true;
+
+        // default fill status is off
+        mainTurtle.filled = false;
+        mainTurtle.fillRule = FILL_EVEN_ODD;
+        mainTurtlePolyVertexCount = 0;
+        mainTurtlePolyHash = 0;
+
+        // default pen is one pixel wide, with round corners and ends when widened
+        mainTurtle.penWidth = 1.0;
+        mainTurtle.lineJoin = JOIN_ROUND;
+        mainTurtle.lineCap = CAP_ROUND;
+        mainTurtleContourCount = 0;
+
+        // world coordinates are image coordinates again
+        resetTransform();
+        mainTurtleTransformStack.clear();
+    }
+
+
+    /**
+     * Creates a backup of the current turtle.
+     * The backup can be restored by using restore().
+     * Useful in complex drawing situations.
+     */
+    void backup() {
+        if (recordCommand(OP_BACKUP)) return;
+        backupTurtle = mainTurtle;
+    }
+
+
+    /**
+     * Restores the turtle from the backup.
+     */
+    void restore() {
+        if (recordCommand(OP_RESTORE)) return;
+        mainTurtle = backupTurtle;
+    }
+
+
+    /**
+     * Fills the whole field with one color, erasing everything drawn so far.
+     * The turtle keeps its position and settings; with reset() and backup(), the field can be reused
+     * for a new image without allocating it again.
+     * @param red
+     * @param green
+     * @param blue
+     */
+    void clear(int red = 255, int green = 255, int blue = 255) {
+        if (recordCommand(OP_CLEAR, red, green, blue)) return;
+        flushStroke();
+        if (mainFieldMeasuring) {
+            if (mainFieldVector != nullptr) {
+                mainFieldVector->clear({(unsigned char) red, (unsigned char) green, (unsigned char) blue});
+            }
+            return;
+        }
+        reaches(-mainFieldCenterX, -mainFieldCenterY,
+                (int) mainFieldWidth - 1 - mainFieldCenterX, (int) mainFieldHeight - 1 - mainFieldCenterY);
+        if (mainFieldClipped) {
+            rgb color = {(unsigned char) red, (unsigned char) green, (unsigned char) blue};
+            for (int row = mainFieldClipBottom; row <= mainFieldClipTop; row++) {
+                fillRun(mainTurtleImage + (size_t) row * mainFieldWidth + mainFieldClipLeft,
+                        mainFieldClipRight - mainFieldClipLeft + 1, color);
+            }
+            return;
+        }
+
+        size_t count = (size_t) mainFieldWidth * mainFieldHeight;
+        if (red == green && green == blue) {
+            memset(mainTurtleImage, red, count * sizeof(rgb));
+            return;
+        }
+
+        // fill one pixel, then keep doubling the filled part
+        mainTurtleImage[0] = {(unsigned char) red, (unsigned char) green, (unsigned char) blue};
+        for (size_t filled = 1; filled < count; filled *= 2) {
+            memcpy(mainTurtleImage + filled, mainTurtleImage, std::min(filled, count - filled) * sizeof(rgb));
+        }
+    }
+
+
+    /**
+     * Moves the turtle forward, drawing a straight line if the pen is down.
+     * @param pixels movement distance
+     */
+    void forward(int pixels) {
+        if (recordCommand(OP_FORWARD, pixels)) return;
+        if (mainTurtleFixed) {
+            // in 1/256 pixels, from the fixed-point heading vector
+            if (!(mainTurtle.heading == mainTurtleVectorHeading)) {
+                double radians = mainTurtle.heading * M_PI / 180.0;
+                mainTurtleVectorX = roundToInteger(cos(radians) * (1 << FIXED_VECTOR_SHIFT));
+                mainTurtleVectorY = roundToInteger(sin(radians) * (1 << FIXED_VECTOR_SHIFT));
+                mainTurtleVectorHeading = mainTurtle.heading;
+            }
+            const int shift = FIXED_VECTOR_SHIFT - FIXED_SHIFT;
+            long long x = toFixed(mainTurtle.xpos) + ((pixels * mainTurtleVectorX + (1 << (shift - 1))) >> shift);
+            long long y = toFixed(mainTurtle.ypos) + ((pixels * mainTurtleVectorY + (1 << (shift - 1))) >> shift);
+            goTo((double) x / FIXED_ONE, (double) y / FIXED_ONE);
+            return;
+        }
+
+        // calculate (x,y) movement vector from heading
+        double radians = mainTurtle.heading * M_PI / 180.0;
+        double dx = cos(radians) * pixels;
+        double dy = sin(radians) * pixels;
+
+        // delegate to another method to actually move
+        goTo(mainTurtle.xpos + dx, mainTurtle.ypos + dy);
+    }
+
+
+    /**
+     * Moves the turtle backward, drawing a straight line if the pen is down.
+     * @param pixels movement distance
+     */
+    void backward(int pixels) {
+        if (recordCommand(OP_BACKWARD, pixels)) return;
+        // opposite of "forward"
+        forward(-pixels);
+    }
+
+    /**
+     * Moves the turtle left.
+     * @param pixels movement distance
+     */
+    void strafeLeft(int pixels) {
+        if (recordCommand(OP_STRAFE_LEFT, pixels)) return;
+        turnLeft(90);
+        forward(pixels);
+        turnRight(90);
+    }
+
+    /**
+     * Moves the turtle right.
+     * @param pixels movement distance
+     */
+    void strafeRight(int pixels) {
+        if (recordCommand(OP_STRAFE_RIGHT, pixels)) return;
+        turnRight(90);
+        forward(pixels);
+        turnLeft(90);
+    }
+
+
+    /**
+     * Turns the turtle to the left by the specified number of degrees.
+     * @param angle
+     */
+    void turnLeft(double angle) {
+        if (recordCommand(OP_TURN_LEFT, angle)) return;
+        // rotate turtle heading
+        mainTurtle.heading += angle;
+
+        // constrain heading to range: [0.0, 360.0)
+        if (mainTurtle.heading < 0.0) {
+            mainTurtle.heading += 360.0;
+        } else if (mainTurtle.heading >= 360.0) {
+            mainTurtle.heading -= 360.0;
+        }
+    }
+
+
+    /**
+     * Turns the turtle to the right by the specified number of degrees.
+     * @param angle
+     */
+    void turnRight(double angle) {
+        if (recordCommand(OP_TURN_RIGHT, angle)) return;
+        // opposite of "turn left"
+        turnLeft(-angle);
+    }
+
+
+    /**
+     * Sets the pen status to "up" (do not draw).
+     */
+    void penUp() {
+        if (recordCommand(OP_PEN_UP)) return;
+        flushStroke();
+        mainTurtle.pendown = false;
+    }
+
+
+    /**
+     * Sets the pen status to "down" (draw).
+     */
+    void penDown() {
+        if (recordCommand(OP_PEN_DOWN)) return;
+        mainTurtle.pendown = true;
+    }
+
+
+    /**
+     * Starts filling.
+     * Call this before drawing a polygon to activate the bookkeeping required to run the filling algorithm later.
+     */
+    void beginFill() {
+        if (recordCommand(OP_BEGIN_FILL)) return;
+        mainTurtle.filled = true;
+        mainTurtlePolyVertexCount = 0;
+        mainTurtleContourCount = 0;
+        mainTurtlePolyHash = 0;
+    }
+
+
+    /**
+     * Closes the current contour of the fill and starts a new one.
+     * All contours recorded between beginFill() and endFill() are filled together in one pass,
+     * which allows shapes with holes and several separate islands.
+     */
+    void closeContour() {
+        if (recordCommand(OP_CLOSE_CONTOUR)) return;
+        int start = mainTurtleContourCount > 0 ? mainTurtleContourEnd[mainTurtleContourCount - 1] : 0;
+        if (mainTurtlePolyVertexCount > start) {
+            mainTurtleContourEnd[mainTurtleContourCount++] = mainTurtlePolyVertexCount;
+            mainTurtlePolyHash = hashBytes((const unsigned char *) &mainTurtlePolyVertexCount, sizeof(int),
+                                           mainTurtlePolyHash);
+        }
+    }
+
+
+    /**
+     * Sets the rule deciding which parts of overlapping contours are filled.
+     * FILL_EVEN_ODD (the default) leaves holes wherever contours overlap;
+     * FILL_NONZERO only leaves holes inside contours running in the opposite direction.
+     * @param rule
+     */
+    void setFillRule(turtleFillRule rule) {
+        if (recordCommand(OP_SET_FILL_RULE, rule)) return;
+        mainTurtle.fillRule = rule;
+    }
+
+
+    /**
+     * Enables or disables anti-aliased polygon filling.
+     * When enabled, endFill() computes the exact area of each pixel covered by the polygon
+     * and blends the fill color accordingly, giving smooth edges at close to the cost of a regular fill.
+     * @param enabled
+     */
+    void setFillAntialiasing(bool enabled) {
+        if (recordCommand(OP_SET_FILL_ANTIALIASING, enabled)) return;
+        mainFieldAntialiasFill = enabled;
+    }
+
+
+    /**
+     * Enables or disables anti-aliased lines.
+     * When enabled, forward(), goTo() and drawLine() use Xiaolin Wu's algorithm:
+     * lines keep their real-valued endpoints and are blended into the field with gamma-correct coverage.
+     * Supersampled fields smooth lines by downsampling instead and ignore this setting.
+     * @param enabled
+     */
+    void setLineAntialiasing(bool enabled) {
+        if (recordCommand(OP_SET_LINE_ANTIALIASING, enabled)) return;
+        mainFieldAntialiasLines = enabled;
+    }
+
+
+    /**
+     * Sets the width of the pen in pixels.
+     * Wider pens draw lines, turtle paths and circle outlines as filled shapes,
+     * with corners and ends shaped by setLineJoin() and setLineCap(). Widths up to 1 draw 1-pixel lines.
+     * @param width
+     */
+    void setPenWidth(double width) {
+        if (recordCommand(OP_SET_PEN_WIDTH, width)) return;
+        mainTurtle.penWidth = width;
+    }
+
+
+    /**
+     * Sets how corners of thick strokes are drawn.
+     * @param join JOIN_ROUND, JOIN_MITER or JOIN_BEVEL
+     */
+    void setLineJoin(turtleLineJoin join) {
+        if (recordCommand(OP_SET_LINE_JOIN, join)) return;
+        mainTurtle.lineJoin = join;
+    }
+
+
+    /**
+     * Sets how the ends of thick strokes are drawn.
+     * @param cap CAP_BUTT, CAP_ROUND or CAP_SQUARE
+     */
+    void setLineCap(turtleLineCap cap) {
+        if (recordCommand(OP_SET_LINE_CAP, cap)) return;
+        mainTurtle.lineCap = cap;
+    }
+
+
+    /**
+     * Moves the world origin by the given distance, in current world units.
+     * The world transform maps turtle coordinates to image pixels whenever the turtle draws: lines and fills,
+     * and the positions of dot(), drawTurtle(), drawText() and fillCircle(radius). Pen widths, text and
+     * the explicit pixel functions (drawPixel(), drawLine(), ...) stay in image pixels.
+     * @param dx
+     * @param dy
+     */
+    void translate(double dx, double dy) {
+        if (recordCommand(OP_TRANSLATE, dx, dy)) return;
+        turtleTransform &m = mainTurtleTransform;
+        m.x0 += m.xx * dx + m.xy * dy;
+        m.y0 += m.yx * dx + m.yy * dy;
+        mainTurtleTransformed = !isIdentity(m);
+    }
+
+
+    /**
+     * Rotates the world around its origin, counterclockwise by the given number of degrees.
+     * @param angle
+     */
+    void rotate(double angle) {
+        if (recordCommand(OP_ROTATE, angle)) return;
+        double radians = angle * M_PI / 180.0;
+        double c = cos(radians);
+        double s = sin(radians);
+        turtleTransform &m = mainTurtleTransform;
+        m = {m.xx * c + m.xy * s, m.yx * c + m.yy * s, m.xy * c - m.xx * s, m.yy * c - m.yx * s, m.x0, m.y0};
+        mainTurtleTransformed = !isIdentity(m);
+    }
+
+
+    /**
+     * Scales the world around its origin by the given factor.
+     * @param factor
+     */
+    void scale(double factor) {
+        scale(factor, factor);
+    }
+
+
+    /**
+     * Scales the world around its origin, separately along each axis.
+     * @param sx
+     * @param sy
+     */
+    void scale(double sx, double sy) {
+        if (recordCommand(OP_SCALE, sx, sy)) return;
+        turtleTransform &m = mainTurtleTransform;
+        m.xx *= sx;
+        m.yx *= sx;
+        m.xy *= sy;
+        m.yy *= sy;
+        mainTurtleTransformed = !isIdentity(m);
+    }
+
+
+    /**
+     * Saves the world transform, to be restored by popTransform().
+     */
+    void pushTransform() {
+        if (recordCommand(OP_PUSH_TRANSFORM)) return;
+        mainTurtleTransformStack.push_back(mainTurtleTransform);
+    }
+
+
+    /**
+     * Restores the world transform saved by the matching pushTransform().
+     */
+    void popTransform() {
+        if (recordCommand(OP_POP_TRANSFORM)) return;
+        if (mainTurtleTransformStack.empty()) {
+            fprintf(stderr, "popTransform() without a matching pushTransform()\n");
+            exit(EXIT_FAILURE);
+        }
+        mainTurtleTransform = mainTurtleTransformStack.back();
+        mainTurtleTransformStack.pop_back();
+        mainTurtleTransformed = !isIdentity(mainTurtleTransform);
+    }
+
+
+    /**
+     * Makes world coordinates equal to image coordinates again. Saved transforms are kept.
+     */
+    void resetTransform() {
+        if (recordCommand(OP_RESET_TRANSFORM)) return;
+        mainTurtleTransform = {1, 0, 0, 1, 0, 0};
+        mainTurtleTransformed = false;
+    }
+
+
+    /**
+     * Ends filling.
+     * Call this after drawing a polygon to trigger the fill algorithm.
+     * The filled polygon may have up to 128 sides in total, spread over any number of contours.
+     */
+    void endFill() {
+        if (recordCommand(OP_END_FILL)) return;
+        if (mainFieldMeasuring) {
+            measureFill();
+            return;
+        }
+        flushStroke();
+
+        const double *xs = mainTurtlePolyX;
+        const double *ys = mainTurtlePolyY;
+        double fieldX[MAX_POLYGON_VERTICES];
+        double fieldY[MAX_POLYGON_VERTICES];
+        if (mainFieldScale > 1) {
+            for (int i = 0; i < mainTurtlePolyVertexCount; i++) {
+                fieldX[i] = toFieldX(mainTurtlePolyX[i]);
+                fieldY[i] = toFieldY(mainTurtlePolyY[i]);
+            }
+            xs = fieldX;
+            ys = fieldY;
+        }
+
+        if (mainFieldReferenceMode) {
+            endFillReference(xs, ys);
+            return;
+        }
+
+        closeContour();
+        fillPolygon(xs, ys, mainTurtleContourEnd, mainTurtleContourCount, mainTurtle.fillRule, mainTurtle.fillColor,
+                    mainFieldAntialiasFill);
+
+        mainTurtle.filled = false;
+
+        // redraw polygon (filling is imperfect and can occasionally occlude sides)
+        redrawPolygon();
+    }
+
+
+    /**
+     * Moves the turtle to the specified location, drawing a straight line if the pen is down.
+     * Takes integer coordinate parameters.
+     * @param x
+     * @param y
+     */
+    void goTo(int x, int y) {
         goTo((double) x, (double) y);
     }
 
 
     /**
-     * Moves the turtle to the specified location, drawing a straight line if the pen is down.
-     * Takes real-numbered coordinate parameters, and is also used internally to implement forward and backward motion.
+     * Moves the turtle to the specified location, drawing a straight line if the pen is down.
+     * Takes real-numbered coordinate parameters, and is also used internally to implement forward and backward motion.
+     * @param x
+     * @param y
+     */
+    void goTo(double x, double y) {
+        if (recordCommand(OP_GO_TO, x, y)) return;
+        if (mainTurtleFixed) {
+            x = toFixedGrid(x);
+            y = toFixedGrid(y);
+        }
+        double imageX = x;
+        double imageY = y;
+        if (mainTurtleTransformed) {
+            toImage(x, y, imageX, imageY);
+        }
+
+        // draw line if pen is down
+        if (mainTurtle.pendown) {
+            double startX = mainTurtle.xpos;
+            double startY = mainTurtle.ypos;
+            if (mainTurtleTransformed) {
+                toImage(mainTurtle.xpos, mainTurtle.ypos, startX, startY);
+            }
+            strokeVisible(startX, startY, imageX, imageY);
+        }
+
+        // change current turtle position
+        mainTurtle.xpos = (double) x;
+        mainTurtle.ypos = (double) y;
+
+        // track coordinates for filling (in image coordinates, as the transform may change before endFill)
+        if (mainTurtle.filled && mainTurtle.pendown &&
+            mainTurtlePolyVertexCount < MAX_POLYGON_VERTICES) {
+            mainTurtlePolyX[mainTurtlePolyVertexCount] = imageX;
+            mainTurtlePolyY[mainTurtlePolyVertexCount] = imageY;
+            mainTurtlePolyVertexCount++;
+            const double vertex[] = {imageX, imageY};
+            mainTurtlePolyHash = hashBytes((const unsigned char *) vertex, sizeof(vertex), mainTurtlePolyHash);
+        }
+    }
+
+
+    /**
+     * Rotates the turtle to the given heading (in degrees).
+     * 0 degrees means facing to the right.
+     * 90 degrees means facing straight up.
+     * @param angle
+     */
+    void setHeading(double angle) {
+        if (recordCommand(OP_SET_HEADING, angle)) return;
+        mainTurtle.heading = angle;
+    }
+
+
+    /**
+     * Set the current drawing color.
+     * Each component (red, green, and blue) may be any value between 0 and 255 (inclusive).
+     * Black is (0,0,0) and white is (255,255,255).
+     * @param red
+     * @param green
+     * @param blue
+     */
+    void setPenColor(int red, int green, int blue) {
+        if (recordCommand(OP_SET_PEN_COLOR, red, green, blue)) return;
+        mainTurtle.strokeColor.red = red;
+        mainTurtle.strokeColor.green = green;
+        mainTurtle.strokeColor.blue = blue;
+    }
+
+
+    /**
+     * Set the current filling color.
+     * Each component (red, green, and blue) may be any value between 0 and 255 (inclusive).
+     * Black is (0,0,0) and white is (255,255,255).
+     * @param red
+     * @param green
+     * @param blue
+     */
+    void setFillColor(int red, int green, int blue) {
+        if (recordCommand(OP_SET_FILL_COLOR, red, green, blue)) return;
+        mainTurtle.fillColor.red = red;
+        mainTurtle.fillColor.green = green;
+        mainTurtle.fillColor.blue = blue;
+    }
+
+
+    /**
+     * Draws a 1-pixel dot at the current location, regardless of pen status.
+     */
+    void dot() {
+        if (recordCommand(OP_DOT)) return;
+        double x, y;
+        toImage(mainTurtle.xpos, mainTurtle.ypos, x, y);
+
+        // draw a pixel at the current location, regardless of pen status
+        drawPixel((int) round(x), (int) round(y));
+    }
+
+
+    /**
+     * Draw a 1-pixel dot at the given location using the current draw color,
+     * regardless of current turtle location or pen status.
+     * @param x
+     * @param y
+     */
+    void drawPixel(int x, int y) {
+        if (recordCommand(OP_DRAW_PIXEL, x, y)) return;
+        if (mainFieldMeasuring) {
+            measureBox(x, y, x, y, 1.0);
+            if (mainFieldVector != nullptr) {
+                mainFieldVector->pixels(x, y, x, y, mainTurtle.strokeColor);
+            }
+            return;
+        }
+        flushStroke();
+        if (mainFieldScale == 1) {
+            plotPixel(x, y);
+            return;
+        }
+
+        // blocks never straddle the field border, so checking one corner is enough
+        int left = blockX(x);
+        int bottom = blockY(y);
+        if (!insideField(left, bottom)) {
+            if (!mainFieldClipped && !mainFieldWindow && ++numPixelsOutOfBounds < 100) {
+                fprintf(stderr, "Pixel out of bounds: (%d,%d)\n", x, y);
+            }
+            return;
+        }
+        fillBlock(left, bottom, mainTurtle.strokeColor);
+
+        if (mainFieldSaveFrames &&
+            mainFieldPixelCount++ % mainFieldFrameInterval == 0) {
+            saveFrame();
+        }
+    }
+
+
+    /**
+     * Draws a 1-pixel dot at the given location using the current fill color,
+     * regardless of current turtle location or pen status.
+     * @param x
+     * @param y
+     */
+    void fillPixel(int x, int y) {
+        markUntraced();
+        if (mainFieldMeasuring) {
+            measureBox(x, y, x, y, 1.0);
+            if (mainFieldVector != nullptr) {
+                mainFieldVector->pixels(x, y, x, y, mainTurtle.fillColor);
+            }
+            return;
+        }
+        flushStroke();
+        if (mainFieldScale == 1) {
+            plotFillPixel(x, y);
+            return;
+        }
+
+        int left = blockX(x);
+        int bottom = blockY(y);
+        if (insideField(left, bottom)) {
+            fillBlock(left, bottom, mainTurtle.fillColor);
+        }
+    }
+
+
+    /**
+     * Draw a straight line between the given coordinates, regardless of current turtle location or pen status.
+     * @param x0
+     * @param y0
+     * @param x1
+     * @param y1
+     */
+    void drawLine(int x0, int y0, int x1, int y1) {
+        if (recordCommand(OP_DRAW_LINE, x0, y0, x1, y1)) return;
+        if (mainFieldMeasuring) {
+            measureSegment(x0, y0, x1, y1);
+            if (mainFieldVector != nullptr) {
+                mainFieldVector->line(x0, y0, x1, y1, mainTurtle, false);
+            }
+            return;
+        }
+        flushStroke();
+        if (mainTurtle.penWidth > 1.0) {
+            strokeThick(toFieldX(x0), toFieldY(y0), toFieldX(x1), toFieldY(y1), true);
+            flushStroke();
+            return;
+        }
+
+        if (mainFieldScale > 1) {
+            int center = (int) (mainFieldScale - 1) / 2;
+            drawBand(blockX(x0) + center, blockY(y0) + center, blockX(x1) + center, blockY(y1) + center);
+            return;
+        }
+
+        if (mainFieldAntialiasLines) {
+            drawLineAntialiased(x0, y0, x1, y1);
+            return;
+        }
+
+        rasterLine(x0, y0, x1, y1);
+    }
+
+
+    /**
+     * Draws a circle at the given coordinates with the given radius, regardless of current turtle location or pen status.
+     * @param x0
+     * @param y0
+     * @param radius
+     */
+    void drawCircle(int x0, int y0, int radius) {
+        if (recordCommand(OP_DRAW_CIRCLE, x0, y0, radius)) return;
+        // implementation based on midpoint circle algorithm:
+        //   https://en.wikipedia.org/wiki/Midpoint_circle_algorithm
+
+        int x = radius;
+        int y = 0;
+        int switch_criteria = 1 - x;
+
+        if (mainTurtle.filled) {
+            fillCircle(x0, y0, radius);
+        }
+        if (mainFieldMeasuring) {
+            double reach = radius + std::max(mainTurtle.penWidth, 1.0) / 2.0;
+            measureBox(x0 - reach, y0 - reach, x0 + reach, y0 + reach, 2.0 * M_PI * radius * std::max(mainTurtle.penWidth, 1.0));
+            mainFieldMeasurement.circles++;
+            if (mainFieldVector != nullptr) {
+                mainFieldVector->circle(x0, y0, radius, mainTurtle, true);
+            }
+            return;
+        }
+        flushStroke();
+
+        if (mainFieldScale > 1 || mainTurtle.penWidth > 1.0) {
+            // the outline becomes a ring as wide as the pen
+            int scale = (int) mainFieldScale;
+            int thickness = (int) fmax(round(mainTurtle.penWidth * scale), scale);
+            int outer = radius * scale + (thickness + 1) / 2;
+            fillRing(blockX(x0) + scale / 2, blockY(y0) + scale / 2, outer - thickness, outer, mainTurtle.strokeColor);
+            return;
+        }
+        if (!reaches(x0 - radius, y0 - radius, x0 + radius, y0 + radius)) {
+            return;
+        }
+
+        while (x >= y) {
+            plotPixel(x + x0, y + y0);
+            plotPixel(y + x0, x + y0);
+            plotPixel(-x + x0, y + y0);
+            plotPixel(-y + x0, x + y0);
+            plotPixel(-x + x0, -y + y0);
+            plotPixel(-y + x0, -x + y0);
+            plotPixel(x + x0, -y + y0);
+            plotPixel(y + x0, -x + y0);
+            y++;
+            if (switch_criteria <= 0) {
+                switch_criteria += 2 * y + 1;       // no x-coordinate change
+            } else {
+                x--;
+                switch_criteria += 2 * (y - x) + 1;
+            }
+        }
+    }
+
+
+    /**
+     * Fill a circle at the given coordinates with the given radius, regardless of current turtle location or pen status.
+     * @param x0
+     * @param y0
+     * @param radius
+     */
+    void fillCircle(int x0, int y0, int radius) {
+        if (recordCommand(OP_FILL_CIRCLE, x0, y0, radius)) return;
+        if (mainFieldMeasuring) {
+            measureBox(x0 - radius, y0 - radius, x0 + radius, y0 + radius, M_PI * radius * radius);
+            mainFieldMeasurement.circles++;
+            if (mainFieldVector != nullptr) {
+                // the filled pixels reach half a pixel past the radius
+                mainFieldVector->circle(x0, y0, radius + 0.5, mainTurtle, false);
+            }
+            return;
+        }
+        flushStroke();
+        int scale = (int) mainFieldScale;
+        int x = blockX(x0) + scale / 2;
+        int y = blockY(y0) + scale / 2;
+
+        if (mainFieldReferenceMode) {
+            fillCircleReference(x, y, radius * scale);
+            return;
+        }
+
+        fillRing(x, y, 0, radius * scale, mainTurtle.fillColor);
+    }
+
+
+    /**
+     * Fills the region of same-colored pixels containing the given location with the current fill color
+     * (bucket fill), regardless of current turtle location or pen status.
+     * Uses a span-based scanline algorithm with an explicit stack, so regions of any size are safe.
+     * @param x
+     * @param y
+     */
+    void floodFill(int x, int y) {
+        if (recordCommand(OP_FLOOD_FILL, x, y)) return;
+        if (mainFieldMeasuring) {
+            mainFieldMeasurement.fills++;
+            if (mainFieldVector != nullptr) {
+                mainFieldVector->skip();
+            }
+            return;
+        }
+
+        // based on the combined scan-and-fill span algorithm (Smith 1979, Heckbert 1990)
+        flushStroke();
+        reaches(-mainFieldCenterX, -mainFieldCenterY,
+                (int) mainFieldWidth - 1 - mainFieldCenterX, (int) mainFieldHeight - 1 - mainFieldCenterY);
+        x = blockX(x) + (int) (mainFieldScale - 1) / 2;
+        y = blockY(y) + (int) (mainFieldScale - 1) / 2;
+        if (!insideClip(x, y)) {
+            return;
+        }
+
+        // the region ends at the clip, which is the whole field unless setClip() was called
+        int width = (int) mainFieldWidth;
+        int height = (int) mainFieldHeight;
+        int leftmost = mainFieldClipLeft;
+        int rightmost = mainFieldClipRight;
+        int column = x + mainFieldCenterX;
+        int row = y + mainFieldCenterY;
+        rgb target = mainTurtleImage[(size_t) row * width + column];
+        rgb color = mainTurtle.fillColor;
+        if (sameColor(target, color)) {
+            return;
+        }
+
+        // every stacked span is a row segment whose neighbors still need scanning;
+        // start with room for a few spans per row and grow only for very ragged regions
+        size_t capacity = 4 * (size_t) height + 64;
+        size_t count = 0;
+        auto *stack = (floodSpan *) malloc(capacity * sizeof(floodSpan));
+        if (stack == nullptr) {
+            fprintf(stderr, "Can't allocate memory for flood fill.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        auto push = [&](int left, int right, int spanRow, int direction) {
+            if (spanRow < mainFieldClipBottom || spanRow > mainFieldClipTop) {
+                return;
+            }
+            if (count == capacity) {
+                capacity *= 2;
+                stack = (floodSpan *) realloc(stack, capacity * sizeof(floodSpan));
+                if (stack == nullptr) {
+                    fprintf(stderr, "Can't allocate memory for flood fill.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            stack[count++] = {left, right, spanRow, direction};
+        };
+
+        push(column, column, row, 1);
+        push(column, column, row - 1, -1);
+
+        while (count > 0) {
+            floodSpan span = stack[--count];
+            rgb *line = mainTurtleImage + (size_t) span.row * width;
+            int left = span.left;
+            int x1 = span.left;
+
+            // extend the run to the left of the parent span
+            if (sameColor(line[left], target)) {
+                while (left > leftmost && sameColor(line[left - 1], target)) {
+                    left--;
+                }
+                if (left < span.left) {
+                    push(left, span.left - 1, span.row - span.direction, -span.direction);
+                }
+            }
+
+            // scan the runs below the parent span, filling each with a single span write
+            while (x1 <= span.right) {
+                while (x1 <= rightmost && sameColor(line[x1], target)) {
+                    x1++;
+                }
+                if (x1 > left) {
+                    fillRun(line + left, x1 - left, color);
+                    push(left, x1 - 1, span.row + span.direction, span.direction);
+                    if (x1 - 1 > span.right) {
+                        push(span.right + 1, x1 - 1, span.row - span.direction, -span.direction);
+                    }
+                }
+                x1++;
+                while (x1 < span.right && !sameColor(line[x1], target)) {
+                    x1++;
+                }
+                left = x1;
+            }
+        }
+
+        free(stack);
+    }
+
+
+    /**
+     * Fills a circle at the current coordinates with the given radius.
+     * @param radius
+     */
+    void fillCircle(int radius) {
+        if (!mainTurtleTransformed) {
+            fillCircle(mainTurtle.xpos, mainTurtle.ypos, radius);
+            return;
+        }
+
+        // a non-uniform scale would make an ellipse; keep the circle of the same area
+        const turtleTransform &m = mainTurtleTransform;
+        double x, y;
+        toImage(mainTurtle.xpos, mainTurtle.ypos, x, y);
+        fillCircle((int) x, (int) y, (int) round(radius * sqrt(fabs(m.xx * m.yy - m.xy * m.yx))));
+    }
+
+
+    /**
+     * Draws a turtle at the current location.
+     * The turtle is placed on whole pixels and turned to whole degrees, so each combination of heading and colors
+     * is rasterized once and then copied onto the field.
+     */
+    void drawTurtle() {
+        if (recordCommand(OP_DRAW_TURTLE)) return;
+        flushStroke();
+
+        double imageX, imageY;
+        toImage(mainTurtle.xpos, mainTurtle.ypos, imageX, imageY);
+        double heading = mainTurtle.heading;
+        if (mainTurtleTransformed) {
+            // point the turtle along the image of its heading
+            double radians = heading * M_PI / 180.0;
+            const turtleTransform &m = mainTurtleTransform;
+            heading = atan2(m.yx * cos(radians) + m.yy * sin(radians),
+                            m.xx * cos(radians) + m.xy * sin(radians)) * 180.0 / M_PI;
+        }
+
+        int x = (int) floor(imageX + 0.5);
+        int y = (int) floor(imageY + 0.5);
+        int degrees = (int) floor(fmod(heading, 360.0) + 0.5);
+        degrees = (degrees % 360 + 360) % 360;
+
+        if (mainFieldVector != nullptr) {
+            drawTurtleCircles(x, y, degrees);
+        } else if (mainFieldMeasuring) {
+            // the legs and the head reach 15 pixels from the center
+            measureBox(x - 15, y - 15, x + 15, y + 15, M_PI * 15 * 15);
+        } else if (mainFieldReferenceMode) {
+            drawTurtleCircles(x, y, degrees);
+        } else {
+            stampSprite(turtleSpriteFor(degrees), x, y);
+        }
+    }
+
+
+    /**
+     * Renders a sequence of turtle commands once, so the result can be stamped many times.
+     * The commands run on a fresh turtle in the middle of a scratch field of (2 * radius + 1) pixels squared,
+     * with this turtle's supersampling and anti-aliasing settings. Commands that read the field (floodFill)
+     * see the scratch background, not the field the sprite is later stamped on.
+     * @param commands commands to render
+     * @param count number of commands
+     * @param radius largest distance from the start position that the commands draw at
+     * @return sprite anchored at the start position
+     */
+    turtleSprite createSprite(const turtleCommand *commands, size_t count, unsigned int radius) {
+        Turtle dark(2 * radius + 1, 2 * radius + 1, mainFieldScale);
+        Turtle light(2 * radius + 1, 2 * radius + 1, mainFieldScale);
+        memset(dark.mainTurtleImage, 0, sizeof(rgb) * dark.mainFieldWidth * dark.mainFieldHeight);
+        for (Turtle *canvas : {&dark, &light}) {
+            canvas->mainFieldAntialiasFill = mainFieldAntialiasFill;
+            canvas->mainFieldAntialiasLines = mainFieldAntialiasLines;
+            canvas->execute(commands, count);
+            canvas->flushStroke();
+        }
+        return spriteFromRenders(dark, light);
+    }
+
+
+    /**
+     * Draws a sprite in its own colors with its anchor at the given location, clipped to the field.
+     * @param sprite sprite made by createSprite()
+     * @param x
+     * @param y
+     */
+    void stamp(const turtleSprite &sprite, int x, int y) {
+        markUntraced();
+        if (mainFieldMeasuring) {
+            measureSprite(sprite, x, y);
+            return;
+        }
+        flushStroke();
+        stampSprite(sprite, x, y);
+    }
+
+
+    /**
+     * Draws the shape of a sprite in the current pen color with its anchor at the given location,
+     * clipped to the field.
+     * @param sprite sprite made by createSprite()
+     * @param x
+     * @param y
+     */
+    void stampMask(const turtleSprite &sprite, int x, int y) {
+        markUntraced();
+        if (mainFieldMeasuring) {
+            measureSprite(sprite, x, y);
+            return;
+        }
+        flushStroke();
+        rgb color = mainTurtle.strokeColor;
+        mainFieldTintRow.resize(3 * (size_t) sprite.width);
+        for (size_t i = 0; i < mainFieldTintRow.size(); i += 3) {
+            mainFieldTintRow[i] = color.red;
+            mainFieldTintRow[i + 1] = color.green;
+            mainFieldTintRow[i + 2] = color.blue;
+        }
+        stampSprite(sprite, x, y, &color);
+    }
+
+
+    /**
+     * Saves current field to a .bmp file.
+     * @param filename
+     */
+    void saveBMP(const char *filename) {
+        flushStroke();
+        writeBMP(filename);
+    }
+
+
+    /**
+     * Encodes the field as a .bmp file in memory, like saveBMP() would write it.
+     * @param bytes receives the file, replacing its contents (its capacity is reused)
+     */
+    void encodeBMP(std::vector<unsigned char> &bytes) {
+        flushStroke();
+        bytes.resize(sizeOfBMP());
+        unsigned char *out = bytes.data();
+        encodeBMPTo([&out](const unsigned char *data, size_t size) {
+            memcpy(out, data, size);
+            out += size;
+        });
+    }
+
+
+    /**
+     * Enables the video output.
+     * When enabled, periodic frame bitmaps will be saved with sequentially-ordered filenames matching the following pattern:
+     * "frameXXXX.bmp" (X is a digit).
+     * Frames are emitted after a regular number of pixels have been drawn.
+     * This number is set by the parameter to this function.
+     * Some experimentation may be required to find a optimal values for different shapes.
+     * @param pixelsPerFrame
+     */
+    void beginVideo(int pixelsPerFrame) {
+        mainFieldSaveFrames = true;
+        mainFieldFrameCount = 0;
+        mainFieldFrameInterval = pixelsPerFrame;
+        mainFieldPixelCount = 0;
+    }
+
+
+    /**
+     * Emits a single video frame containing the current field image.
+     */
+    void saveFrame() {
+        char filename[32];
+        sprintf(filename, "frame%05d.bmp", ++mainFieldFrameCount);
+        writeBMP(filename);
+    }
+
+
+    /**
+     * Disables the video output.
+     */
+    void endVideo() {
+        mainFieldSaveFrames = false;
+    }
+
+
+    /**
+     * Returns the current x-coordinate.
+     * @return current x-coordinate
+     */
+    double getX() {
+        return mainTurtle.xpos;
+    }
+
+
+    /**
+     * Returns the current y-coordinate.
+     * @return current y-coordinate
+     */
+    double getY() {
+        return mainTurtle.ypos;
+    }
+
+    /**
+     * Draws an integer at the current location, see drawText().
+     * @param number number to draw
+     * @param scale image pixels per glyph cell
+     */
+    void drawInt(int number, unsigned int scale = 1) {
+        if (recordCommand(OP_DRAW_INT, number, scale)) return;
+        char digits[16];
+        snprintf(digits, sizeof(digits), "%d", number);
+        drawText(digits, scale);
+    }
+
+    /**
+     * Draws text with the pen color, the top-left corner of the first glyph at the current location.
+     * Glyphs are TURTLE_FONT_WIDTH x TURTLE_FONT_HEIGHT cells of scale x scale pixels, and '\n' starts
+     * a new line below the first one. The turtle does not move.
+     * @param text null-terminated text to draw
+     * @param scale image pixels per glyph cell
+     */
+    void drawText(const char *text, unsigned int scale = 1) {
+        markUntraced();
+        flushStroke();
+        if (scale == 0) {
+            return;
+        }
+
+        double x, y;
+        toImage(mainTurtle.xpos, mainTurtle.ypos, x, y);
+        int left = (int) floor(x + 0.5);
+        int top = (int) floor(y + 0.5);
+
+        // text has no command, so the pixels it may draw one by one must not end up in a trace either
+        turtleTraceWriter *recorder = mainTurtleRecorder;
+        mainTurtleRecorder = nullptr;
+        while (true) {
+            size_t length = strcspn(text, "\n");
+            drawTextLine(text, length, left, top, (int) scale);
+            if (text[length] == '\0') {
+                break;
+            }
+            text += length + 1;
+            top -= TURTLE_FONT_LINE * (int) scale;
+        }
+        mainTurtleRecorder = recorder;
+    }
+
+    /**
+     * Returns the image width in pixels.
+     * @return image width
+     */
+    unsigned int getWidth() const {
+        return mainFieldWidth / mainFieldScale;
+    }
+
+    /**
+     * Returns the image height in pixels.
+     * @return image height
+     */
+    unsigned int getHeight() const {
+        return mainFieldHeight / mainFieldScale;
+    }
+
+    /**
+     * Returns the number of transforms saved by pushTransform() and not yet restored.
+     * @return how many popTransform() calls may follow
+     */
+    size_t getTransformDepth() const {
+        return mainTurtleTransformStack.size();
+    }
+
+    /**
+     * Returns the turtle: its position and heading in world coordinates, and its pen.
+     * @return current turtle state
+     */
+    const turtleState &getState() const {
+        return mainTurtle;
+    }
+
+    /**
+     * Returns the supersampling factor the field was created with.
+     * @return field pixels per image pixel along each axis
+     */
+    unsigned int getScale() const {
+        return mainFieldScale;
+    }
+
+    /**
+     * Returns the pixel data of the field, stored row by row starting from the bottom row.
+     * With supersampling the field is getScale() times wider and higher than the image.
+     * @return pointer to (width * scale) * (height * scale) pixels
+     */
+    const rgb *getImage() {
+        flushStroke();
+        return mainTurtleImage;
+    }
+
+    /**
+     * Sets the number of threads used for parallel work such as hashing and large fills.
+     * @param threads thread count, or 0 to use one thread per hardware core
+     */
+    void setThreads(unsigned int threads) {
+        mainFieldThreads = threads;
+    }
+
+    /**
+     * Computes a fast non-cryptographic 64-bit hash of the field contents and size.
+     * Blocks of HASH_BLOCK_ROWS rows are hashed in parallel, so the result does not depend on the thread count.
+     * @return hash of the field
+     */
+    unsigned long long hashImage() {
+        flushStroke();
+        std::vector<unsigned long long> blocks = hashBlocks();
+        return hashBytes((const unsigned char *) blocks.data(), blocks.size() * sizeof(unsigned long long),
+                         ((unsigned long long) mainFieldWidth << 32) | mainFieldHeight);
+    }
+
+    /**
+     * Fast non-cryptographic 64-bit hash with XXH64-style rounds over four independent lanes.
+     * @param data bytes to hash
+     * @param size number of bytes
+     * @param seed hash seed
+     * @return hash value
+     */
+    static unsigned long long hashBytes(const unsigned char *data, size_t size, unsigned long long seed) {
+        const unsigned long long P1 = 11400714785074694791ULL;
+        const unsigned long long P2 = 14029467366897019727ULL;
+        const unsigned long long P3 = 1609587929392839161ULL;
+        const unsigned long long P4 = 9650029242287828579ULL;
+        const unsigned long long P5 = 2870177450012600261ULL;
+        auto rotl = [](unsigned long long x, int r) { return (x << r) | (x >> (64 - r)); };
+        auto round = [&](unsigned long long acc, unsigned long long input) { return rotl(acc + input * P2, 31) * P1; };
+
+        const unsigned char *end = data + size;
+        unsigned long long hash;
+        unsigned long long word;
+
+        if (size >= 32) {
+            unsigned long long v1 = seed + P1 + P2;
+            unsigned long long v2 = seed + P2;
+            unsigned long long v3 = seed;
+            unsigned long long v4 = seed - P1;
+            for (; data + 32 <= end; data += 32) {
+                memcpy(&word, data, 8);
+                v1 = round(v1, word);
+                memcpy(&word, data + 8, 8);
+                v2 = round(v2, word);
+                memcpy(&word, data + 16, 8);
+                v3 = round(v3, word);
+                memcpy(&word, data + 24, 8);
+                v4 = round(v4, word);
+            }
+            hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        } else {
+            hash = seed + P5;
+        }
+        hash += size;
+
+        for (; data + 8 <= end; data += 8) {
+            memcpy(&word, data, 8);
+            hash = rotl(hash ^ round(0, word), 27) * P1 + P4;
+        }
+        for (; data < end; data++) {
+            hash = rotl(hash ^ (*data * P5), 11) * P1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= P2;
+        hash ^= hash >> 29;
+        hash *= P3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    /**
+     * Saves the hashes of the field's row blocks to a golden file, to be verified later with checkGolden().
+     * The file is a few bytes per HASH_BLOCK_ROWS rows instead of a full image.
+     * @param filename
+     */
+    void saveGolden(const char *filename) {
+        flushStroke();
+        std::vector<unsigned long long> blocks = hashBlocks();
+
+        FILE *file = fopen(filename, "w");
+        if (file == nullptr) {
+            fprintf(stderr, "Could not write to file: %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+
+        fprintf(file, "YATG golden 1\n%u %u %d\n", mainFieldWidth, mainFieldHeight, HASH_BLOCK_ROWS);
+        for (unsigned long long block : blocks) {
+            fprintf(file, "%016llx\n", block);
+        }
+        fclose(file);
+    }
+
+    /**
+     * Compares the field against a golden file written by saveGolden().
+     * Row ranges that differ are reported on stderr.
+     * @param filename
+     * @return true if the field matches the golden file
+     */
+    bool checkGolden(const char *filename) {
+        flushStroke();
+        FILE *file = fopen(filename, "r");
+        if (file == nullptr) {
+            fprintf(stderr, "Could not read golden file: %s\n", filename);
+            return false;
+        }
+
+        unsigned int width = 0, height = 0;
+        int blockRows = 0;
+        if (fscanf(file, "YATG golden 1 %u %u %d", &width, &height, &blockRows) != 3) {
+            fprintf(stderr, "Not a golden file: %s\n", filename);
+            fclose(file);
+            return false;
+        }
+        if (width != mainFieldWidth || height != mainFieldHeight || blockRows != HASH_BLOCK_ROWS) {
+            fprintf(stderr, "Golden file %s is for a %ux%u field, not %ux%u\n",
+                    filename, width, height, mainFieldWidth, mainFieldHeight);
+            fclose(file);
+            return false;
+        }
+
+        std::vector<unsigned long long> blocks = hashBlocks();
+        bool matches = true;
+        for (size_t i = 0; i < blocks.size(); i++) {
+            unsigned long long expected;
+            if (fscanf(file, "%llx", &expected) != 1) {
+                fprintf(stderr, "Golden file %s is truncated\n", filename);
+                matches = false;
+                break;
+            }
+            if (expected != blocks[i]) {
+                unsigned int first = (unsigned int) i * HASH_BLOCK_ROWS;
+                unsigned int last = first + HASH_BLOCK_ROWS < mainFieldHeight ? first + HASH_BLOCK_ROWS : mainFieldHeight;
+                fprintf(stderr, "Rows %u-%u differ from golden file %s\n", first, last - 1, filename);
+                matches = false;
+            }
+        }
+
+        fclose(file);
+        return matches;
+    }
+
+    /**
+     * Switches between the optimized rasterizers and the original reference implementations
+     * of drawLine(), endFill(), fillCircle() and saveBMP().
+     * Both must produce identical images; the reference mode exists to verify that.
+     * @param enabled true to use the reference implementations
+     */
+    void setReferenceMode(bool enabled) {
+        mainFieldReferenceMode = enabled;
+    }
+
+    /**
+     * Switches fixed-point positions on or off. In fixed-point mode the turtle's position is kept in 24.8
+     * fixed point: goTo() rounds to 1/256 of a pixel, and forward() adds the distance times a unit vector
+     * along the heading, itself kept with 16 fraction bits, so long paths add up the same way everywhere.
+     * Thin aliased lines of the turtle's path are then drawn from their exact ends rather than rounded ones,
+     * with integer arithmetic only: the pixels are those the line passes closest to, and the pixels holding
+     * both ends are always included, so lines meeting at a point meet in the same pixel. Lines under
+     * a world transform, thick, anti-aliased or supersampled lines are drawn as without fixed point.
+     * The mode has no command, so a trace recorded in it does not carry it: set it again before replaying.
+     * @param enabled true to keep positions in fixed point
+     */
+    void setFixedPoint(bool enabled) {
+        mainTurtleFixed = enabled;
+        if (enabled) {
+            mainTurtle.xpos = toFixedGrid(mainTurtle.xpos);
+            mainTurtle.ypos = toFixedGrid(mainTurtle.ypos);
+        }
+    }
+
+    /**
+     * Switches measure mode on or off. In measure mode, nothing is drawn: lines, fills, circles, text, turtles
+     * and stamps only extend the bounding box and counts of getMeasurement(), so a program can be sized up at
+     * the speed of interpreting it. Flood fills are counted but, as they depend on the field, not measured.
+     * Turning measure mode on clears the previous measurement; turning it off also stops vector output.
+     * @param enabled true to measure instead of drawing
+     */
+    void setMeasureMode(bool enabled) {
+        mainFieldMeasuring = enabled;
+        if (!enabled) {
+            mainFieldVector = nullptr;
+        }
+        if (enabled) {
+            mainFieldMeasurement = {INFINITY, INFINITY, -INFINITY, -INFINITY, 0, 0, 0, 0.0};
+        }
+    }
+
+    /**
+     * Writes what the commands draw to an SVG or EPS drawing instead of the field, or stops writing (nullptr).
+     * This turns measure mode on, or off again: lines, fills, circles, pixels, text and turtles are written
+     * in image coordinates, after the world transform, as they would be drawn on this image. Flood fills
+     * and stamped sprites, which are made of the field's pixels, are left out. Supersampling and
+     * anti-aliasing make no difference to the drawing.
+     * @param writer drawing to write to, or nullptr
+     */
+    void setVectorOutput(turtleVectorWriter *writer) {
+        flushStroke();
+        setMeasureMode(writer != nullptr);
+        mainFieldVector = writer;
+    }
+
+    /**
+     * Returns what was drawn since measure mode was turned on.
+     * @return bounds, counts and estimated pixels
+     */
+    turtleMeasurement getMeasurement() const {
+        return mainFieldMeasurement;
+    }
+
+    /**
+     * Limits drawing to the image pixels from (left,bottom) to (right,top), inclusive.
+     * Inside the rectangle every pixel comes out exactly as without a clip; lines, fills, circles, text and
+     * stamps that lie wholly outside it are skipped after a bounds check, so a small clip draws a long program
+     * at little more than the cost of interpreting it. clear() wipes only the rectangle, and flood fills
+     * stop at its border. An empty rectangle (left > right) draws nothing at all.
+     * @param left
+     * @param bottom
+     * @param right
+     * @param top
+     */
+    void setClip(int left, int bottom, int right, int top) {
+        flushStroke();
+        int scale = (int) mainFieldScale;
+        mainFieldClipLeft = std::max(blockX(left) + mainFieldCenterX, 0);
+        mainFieldClipBottom = std::max(blockY(bottom) + mainFieldCenterY, 0);
+        mainFieldClipRight = std::min(blockX(right) + scale - 1 + mainFieldCenterX, (int) mainFieldWidth - 1);
+        mainFieldClipTop = std::min(blockY(top) + scale - 1 + mainFieldCenterY, (int) mainFieldHeight - 1);
+        mainFieldClipped = true;
+    }
+
+    /**
+     * Scrolls the image so that image pixel (x,y) lies at its center, where (0,0) was. The image becomes a
+     * window on a larger one: every canvas with the same supersampling draws exactly the same pixels at
+     * the same image coordinates after setOrigin(), so windows cut from one drawing fit together. (Without
+     * it, supersampled fields of odd sizes place their blocks differently.) Removes the clip (see setClip()),
+     * and pixels drawn outside the window are no longer reported as out of bounds.
+     * @param x
+     * @param y
+     */
+    void setOrigin(int x, int y) {
+        flushStroke();
+        int scale = (int) mainFieldScale;
+        mainFieldOriginX = x;
+        mainFieldOriginY = y;
+        mainFieldWindow = true;
+        mainFieldBlockX = 0;
+        mainFieldBlockY = 0;
+        mainFieldCenterX = ((int) getWidth() / 2 - x) * scale;
+        mainFieldCenterY = ((int) getHeight() / 2 - y) * scale;
+        resetClip();
+    }
+
+    /**
+     * Lets drawing reach the whole field again, see setClip().
+     */
+    void resetClip() {
+        flushStroke();
+        mainFieldClipLeft = 0;
+        mainFieldClipBottom = 0;
+        mainFieldClipRight = (int) mainFieldWidth - 1;
+        mainFieldClipTop = (int) mainFieldHeight - 1;
+        mainFieldClipped = false;
+    }
+
+    /**
+     * Returns a box around the image pixels that drawing may have written since the last call, and starts
+     * a new one. Lines, fills and stamps add their bounding boxes whether or not they lie inside the clip,
+     * so with an empty clip this finds where commands draw without drawing them. Clearing and flood fills
+     * add the whole image. The end cap of a thick stroke counts when it is drawn, usually by the next command.
+     * @return touched pixels (left > right if none)
+     */
+    turtleBounds takeTouched() {
+        turtleBounds field = mainFieldTouched;
+        mainFieldTouched = {0, 0, -1, -1};
+        if (field.left > field.right) {
+            return field;
+        }
+
+        // field pixels to the image pixels of their blocks, rounding down
+        int scale = (int) mainFieldScale;
+        auto toImagePixel = [scale](int coordinate) {
+            return coordinate >= 0 ? coordinate / scale : -((scale - 1 - coordinate) / scale);
+        };
+        return {toImagePixel(field.left - mainFieldBlockX), toImagePixel(field.bottom - mainFieldBlockY),
+                toImagePixel(field.right - mainFieldBlockX), toImagePixel(field.top - mainFieldBlockY)};
+    }
+
+    /**
+     * Returns a hash of everything that decides what the next command draws: the turtle and its backup,
+     * the world transform and the top of its stack, the anti-aliasing and reference settings, an open thick
+     * stroke and the polygon being filled. Equal commands run from equal hashes draw the same pixels over
+     * the same background, except flood fills, which also depend on the rest of the field.
+     * @return 64-bit hash
+     */
+    unsigned long long hashState() const {
+        double values[64];
+        int count = 0;
+        for (const turtleState *state : {&mainTurtle, &backupTurtle}) {
+            const double fields[] = {state->xpos, state->ypos, state->heading,
+                                     (double) state->strokeColor.red, (double) state->strokeColor.green,
+                                     (double) state->strokeColor.blue, (double) state->fillColor.red,
+                                     (double) state->fillColor.green, (double) state->fillColor.blue,
+                                     (double) state->pendown, (double) state->filled, (double) state->fillRule,
+                                     state->penWidth, (double) state->lineJoin, (double) state->lineCap};
+            for (double field : fields) values[count++] = field;
+        }
+
+        const turtleTransform noTransform{1, 0, 0, 1, 0, 0};
+        for (const turtleTransform *m : {&mainTurtleTransform, mainTurtleTransformStack.empty() ?
+                                                               &noTransform : &mainTurtleTransformStack.back()}) {
+            const double fields[] = {m->xx, m->yx, m->xy, m->yy, m->x0, m->y0};
+            for (double field : fields) values[count++] = field;
+        }
+
+        const strokeEnd &stroke = mainTurtleStroke;
+        const double settings[] = {(double) mainTurtleTransformStack.size(), (double) mainTurtleTransformed,
+                                   (double) mainFieldAntialiasFill, (double) mainFieldAntialiasLines,
+                                   (double) mainFieldReferenceMode, (double) mainTurtleFixed,
+                                   mainTurtleFixed ? mainTurtleVectorHeading : 0.0,
+                                   mainTurtleFixed ? (double) mainTurtleVectorX : 0.0,
+                                   mainTurtleFixed ? (double) mainTurtleVectorY : 0.0, (double) mainTurtleStrokeOpen,
+                                   mainTurtleStrokeOpen ? stroke.x : 0.0, mainTurtleStrokeOpen ? stroke.y : 0.0,
+                                   mainTurtleStrokeOpen ? stroke.dx : 0.0, mainTurtleStrokeOpen ? stroke.dy : 0.0,
+                                   mainTurtleStrokeOpen ? stroke.halfWidth : 0.0,
+                                   mainTurtleStrokeOpen ? stroke.color.red * 65536.0 + stroke.color.green * 256.0 +
+                                                          stroke.color.blue : 0.0,
+                                   mainTurtleStrokeOpen ? (double) stroke.cap : 0.0,
+                                   (double) mainTurtlePolyVertexCount, (double) mainTurtleContourCount};
+        for (double setting : settings) values[count++] = setting;
+
+        return hashBytes((const unsigned char *) values, (size_t) count * sizeof(double), mainTurtlePolyHash);
+    }
+
+    /**
+     * Saves the state that decides what the next command draws: the turtle and its backup, the world transform
+     * and its stack, the anti-aliasing and fixed-point settings, an open thick stroke and the polygon being filled. The vertices
+     * of the polygon are only copied if asked for, as most commands don't need them.
+     * @param snapshot state (output)
+     * @param polygon also save the vertices of the polygon?
+     */
+    void saveState(turtleSnapshot &snapshot, bool polygon) const {
+        snapshot.turtle = mainTurtle;
+        snapshot.backup = backupTurtle;
+        snapshot.transform = mainTurtleTransform;
+        snapshot.transformStack = mainTurtleTransformStack;
+        snapshot.antialiasFill = mainFieldAntialiasFill;
+        snapshot.antialiasLines = mainFieldAntialiasLines;
+        snapshot.fixedPoint = mainTurtleFixed;
+        snapshot.vectorHeading = mainTurtleVectorHeading;
+        snapshot.vectorX = mainTurtleVectorX;
+        snapshot.vectorY = mainTurtleVectorY;
+        snapshot.strokeOpen = mainTurtleStrokeOpen;
+        snapshot.stroke = mainTurtleStroke;
+        snapshot.scale = mainFieldScale;
+        snapshot.blockX = mainFieldBlockX;
+        snapshot.blockY = mainFieldBlockY;
+        snapshot.polyVertexCount = mainTurtlePolyVertexCount;
+        snapshot.contourCount = mainTurtleContourCount;
+        snapshot.polyHash = mainTurtlePolyHash;
+        int vertices = polygon ? mainTurtlePolyVertexCount : 0;
+        snapshot.polyX.assign(mainTurtlePolyX, mainTurtlePolyX + vertices);
+        snapshot.polyY.assign(mainTurtlePolyY, mainTurtlePolyY + vertices);
+        snapshot.contourEnd.assign(mainTurtleContourEnd, mainTurtleContourEnd + (polygon ? mainTurtleContourCount : 0));
+    }
+
+    /**
+     * Restores a state saved by saveState(), possibly on another turtle or at another supersampling.
+     * An open thick stroke is replaced without drawing its end cap. Without saved vertices, the polygon
+     * being filled keeps its size but not its shape, so it must not be filled before the next beginFill().
+     * @param snapshot
+     */
+    void loadState(const turtleSnapshot &snapshot) {
+        mainTurtle = snapshot.turtle;
+        backupTurtle = snapshot.backup;
+        mainTurtleTransform = snapshot.transform;
+        mainTurtleTransformStack = snapshot.transformStack;
+        mainTurtleTransformed = !isIdentity(mainTurtleTransform);
+        mainFieldAntialiasFill = snapshot.antialiasFill;
+        mainFieldAntialiasLines = snapshot.antialiasLines;
+        mainTurtleFixed = snapshot.fixedPoint;
+        mainTurtleVectorHeading = snapshot.vectorHeading;
+        mainTurtleVectorX = snapshot.vectorX;
+        mainTurtleVectorY = snapshot.vectorY;
+
+        mainTurtleStrokeOpen = snapshot.strokeOpen;
+        mainTurtleStroke = snapshot.stroke;
+        if (snapshot.scale != mainFieldScale || snapshot.blockX != mainFieldBlockX || snapshot.blockY != mainFieldBlockY) {
+            // through image coordinates, which is exact for snapshots taken without supersampling
+            double scale = snapshot.scale;
+            double x = (snapshot.stroke.x - snapshot.blockX - (scale - 1) / 2.0) / scale;
+            double y = (snapshot.stroke.y - snapshot.blockY - (scale - 1) / 2.0) / scale;
+            mainTurtleStroke.x = toFieldX(x);
+            mainTurtleStroke.y = toFieldY(y);
+            mainTurtleStroke.halfWidth = snapshot.stroke.halfWidth / scale * mainFieldScale;
+        }
+
+        mainTurtlePolyVertexCount = snapshot.polyVertexCount;
+        mainTurtleContourCount = snapshot.contourCount;
+        mainTurtlePolyHash = snapshot.polyHash;
+        std::copy(snapshot.polyX.begin(), snapshot.polyX.end(), mainTurtlePolyX);
+        std::copy(snapshot.polyY.begin(), snapshot.polyY.end(), mainTurtlePolyY);
+        std::copy(snapshot.contourEnd.begin(), snapshot.contourEnd.end(), mainTurtleContourEnd);
+    }
+
+    /**
+     * Sets the world transform so the measured bounding box fills the image, keeping its aspect ratio and
+     * leaving padding pixels free on every side. The measurement should be taken without a world transform.
+     * Pen widths and text are not scaled, so their share of the box is only approximate.
+     * @param measurement result of getMeasurement()
+     * @param padding free pixels around the drawing
+     */
+    void fitToImage(const turtleMeasurement &measurement, double padding = 0) {
+        resetTransform();
+        if (measurement.minX > measurement.maxX) {
+            return;
+        }
+
+        // extreme pixel centers of the image, then the largest scale that fits both ways
+        int width = (int) getWidth();
+        int height = (int) getHeight();
+        double left = mainFieldOriginX - width / 2 + padding;
+        double right = mainFieldOriginX + width - 1 - width / 2 - padding;
+        double bottom = mainFieldOriginY - height / 2 + padding;
+        double top = mainFieldOriginY + height - 1 - height / 2 - padding;
+
+        double sizeX = measurement.maxX - measurement.minX;
+        double sizeY = measurement.maxY - measurement.minY;
+        double factor = INFINITY;
+        if (sizeX > 0.0) factor = std::min(factor, (right - left) / sizeX);
+        if (sizeY > 0.0) factor = std::min(factor, (top - bottom) / sizeY);
+        if (!(factor > 0.0) || std::isinf(factor)) {
+            factor = 1.0;
+        }
+
+        translate((left + right) / 2.0, (bottom + top) / 2.0);
+        scale(factor);
+        translate(-(measurement.minX + measurement.maxX) / 2.0, -(measurement.minY + measurement.maxY) / 2.0);
+    }
+
+    /**
+     * Runs a sequence of commands in measure mode on a scratch turtle in this turtle's state,
+     * fits the world transform to the result with fitToImage(), then draws the commands.
+     * The fitted transform stays in place afterwards.
+     * @param commands commands to draw
+     * @param count number of commands
+     * @param padding free pixels around the drawing
+     */
+    void drawFitted(const turtleCommand *commands, size_t count, double padding = 0) {
+        Turtle measure(1, 1);
+        measure.mainTurtle = mainTurtle;
+        measure.setMeasureMode(true);
+        measure.execute(commands, count);
+
+        fitToImage(measure.getMeasurement(), padding);
+        execute(commands, count);
+    }
+
+    /**
+     * Executes a single turtle command.
+     * @param command command to execute
+     */
+    void execute(const turtleCommand &command) {
+        const double *a = command.args;
+
+        switch (command.op) {
+            case OP_FORWARD:        forward((int) a[0]); break;
+            case OP_BACKWARD:       backward((int) a[0]); break;
+            case OP_STRAFE_LEFT:    strafeLeft((int) a[0]); break;
+            case OP_STRAFE_RIGHT:   strafeRight((int) a[0]); break;
+            case OP_TURN_LEFT:      turnLeft(a[0]); break;
+            case OP_TURN_RIGHT:     turnRight(a[0]); break;
+            case OP_SET_HEADING:    setHeading(a[0]); break;
+            case OP_GO_TO:          goTo(a[0], a[1]); break;
+            case OP_PEN_UP:         penUp(); break;
+            case OP_PEN_DOWN:       penDown(); break;
+            case OP_SET_PEN_COLOR:  setPenColor((int) a[0], (int) a[1], (int) a[2]); break;
+            case OP_SET_FILL_COLOR: setFillColor((int) a[0], (int) a[1], (int) a[2]); break;
+            case OP_BEGIN_FILL:     beginFill(); break;
+            case OP_END_FILL:       endFill(); break;
+            case OP_DOT:            dot(); break;
+            case OP_DRAW_PIXEL:     drawPixel((int) a[0], (int) a[1]); break;
+            case OP_DRAW_LINE:      drawLine((int) a[0], (int) a[1], (int) a[2], (int) a[3]); break;
+            case OP_DRAW_CIRCLE:    drawCircle((int) a[0], (int) a[1], (int) a[2]); break;
+            case OP_FILL_CIRCLE:    fillCircle((int) a[0], (int) a[1], (int) a[2]); break;
+            case OP_DRAW_TURTLE:    drawTurtle(); break;
+            case OP_DRAW_INT:       drawInt((int) a[0], a[1] >= 1 ? (unsigned int) a[1] : 0); break;
+            case OP_BACKUP:         backup(); break;
+            case OP_RESTORE:        restore(); break;
+            case OP_RESET:          reset(); break;
+            case OP_FLOOD_FILL:     floodFill((int) a[0], (int) a[1]); break;
+            case OP_CLOSE_CONTOUR:  closeContour(); break;
+            case OP_SET_FILL_RULE:  setFillRule((turtleFillRule) (int) a[0]); break;
+            case OP_SET_FILL_ANTIALIASING: setFillAntialiasing(a[0] != 0); break;
+            case OP_SET_LINE_ANTIALIASING: setLineAntialiasing(a[0] != 0); break;
+            case OP_SET_PEN_WIDTH:  setPenWidth(a[0]); break;
+            case OP_SET_LINE_JOIN:  setLineJoin((turtleLineJoin) (int) a[0]); break;
+            case OP_SET_LINE_CAP:   setLineCap((turtleLineCap) (int) a[0]); break;
+            case OP_PUSH_TRANSFORM: pushTransform(); break;
+            case OP_POP_TRANSFORM:  popTransform(); break;
+            case OP_TRANSLATE:      translate(a[0], a[1]); break;
+            case OP_ROTATE:         rotate(a[0]); break;
+            case OP_SCALE:          scale(a[0], a[1]); break;
+            case OP_RESET_TRANSFORM: resetTransform(); break;
+            case OP_CLEAR:          clear((int) a[0], (int) a[1], (int) a[2]); break;
+        }
+    }
+
+    /**
+     * Executes a sequence of turtle commands in order.
+     * @param commands commands to execute
+     * @param count number of commands
+     */
+    void execute(const turtleCommand *commands, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            execute(commands[i]);
+        }
+    }
+
+    /**
+     * Records every following call that has a turtle command (see turtleOpcode) to the given trace,
+     * until recording is stopped with nullptr. Calls made by other calls are not recorded separately,
+     * and drawText(), fillPixel(), stamps and settings without a command are not recorded at all;
+     * drawing one of them marks the trace incomplete (see turtleTraceWriter::isComplete()).
+     * @param recorder trace to append to, or nullptr
+     */
+    void setRecorder(turtleTraceWriter *recorder) {
+        mainTurtleRecorder = recorder;
+    }
+
+    /**
+     * Executes the commands of a binary trace file written by turtleTraceWriter.
+     * The file is memory-mapped and decoded as it is executed.
+     * @param filename
+     */
+    void replayTrace(const char *filename) {
+        turtleTraceReader reader(filename);
+        replayTrace(reader);
+    }
+
+    /**
+     * Executes the commands of a binary trace held in memory.
+     * @param bytes trace written by turtleTraceWriter
+     * @param count size of the trace in bytes
+     */
+    void replayTrace(const unsigned char *bytes, size_t count) {
+        turtleTraceReader reader(bytes, count);
+        replayTrace(reader);
+    }
+
+    /**
+     * Executes the remaining commands of a trace.
+     * @param reader
+     */
+    void replayTrace(turtleTraceReader &reader) {
+        turtleCommand command;
+        while (reader.next(command)) {
+            execute(command);
+        }
+    }
+
+private:
+    /**
+     * Marks the trace incomplete, if recording, before a call that draws without a command.
+     */
+    void markUntraced() {
+        if (mainTurtleRecorder != nullptr) {
+            mainTurtleRecorder->markIncomplete();
+        }
+    }
+
+    /**
+     * Records a call to the trace, if recording, and then carries it out with recording paused,
+     * so calls it makes are not recorded again.
+     * @param op command of the call
+     * @return true if the call was recorded and carried out; the caller then returns at once
+     */
+    bool recordCommand(turtleOpcode op, double a0 = 0, double a1 = 0, double a2 = 0, double a3 = 0) {
+        if (mainTurtleRecorder == nullptr) {
+            return false;
+        }
+
+        turtleCommand command{op, {a0, a1, a2, a3}};
+        turtleTraceWriter *recorder = mainTurtleRecorder;
+        recorder->write(command);
+        mainTurtleRecorder = nullptr;
+        execute(command);
+        mainTurtleRecorder = recorder;
+        return true;
+    }
+
+    /**
+     * Cleans up any memory used by the turtle graphics system.
+     */
+    void cleanup() {
+        if (mainTurtleImage != nullptr) {
+            free(mainTurtleImage);
+            mainTurtleImage = nullptr;
+        }
+    }
+
+    /**
+     * Runs function(begin, end) on consecutive ranges covering [0, count), spread over the worker threads.
+     * Each range holds at least minChunk items; small jobs run entirely on the calling thread.
+     * @param count number of items
+     * @param minChunk smallest number of items worth a thread
+     * @param function callable taking (size_t begin, size_t end)
+     */
+    template<typename Function>
+    void parallelFor(size_t count, size_t minChunk, Function function) {
+        size_t threads = mainFieldThreads != 0 ? mainFieldThreads : std::thread::hardware_concurrency();
+        if (minChunk == 0) minChunk = 1;
+        if (threads > count / minChunk) threads = count / minChunk;
+        if (threads <= 1) {
+            function((size_t) 0, count);
+            return;
+        }
+
+        size_t chunk = (count + threads - 1) / threads;
+        std::vector<std::thread> workers;
+        for (size_t begin = chunk; begin < count; begin += chunk) {
+            workers.emplace_back(function, begin, begin + chunk < count ? begin + chunk : count);
+        }
+        function((size_t) 0, chunk);
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+    /**
+     * Hashes the field in blocks of HASH_BLOCK_ROWS rows, in parallel.
+     * @return one hash per row block, bottom block first
+     */
+    std::vector<unsigned long long> hashBlocks() {
+        size_t count = (mainFieldHeight + HASH_BLOCK_ROWS - 1) / HASH_BLOCK_ROWS;
+        std::vector<unsigned long long> blocks(count);
+        size_t rowBytes = (size_t) mainFieldWidth * sizeof(rgb);
+
+        parallelFor(count, 4, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                size_t firstRow = i * HASH_BLOCK_ROWS;
+                size_t rows = firstRow + HASH_BLOCK_ROWS < mainFieldHeight ? HASH_BLOCK_ROWS : mainFieldHeight - firstRow;
+                blocks[i] = hashBytes((const unsigned char *) mainTurtleImage + firstRow * rowBytes, rows * rowBytes, i);
+            }
+        });
+        return blocks;
+    }
+
+    /**
+     * Compares two colors.
+     * @return true if all components are equal
+     */
+    static bool sameColor(rgb a, rgb b) {
+        return a.red == b.red && a.green == b.green && a.blue == b.blue;
+    }
+
+    /**
+     * Checks whether the given turtle coordinates lie on the field.
+     * @param x
+     * @param y
+     * @return true if the pixel at (x,y) exists
+     */
+    bool insideField(int x, int y) const {
+        int column = x + mainFieldCenterX;
+        int row = y + mainFieldCenterY;
+        return column >= 0 && column < (int) mainFieldWidth && row >= 0 && row < (int) mainFieldHeight;
+    }
+
+    /**
+     * Checks whether the given field pixel may be drawn: it lies on the field and inside the clip.
+     * @param x
+     * @param y
+     * @return true if the pixel at (x,y) is drawn
+     */
+    bool insideClip(int x, int y) const {
+        int column = x + mainFieldCenterX;
+        int row = y + mainFieldCenterY;
+        return column >= mainFieldClipLeft && column <= mainFieldClipRight &&
+               row >= mainFieldClipBottom && row <= mainFieldClipTop;
+    }
+
+    /**
+     * Adds the field box of a primitive about to be drawn to the touched bounds (see takeTouched()),
+     * and checks whether any of it lies inside the clip.
+     * @param left box in field coordinates, inclusive
+     * @param bottom
+     * @param right
+     * @param top
+     * @return false if the primitive can be skipped
+     */
+    bool reaches(int left, int bottom, int right, int top) {
+        turtleBounds &touched = mainFieldTouched;
+        if (touched.left > touched.right) {
+            touched = {left, bottom, right, top};
+        } else {
+            touched = {std::min(touched.left, left), std::min(touched.bottom, bottom),
+                       std::max(touched.right, right), std::max(touched.top, top)};
+        }
+        if (!mainFieldClipped) {
+            return true;
+        }
+        int columnOffset = mainFieldCenterX;
+        int rowOffset = mainFieldCenterY;
+        return right + columnOffset >= mainFieldClipLeft && left + columnOffset <= mainFieldClipRight &&
+               top + rowOffset >= mainFieldClipBottom && bottom + rowOffset <= mainFieldClipTop;
+    }
+
+    /**
+     * Version of reaches() for a box with fractional (or huge) coordinates, which is widened to whole pixels.
+     */
+    bool reaches(double left, double bottom, double right, double top) {
+        auto pixel = [](double coordinate) {
+            return (int) fmax(-1e9, fmin(1e9, coordinate));
+        };
+        return reaches(pixel(floor(left)), pixel(floor(bottom)), pixel(ceil(right)), pixel(ceil(top)));
+    }
+
+    /**
+     * Returns the field x-coordinate of the left column of the block drawn for image column x.
+     * @param x
+     * @return field x-coordinate
+     */
+    int blockX(int x) const {
+        return x * (int) mainFieldScale + mainFieldBlockX;
+    }
+
+    /**
+     * Returns the field y-coordinate of the bottom row of the block drawn for image row y.
+     * @param y
+     * @return field y-coordinate
+     */
+    int blockY(int y) const {
+        return y * (int) mainFieldScale + mainFieldBlockY;
+    }
+
+    /**
+     * Maps an image x-coordinate to the field, so that integers land on block centers.
+     * @param x
+     * @return field x-coordinate
+     */
+    double toFieldX(double x) const {
+        return x * mainFieldScale + mainFieldBlockX + (mainFieldScale - 1) / 2.0;
+    }
+
+    /**
+     * Maps an image y-coordinate to the field, so that integers land on block centers.
+     * @param y
+     * @return field y-coordinate
+     */
+    double toFieldY(double y) const {
+        return y * mainFieldScale + mainFieldBlockY + (mainFieldScale - 1) / 2.0;
+    }
+
+    /**
+     * Snaps a field coordinate to a pixel, rounding halves down so block centers of even scales
+     * land on the same pixel as blockX(x) + (scale - 1) / 2.
+     * @param coordinate
+     * @return pixel coordinate
+     */
+    static int fieldPoint(double coordinate) {
+        return (int) ceil(coordinate - 0.5);
+    }
+
+    /**
+     * Fills the mainFieldScale x mainFieldScale block with the given bottom-left field pixel.
+     * @param left
+     * @param bottom
+     * @param color
+     */
+    void fillBlock(int left, int bottom, rgb color) {
+        int scale = (int) mainFieldScale;
+        reaches(left, bottom, left + scale - 1, bottom + scale - 1);
+        for (int k = 0; k < scale; k++) {
+            fillSpan(left, left + scale - 1, bottom + k, color);
+        }
+    }
+
+    /**
+     * Fills the pixels whose offset (dx,dy) from the center satisfies inner^2 <= dx^2 + dy^2 < outer^2,
+     * one or two spans per row. With inner == 0 this is the disc drawn by fillCircle().
+     * @param x0 center
+     * @param y0
+     * @param inner inner radius
+     * @param outer outer radius
+     * @param color
+     */
+    void fillRing(int x0, int y0, int inner, int outer, rgb color) {
+        if (!reaches(x0 - outer, y0 - outer, x0 + outer, y0 + outer)) {
+            return;
+        }
+        for (int dy = -outer; dy < outer; dy++) {
+            int k = halfWidth(outer * outer - dy * dy);
+            if (k < 0) continue;
+
+            int hole = halfWidth(inner * inner - dy * dy);
+            if (hole < 0) {
+                fillSpan(x0 - k, x0 + k, y0 + dy, color);
+            } else {
+                fillSpan(x0 - k, x0 - hole - 1, y0 + dy, color);
+                fillSpan(x0 + hole + 1, x0 + k, y0 + dy, color);
+            }
+        }
+    }
+
+    /**
+     * Returns the half-width of a circle's row: the largest k with k * k < remaining.
+     * @param remaining squared radius minus squared row offset
+     * @return half-width, or -1 if the row misses the circle
+     */
+    static int halfWidth(int remaining) {
+        if (remaining <= 0) {
+            return -1;
+        }
+        int k = (int) sqrt((double) (remaining - 1));
+        while (k * k >= remaining) k--;
+        while ((k + 1) * (k + 1) < remaining) k++;
+        return k;
+    }
+
+    /**
+     * Fills the pixels x0..x1 (inclusive) of row y with the given color, clipped to the field and the clip.
+     * @param x0
+     * @param x1
+     * @param y
+     * @param color
+     */
+    void fillSpan(int x0, int x1, int y, rgb color) {
+        int row = y + mainFieldCenterY;
+        if (row < mainFieldClipBottom || row > mainFieldClipTop) {
+            return;
+        }
+
+        int first = x0 + mainFieldCenterX;
+        int last = x1 + mainFieldCenterX;
+        if (first < mainFieldClipLeft) first = mainFieldClipLeft;
+        if (last > mainFieldClipRight) last = mainFieldClipRight;
+
+        if (first > last) {
+            return;
+        }
+
+        fillRun(mainTurtleImage + (size_t) row * mainFieldWidth + first, last - first + 1, color);
+    }
+
+    /**
+     * Sets count consecutive pixels to the given color.
+     * @param pixel first pixel
+     * @param count number of pixels
+     * @param color
+     */
+    static void fillRun(rgb *pixel, int count, rgb color) {
+        // write four pixels (12 bytes) at a time from a repeating pattern
+        rgb *end = pixel + count;
+        rgb pattern[4] = {color, color, color, color};
+        for (; pixel + 4 <= end; pixel += 4) {
+            memcpy(pixel, pattern, sizeof(pattern));
+        }
+        while (pixel < end) {
+            *pixel++ = color;
+        }
+    }
+
+    /**
+     * Fills a polygon made of one or more closed contours with a single scanline pass over its bounding box.
+     * Rows use the same intercept rule as the reference fill, so single contours produce identical pixels.
+     * @param xs vertex x-coords
+     * @param ys vertex y-coords
+     * @param contourEnd index one past the last vertex of each contour
+     * @param contours number of contours
+     * @param rule fill rule for overlapping contours
+     * @param color fill color
+     * @param antialias fill with smooth edges?
+     */
+    void fillPolygon(const double *xs, const double *ys, const int *contourEnd, int contours,
+                     turtleFillRule rule, rgb color, bool antialias) {
+        int vertices = contours > 0 ? contourEnd[contours - 1] : 0;
+        if (vertices == 0) {
+            return;
+        }
+        if (antialias) {
+            fillPolygonAntialiased(xs, ys, contourEnd, contours, rule, color);
+            return;
+        }
+
+        // only the rows spanned by the polygon can contain intercepts
+        double minX = xs[0];
+        double maxX = xs[0];
+        double minY = ys[0];
+        double maxY = ys[0];
+        for (int i = 1; i < vertices; i++) {
+            minX = fmin(minX, xs[i]);
+            maxX = fmax(maxX, xs[i]);
+            minY = fmin(minY, ys[i]);
+            maxY = fmax(maxY, ys[i]);
+        }
+        if (!reaches(minX, minY, maxX, maxY)) {
+            return;
+        }
+        int firstRow = mainFieldClipBottom - mainFieldCenterY;
+        int lastRow = mainFieldClipTop - mainFieldCenterY;
+        firstRow = (int) fmax(firstRow, fmin(floor(minY), lastRow + 1.0));
+        lastRow = (int) fmin(lastRow, fmax(ceil(maxY), firstRow - 1.0));
+
+        // convex (more generally: y-monotone) contours cross every row exactly twice
+        bool monotone = contours == 1 && isMonotone(ys, vertices);
+        auto fillRows = [&](int first, int last) {
+            if (monotone) {
+                fillMonotoneRows(xs, ys, vertices, color, first, last);
+            } else {
+                fillPolygonRows(xs, ys, contourEnd, contours, rule, color, first, last);
+            }
+        };
+
+        // rows are independent, so large polygons are filled in row blocks on several threads
+        // with exactly the same result as a serial fill
+        double columns = fmin(maxX, (double) mainFieldWidth - mainFieldCenterX) - fmax(minX, (double) -mainFieldCenterX);
+        double rows = lastRow - firstRow + 1.0;
+        if (rows * columns >= PARALLEL_FILL_PIXELS) {
+            parallelFor((size_t) rows, PARALLEL_FILL_ROWS, [&](size_t begin, size_t end) {
+                fillRows(firstRow + (int) begin, firstRow + (int) end - 1);
+            });
+        } else {
+            fillRows(firstRow, lastRow);
+        }
+    }
+
+    /**
+     * Checks whether a closed contour is y-monotone, i.e. its y-coords change direction at most twice.
+     * All convex polygons are y-monotone.
+     * @param ys vertex y-coords
+     * @param count number of vertices
+     * @return true if every row crosses the contour at most twice
+     */
+    static bool isMonotone(const double *ys, int count) {
+        int changes = 0;
+        int firstDirection = 0;
+        int direction = 0;
+
+        for (int i = 0; i < count; i++) {
+            double dy = ys[(i + 1) % count] - ys[i];
+            int current = dy > 0 ? 1 : (dy < 0 ? -1 : 0);
+            if (current == 0) continue;     // horizontal edges never produce intercepts
+            if (firstDirection == 0) {
+                firstDirection = current;
+            } else if (current != direction) {
+                changes++;
+            }
+            direction = current;
+        }
+        if (direction != firstDirection) {
+            changes++;
+        }
+
+        return firstDirection != 0 && changes <= 2;
+    }
+
+    /**
+     * Scanline fill of a y-monotone contour: instead of intersecting every edge on every row,
+     * walks the left and right edge chains from the lowest to the highest vertex, writing one span per row.
+     * Intercepts are computed exactly like in fillPolygonRows(), so the pixels are identical.
+     * @param xs vertex x-coords
+     * @param ys vertex y-coords
+     * @param count number of vertices
+     * @param color fill color
+     * @param firstRow first row to fill
+     * @param lastRow last row to fill (inclusive)
+     */
+    void fillMonotoneRows(const double *xs, const double *ys, int count, rgb color, int firstRow, int lastRow) {
+        int bottom = 0;
+        for (int i = 1; i < count; i++) {
+            if (ys[i] < ys[bottom]) bottom = i;
+        }
+
+        // edge (a, aNext) climbs the chain of increasing indices, (b, bNext) the chain of decreasing ones
+        int a = bottom;
+        int aNext = (bottom + 1) % count;
+        int b = bottom;
+        int bNext = (bottom + count - 1) % count;
+
+        // rows at or below the lowest vertex have no intercepts
+        int y = (int) fmax(firstRow, fmin(floor(ys[bottom]) + 1.0, lastRow + 1.0));
+        for (; y <= lastRow; y++) {
+            while (ys[aNext] < (double) y && aNext != bottom) {
+                a = aNext;
+                aNext = (aNext + 1) % count;
+            }
+            while (ys[bNext] < (double) y && bNext != bottom) {
+                b = bNext;
+                bNext = (bNext + count - 1) % count;
+            }
+            if (ys[aNext] < (double) y || ys[bNext] < (double) y) {
+                break;  // above the highest vertex
+            }
+
+            // same expression (and operand order) as the general filler, where i follows j in the contour
+            double xa = xs[aNext] + ((double) y - ys[aNext]) / (ys[a] - ys[aNext]) * (xs[a] - xs[aNext]);
+            double xb = xs[b] + ((double) y - ys[b]) / (ys[bNext] - ys[b]) * (xs[bNext] - xs[b]);
+            if (xa < xb) {
+                fillSpan((int) floor(xa) + 1, (int) ceil(xb) - 1, y, color);
+            } else {
+                fillSpan((int) floor(xb) + 1, (int) ceil(xa) - 1, y, color);
+            }
+        }
+    }
+
+    /**
+     * Scanline fill of the given rows of a polygon; see fillPolygon().
+     * @param firstRow first row to fill
+     * @param lastRow last row to fill (inclusive)
+     */
+    void fillPolygonRows(const double *xs, const double *ys, const int *contourEnd, int contours,
+                         turtleFillRule rule, rgb color, int firstRow, int lastRow) {
+        // based on public-domain fill algorithm in C by Darel Rex Finley, 2007
+        //   from http://alienryderflex.com/polygon_fill/
+
+        double nodeX[MAX_POLYGON_VERTICES];     // x-coords of polygon intercepts
+        int nodeWinding[MAX_POLYGON_VERTICES];  // +1 for upward edges, -1 for downward ones
+        int nodes;                              // size of nodeX
+        int y, i, j, c;                         // current row and loop indices
+
+        for (y = firstRow; y <= lastRow; y++) {
+
+            //  build a list of polygon intercepts on the current line, contour by contour
+            nodes = 0;
+            for (c = 0; c < contours; c++) {
+                int start = c > 0 ? contourEnd[c - 1] : 0;
+                j = contourEnd[c] - 1;
+                for (i = start; i < contourEnd[c]; i++) {
+                    if ((ys[i] < (double) y && ys[j] >= (double) y) ||
+                        (ys[j] < (double) y && ys[i] >= (double) y)) {
+                        nodeWinding[nodes] = ys[i] > ys[j] ? 1 : -1;
+                        nodeX[nodes++] = (xs[i] + ((double) y - ys[i]) / (ys[j] - ys[i]) * (xs[j] - xs[i]));
+                    }
+                    j = i;
+                    if (nodes >= MAX_POLYGON_VERTICES) {
+                        fprintf(stderr, "Too many intercepts in fill algorithm!\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+            }
+
+            //  sort the nodes via simple insertion sort
+            for (i = 1; i < nodes; i++) {
+                double temp = nodeX[i];
+                int winding = nodeWinding[i];
+                for (j = i; j > 0 && temp < nodeX[j - 1]; j--) {
+                    nodeX[j] = nodeX[j - 1];
+                    nodeWinding[j] = nodeWinding[j - 1];
+                }
+                nodeX[j] = temp;
+                nodeWinding[j] = winding;
+            }
+
+            //  fill the pixels between entering and leaving intercepts, one span write each
+            if (rule == FILL_EVEN_ODD) {
+                for (i = 0; i + 1 < nodes; i += 2) {
+                    fillSpan((int) floor(nodeX[i]) + 1, (int) ceil(nodeX[i + 1]) - 1, y, color);
+                }
+            } else {
+                int winding = 0;
+                double start = 0.0;
+                for (i = 0; i < nodes; i++) {
+                    if (winding == 0) {
+                        start = nodeX[i];
+                    }
+                    winding += nodeWinding[i];
+                    if (winding == 0) {
+                        fillSpan((int) floor(start) + 1, (int) ceil(nodeX[i]) - 1, y, color);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Draws a 1-pixel dot at the given field location using the current draw color.
+     * @param x
+     * @param y
+     */
+    void plotPixel(int x, int y) {
+        reaches(x, y, x, y);
+        if (!insideField(x, y)) {
+
+            // only print the first 100 error messages (prevents runaway output)
+            if (!mainFieldClipped && !mainFieldWindow && ++numPixelsOutOfBounds < 100) {
+                fprintf(stderr, "Pixel out of bounds: (%d,%d)\n", x, y);
+            }
+            return;
+        }
+        if (!insideClip(x, y)) {
+            return;
+        }
+
+        // calculate pixel offset in image data array
+        int idx = mainFieldWidth * (y + mainFieldCenterY)
+                  + (x + mainFieldCenterX);
+
+        // "draw" the pixel by setting the color values in the image matrix
+        mainTurtleImage[idx].red = mainTurtle.strokeColor.red;
+        mainTurtleImage[idx].green = mainTurtle.strokeColor.green;
+        mainTurtleImage[idx].blue = mainTurtle.strokeColor.blue;
+
+        // track total pixels drawn and emit video frame if a frame interval has
+        // been crossed (and only if video saving is enabled, of course)
+        if (mainFieldSaveFrames &&
+            mainFieldPixelCount++ % mainFieldFrameInterval == 0) {
+            saveFrame();
+        }
+    }
+
+    /**
+     * Draws a 1-pixel dot at the given field location using the current fill color.
+     * @param x
+     * @param y
+     */
+    void plotFillPixel(int x, int y) {
+        // check to make sure it's not out of bounds
+        reaches(x, y, x, y);
+        if (!insideClip(x, y)) {
+            return;
+        }
+
+        // calculate pixel offset in image data array
+        int idx = mainFieldWidth * (y + mainFieldCenterY)
+                  + (x + mainFieldCenterX);
+
+        mainTurtleImage[idx].red = mainTurtle.fillColor.red;
+        mainTurtleImage[idx].green = mainTurtle.fillColor.green;
+        mainTurtleImage[idx].blue = mainTurtle.fillColor.blue;
+    }
+
+    /**
+     * Draws an aliased 1-pixel line between the given field pixels.
+     * @param x0
+     * @param y0
+     * @param x1
+     * @param y1
+     */
+    void rasterLine(int x0, int y0, int x1, int y1) {
+        if (!reaches(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1))) {
+            return;
+        }
+
+        // lines that leave the field (or clip) or feed the video output go through plotPixel()
+        if (mainFieldReferenceMode || mainFieldSaveFrames || !insideClip(x0, y0) || !insideClip(x1, y1)) {
+            drawLineReference(x0, y0, x1, y1);
+            return;
+        }
+
+        // both endpoints are on the (convex) field, so every pixel in between is too;
+        // run the same Bresenham variant while stepping a pointer through the image
+        int absX = abs(x1 - x0);
+        int absY = abs(y1 - y0);
+        int offX = x0 < x1 ? 1 : -1;
+        int offY = y0 < y1 ? (int) mainFieldWidth : -(int) mainFieldWidth;
+        rgb color = mainTurtle.strokeColor;
+        rgb *pixel = mainTurtleImage + mainFieldWidth * (y0 + mainFieldCenterY) + (x0 + mainFieldCenterX);
+        int err;
+        int steps;
+
+        *pixel = color;
+        if (absX > absY) {
+            err = absX / 2;
+            for (steps = absX; steps > 0; steps--) {
+                err = err - absY;
+                if (err < 0) {
+                    pixel += offY;
+                    err += absX;
+                }
+                pixel += offX;
+                *pixel = color;
+            }
+        } else {
+            err = absY / 2;
+            for (steps = absY; steps > 0; steps--) {
+                err = err - absX;
+                if (err < 0) {
+                    pixel += offX;
+                    err += absY;
+                }
+                pixel += offY;
+                *pixel = color;
+            }
+        }
+    }
+
+    /**
+     * Draws a 1-pixel line between points given in 24.8 fixed point (see setFixedPoint()).
+     * Along the major axis, every pixel column (or row) from the one holding the start to the one holding
+     * the end gets the pixel whose center is nearest the line, found by a Bresenham-style walk whose error
+     * term starts from the exact fractions of the ends; the pixels holding the two ends are drawn as well.
+     * @param x0 start, in 1/256 image pixels
+     * @param y0
+     * @param x1 end, in 1/256 image pixels
+     * @param y1
+     */
+    void rasterLineFixed(long long x0, long long y0, long long x1, long long y1) {
+        // pixels stay within one pixel of the ends' pixels across the line
+        int left = (int) fixedToPixel(std::min(x0, x1)) - 1;
+        int bottom = (int) fixedToPixel(std::min(y0, y1)) - 1;
+        int right = (int) fixedToPixel(std::max(x0, x1)) + 1;
+        int top = (int) fixedToPixel(std::max(y0, y1)) + 1;
+        if (!reaches(left, bottom, right, top)) {
+            return;
+        }
+
+        fixedLine line = startFixedLine(x0, y0, x1, y1);
+        if (mainFieldReferenceMode || mainFieldSaveFrames || !insideClip(left, bottom) || !insideClip(right, top)) {
+            drawFixedLineReference(line);
+            return;
+        }
+
+        // the same walk as drawFixedLineReference(), with a running error term and a pointer into the image
+        long long stride = mainFieldWidth;
+        long long majorStep = line.steep ? stride : 1;
+        long long minorStep = line.steep ? 1 : stride;
+        rgb color = mainTurtle.strokeColor;
+        rgb *origin = mainTurtleImage + stride * mainFieldCenterY + mainFieldCenterX;
+        origin[line.first * majorStep + line.firstRow * minorStep] = color;
+        origin[line.last * majorStep + line.lastRow * minorStep] = color;
+        if (line.denominator == 0) {
+            return;
+        }
+
+        // the line crosses the first column within half a pixel of the start, so its row there is within one
+        // of firstRow, and as |step| <= denominator, the row changes by at most one per column
+        long long row = line.numerator < 0 ? -1 : line.numerator >= line.denominator ? 1 : 0;
+        long long error = line.numerator - row * line.denominator;
+        rgb *pixel = origin + line.first * majorStep + (line.firstRow + row) * minorStep;
+        for (long long steps = line.last - line.first;; steps--) {
+            *pixel = color;
+            if (steps == 0) {
+                break;
+            }
+            pixel += majorStep;
+            error += line.step;
+            if (error >= line.denominator) {
+                error -= line.denominator;
+                pixel += minorStep;
+            } else if (error < 0) {
+                error += line.denominator;
+                pixel -= minorStep;
+            }
+        }
+    }
+
+    /**
+     * Original (unoptimized) version of rasterLineFixed(), which finds the row of every column on its own.
+     */
+    void drawFixedLineReference(const fixedLine &line) {
+        auto plot = [this, &line](long long column, long long row) {
+            if (line.steep) {
+                plotPixel((int) row, (int) column);
+            } else {
+                plotPixel((int) column, (int) row);
+            }
+        };
+        plot(line.first, line.firstRow);
+        plot(line.last, line.lastRow);
+        if (line.denominator == 0) {
+            return;
+        }
+        for (long long column = line.first; column <= line.last; column++) {
+            plot(column, line.firstRow + floorDivide(line.numerator + (column - line.first) * line.step,
+                                                     line.denominator));
+        }
+    }
+
+    /**
+     * Sets up the walk of rasterLineFixed() along the major axis of a line.
+     * @param x0 start, in 1/256 image pixels
+     * @param y0
+     * @param x1 end, in 1/256 image pixels
+     * @param y1
+     */
+    static fixedLine startFixedLine(long long x0, long long y0, long long x1, long long y1) {
+        fixedLine line;
+        line.steep = std::llabs(y1 - y0) > std::llabs(x1 - x0);
+        if (line.steep) {
+            std::swap(x0, y0);
+            std::swap(x1, y1);
+        }
+        if (x0 > x1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+        line.first = fixedToPixel(x0);
+        line.last = fixedToPixel(x1);
+        line.firstRow = fixedToPixel(y0);
+        line.lastRow = fixedToPixel(y1);
+
+        // the line at the center of column c is y0 + (c * FIXED_ONE - x0) * dy / dx, and its row is
+        // floor((that + FIXED_ONE / 2) / FIXED_ONE); counted from firstRow, it stays small
+        long long dx = x1 - x0;
+        long long dy = y1 - y0;
+        line.denominator = dx * FIXED_ONE;
+        line.numerator = (y0 - line.firstRow * FIXED_ONE + FIXED_ONE / 2) * dx + (line.first * FIXED_ONE - x0) * dy;
+        line.step = dy * FIXED_ONE;
+        return line;
+    }
+
+    /**
+     * Returns the pixel holding a fixed-point coordinate (the nearest pixel center, halves rounding up).
+     */
+    static long long fixedToPixel(long long coordinate) {
+        return (coordinate + FIXED_ONE / 2) >> FIXED_SHIFT;
+    }
+
+    /**
+     * Divides, rounding toward negative infinity.
+     * @param a
+     * @param b positive divisor
+     */
+    static long long floorDivide(long long a, long long b) {
+        long long quotient = a / b;
+        return quotient * b > a ? quotient - 1 : quotient;
+    }
+
+    /**
+     * Converts a coordinate to 24.8 fixed point, rounding to the nearest multiple of 1/256 (halves up).
+     */
+    static long long toFixed(double coordinate) {
+        return roundToInteger(coordinate * FIXED_ONE);
+    }
+
+    /**
+     * Rounds to the nearest integer, halves up.
+     */
+    static long long roundToInteger(double value) {
+        double shifted = value + 0.5;
+        long long result = (long long) shifted;  // truncates; floor() is a library call without SSE4.1
+        return result > shifted ? result - 1 : result;
+    }
+
+    /**
+     * Rounds a coordinate to the nearest multiple of 1/256 (see setFixedPoint()).
+     */
+    static double toFixedGrid(double coordinate) {
+        return (double) toFixed(coordinate) / FIXED_ONE;
+    }
+
+    /**
+     * Draws a line mainFieldScale field pixels thick, i.e. one image pixel wide once the field is downsampled,
+     * as parallel 1-pixel lines offset along the minor axis.
+     * @param x0
+     * @param y0
+     * @param x1
+     * @param y1
+     */
+    void drawBand(int x0, int y0, int x1, int y1) {
+        bool steep = abs(y1 - y0) > abs(x1 - x0);
+        for (int k = -(int) (mainFieldScale - 1) / 2; k <= (int) mainFieldScale / 2; k++) {
+            if (steep) {
+                rasterLine(x0 + k, y0, x1 + k, y1);
+            } else {
+                rasterLine(x0, y0 + k, x1, y1 + k);
+            }
+        }
+    }
+
+    /**
+     * Adds a drawn box and its estimated pixel count to the measurement.
+     * @param left box in image coordinates
+     * @param bottom
+     * @param right
+     * @param top
+     * @param pixels estimated pixels written
+     */
+    void measureBox(double left, double bottom, double right, double top, double pixels) {
+        turtleMeasurement &m = mainFieldMeasurement;
+        m.minX = std::min(m.minX, left);
+        m.minY = std::min(m.minY, bottom);
+        m.maxX = std::max(m.maxX, right);
+        m.maxY = std::max(m.maxY, top);
+        m.pixels += pixels;
+    }
+
+    /**
+     * Measures a line drawn with the current pen.
+     * @param x0 image coordinates
+     * @param y0
+     * @param x1
+     * @param y1
+     */
+    void measureSegment(double x0, double y0, double x1, double y1) {
+        double dx = x1 - x0;
+        double dy = y1 - y0;
+        double half = 0.0;
+        double pixels = std::max(fabs(dx), fabs(dy)) + 1.0;
+        if (mainTurtle.penWidth > 1.0) {
+            half = mainTurtle.penWidth / 2.0;
+            pixels = (sqrt(dx * dx + dy * dy) + mainTurtle.penWidth) * mainTurtle.penWidth;
+        }
+        measureBox(std::min(x0, x1) - half, std::min(y0, y1) - half, std::max(x0, x1) + half, std::max(y0, y1) + half,
+                   pixels);
+        mainFieldMeasurement.segments++;
+    }
+
+    /**
+     * Measures the polygon recorded since beginFill() and the edges closing its contours, then ends the fill.
+     * The other edges of the outline were measured already as the turtle drew them.
+     */
+    void measureFill() {
+        closeContour();
+        int start = 0;
+        double area = 0.0;
+        for (int c = 0; c < mainTurtleContourCount; c++) {
+            int end = mainTurtleContourEnd[c];
+            for (int i = start; i < end; i++) {
+                int next = i + 1 < end ? i + 1 : start;
+                area += mainTurtlePolyX[i] * mainTurtlePolyY[next] - mainTurtlePolyX[next] * mainTurtlePolyY[i];
+            }
+            measureSegment(mainTurtlePolyX[end - 1], mainTurtlePolyY[end - 1], mainTurtlePolyX[start],
+                           mainTurtlePolyY[start]);
+            start = end;
+        }
+        mainFieldMeasurement.pixels += fabs(area) / 2.0;
+        mainFieldMeasurement.fills++;
+        if (mainFieldVector != nullptr) {
+            mainFieldVector->polygon(mainTurtlePolyX, mainTurtlePolyY, mainTurtleContourEnd, mainTurtleContourCount,
+                                     mainTurtle, false);
+            redrawPolygon();
+        }
+        mainTurtle.filled = false;
+    }
+
+    /**
+     * Measures a sprite stamped with its anchor at the given image pixel.
+     * @param sprite
+     * @param x
+     * @param y
+     */
+    void measureSprite(const turtleSprite &sprite, int x, int y) {
+        if (sprite.width == 0 || sprite.height == 0) {
+            return;
+        }
+
+        int covered = 0;
+        for (int row = 0; row < sprite.height; row++) {
+            if (sprite.rowFirst[row] <= sprite.rowLast[row]) {
+                covered += sprite.rowLast[row] - sprite.rowFirst[row] + 1;
+            }
+        }
+        double field = mainFieldScale;
+        measureBox(x + sprite.left / field, y + sprite.bottom / field,
+                   x + (sprite.left + sprite.width - 1) / field, y + (sprite.bottom + sprite.height - 1) / field,
+                   covered / (field * field));
+    }
+
+    /**
+     * Maps a world (turtle) point to image coordinates with the world transform.
+     * @param x
+     * @param y
+     * @param imageX image x-coordinate (output)
+     * @param imageY image y-coordinate (output)
+     */
+    void toImage(double x, double y, double &imageX, double &imageY) const {
+        const turtleTransform &m = mainTurtleTransform;
+        imageX = m.xx * x + m.xy * y + m.x0;
+        imageY = m.yx * x + m.yy * y + m.y0;
+    }
+
+    /**
+     * Checks if a transform leaves every point where it is.
+     * @param m
+     * @return true for the identity
+     */
+    static bool isIdentity(const turtleTransform &m) {
+        return m.xx == 1.0 && m.yx == 0.0 && m.xy == 0.0 && m.yy == 1.0 && m.x0 == 0.0 && m.y0 == 0.0;
+    }
+
+    /**
+     * Draws a line of the turtle's path, given in image coordinates.
+     * Under a world transform, the line is first clipped to the image (grown by the reach of the pen's joins,
+     * caps and smooth edges), so zoomed-in drawings skip everything outside the view. Aliased lines that cross
+     * the border are rasterized from their clipped ends, which may move their pixels by one.
+     * Without a transform, lines are drawn whole, reporting pixels that fall off the field.
+     * @param x0
+     * @param y0
+     * @param x1
+     * @param y1
+     */
+    void strokeVisible(double x0, double y0, double x1, double y1) {
+        if (mainFieldMeasuring) {
+            measureSegment(x0, y0, x1, y1);
+            if (mainFieldVector != nullptr) {
+                mainFieldVector->line(x0, y0, x1, y1, mainTurtle, true);
+            }
+            return;
+        }
+        if (mainTurtleTransformed) {
+            // thin aliased lines stay on the pixels of the image once their ends are rounded
+            double margin = 0.49;
+            if (mainTurtle.penWidth > 1.0) {
+                margin = mainTurtle.penWidth * MITER_LIMIT / 2.0 + 2.0;
+            } else if (mainFieldAntialiasLines) {
+                margin = 2.0;
+            }
+
+            // the whole segment counts as touched (see takeTouched()), though only its visible part is drawn
+            double reach = margin + 1.0;
+            reaches(toFieldX(fmin(x0, x1) - reach), toFieldY(fmin(y0, y1) - reach),
+                    toFieldX(fmax(x0, x1) + reach), toFieldY(fmax(y0, y1) + reach));
+
+            // clipping to a window that doesn't depend on the view keeps the strokes of every window
+            // (see setOrigin()) the same
+            int width = (int) getWidth();
+            int height = (int) getHeight();
+            int left = std::min(mainFieldOriginX - width / 2, -STROKE_WINDOW);
+            int bottom = std::min(mainFieldOriginY - height / 2, -STROKE_WINDOW);
+            int right = std::max(mainFieldOriginX - width / 2 + width - 1, STROKE_WINDOW);
+            int top = std::max(mainFieldOriginY - height / 2 + height - 1, STROKE_WINDOW);
+            if (!clipSegment(x0, y0, x1, y1, left - margin, bottom - margin, right + margin, top + margin)) {
+                // the stroke left the view: its end cap, if any, lies outside the image
+                flushStroke();
+                return;
+            }
+        }
+        strokeSegment(x0, y0, x1, y1);
+    }
+
+    /**
+     * Clips a segment to a rectangle (Liang-Barsky).
+     * @param x0 start, moved onto the rectangle if outside
+     * @param y0
+     * @param x1 end, moved onto the rectangle if outside
+     * @param y1
+     * @param left rectangle bounds
+     * @param bottom
+     * @param right
+     * @param top
+     * @return false if no part of the segment lies in the rectangle
+     */
+    static bool clipSegment(double &x0, double &y0, double &x1, double &y1,
+                            double left, double bottom, double right, double top) {
+        double dx = x1 - x0;
+        double dy = y1 - y0;
+        double enter = 0.0;
+        double leave = 1.0;
+        const double p[4] = {-dx, dx, -dy, dy};
+        const double q[4] = {x0 - left, right - x0, y0 - bottom, top - y0};
+
+        for (int i = 0; i < 4; i++) {
+            if (p[i] == 0.0) {
+                if (q[i] < 0.0) {
+                    return false;
+                }
+                continue;
+            }
+            double t = q[i] / p[i];
+            if (p[i] < 0.0) {
+                enter = std::max(enter, t);
+            } else {
+                leave = std::min(leave, t);
+            }
+        }
+        if (enter > leave) {
+            return false;
+        }
+
+        // only move endpoints that are actually outside, so visible lines keep their exact ends
+        double startX = x0;
+        double startY = y0;
+        if (leave < 1.0) {
+            x1 = startX + leave * dx;
+            y1 = startY + leave * dy;
+        }
+        if (enter > 0.0) {
+            x0 = startX + enter * dx;
+            y0 = startY + enter * dy;
+        }
+        return true;
+    }
+
+    /**
+     * Draws a line of the turtle's path with the current stroke settings.
+     * Aliased lines snap their endpoints to the nearest pixels; anti-aliased lines keep them exact.
+     * Supersampled fields snap to the nearest field pixels and ignore line anti-aliasing.
+     * Pens wider than 1 pixel draw filled pieces of a thick stroke instead.
+     * @param x0
+     * @param y0
+     * @param x1
+     * @param y1
+     */
+    void strokeSegment(double x0, double y0, double x1, double y1) {
+        if (mainTurtle.penWidth > 1.0) {
+            strokeThick(toFieldX(x0), toFieldY(y0), toFieldX(x1), toFieldY(y1), true);
+            return;
+        }
+
+        flushStroke();
+        if (mainFieldScale > 1) {
+            drawBand(fieldPoint(toFieldX(x0)), fieldPoint(toFieldY(y0)),
+                     fieldPoint(toFieldX(x1)), fieldPoint(toFieldY(y1)));
+        } else if (mainFieldAntialiasLines) {
+            drawLineAntialiased(x0, y0, x1, y1);
+        } else if (mainTurtleFixed && !mainTurtleTransformed && fmax(fmax(fabs(x0), fabs(y0)),
+                                                                     fmax(fabs(x1), fabs(y1))) < FIXED_LIMIT) {
+            // the ends lie on the fixed-point grid, so these conversions are exact
+            rasterLineFixed((long long) (x0 * FIXED_ONE), (long long) (y0 * FIXED_ONE),
+                            (long long) (x1 * FIXED_ONE), (long long) (y1 * FIXED_ONE));
+        } else {
+            drawLine((int) round(x0), (int) round(y0), (int) round(x1), (int) round(y1));
+        }
+    }
+
+    /**
+     * Draws one segment of a thick stroke as a filled quad, together with the join to the previous
+     * segment if the stroke continues, or else the start cap. The end cap is drawn by flushStroke()
+     * once it is clear that the stroke does not continue.
+     * Each piece is filled in one nonzero pass, so pixels are written about once whatever the pen width.
+     * @param x0 start, in field coordinates
+     * @param y0
+     * @param x1 end, in field coordinates
+     * @param y1
+     * @param startCap draw a cap if the stroke starts here?
+     */
+    void strokeThick(double x0, double y0, double x1, double y1, bool startCap) {
+        double halfWidth = mainTurtle.penWidth * mainFieldScale / 2.0;
+        double dx = x1 - x0;
+        double dy = y1 - y0;
+        double length = sqrt(dx * dx + dy * dy);
+        if (length == 0.0) {
+            return;
+        }
+        dx /= length;
+        dy /= length;
+
+        rgb color = mainTurtle.strokeColor;
+        bool continues = mainTurtleStrokeOpen && x0 == mainTurtleStroke.x && y0 == mainTurtleStroke.y &&
+                         halfWidth == mainTurtleStroke.halfWidth && sameColor(color, mainTurtleStroke.color);
+        if (!continues) {
+            flushStroke();
+        }
+
+        // the quad reaches half a pixel past both ends, so neighboring pieces overlap instead of
+        // leaving a seam where an end falls exactly on pixel centers
+        double ex = dx * 0.5;
+        double ey = dy * 0.5;
+        double nx = -dy * halfWidth;
+        double ny = dx * halfWidth;
+        addShapePoint(x0 - ex - nx, y0 - ey - ny);
+        addShapePoint(x1 + ex - nx, y1 + ey - ny);
+        addShapePoint(x1 + ex + nx, y1 + ey + ny);
+        addShapePoint(x0 - ex + nx, y0 - ey + ny);
+        closeShapeContour();
+
+        if (continues) {
+            appendJoin(x0, y0, mainTurtleStroke.dx, mainTurtleStroke.dy, dx, dy, halfWidth);
+        } else if (startCap) {
+            appendCap(x0, y0, -dx, -dy, halfWidth, mainTurtle.lineCap);
+        }
+        fillShape(color);
+
+        mainTurtleStrokeOpen = true;
+        mainTurtleStroke = {x1, y1, dx, dy, halfWidth, color, mainTurtle.lineCap};
+    }
+
+    /**
+     * Ends the current thick stroke, drawing its end cap.
+     * Called before anything else is drawn or the field is read, so strokes stay in drawing order.
+     */
+    void flushStroke() {
+        if (!mainTurtleStrokeOpen) {
+            return;
+        }
+        mainTurtleStrokeOpen = false;
+
+        strokeEnd end = mainTurtleStroke;
+        appendCap(end.x, end.y, end.dx, end.dy, end.halfWidth, end.cap);
+        fillShape(end.color);
+    }
+
+    /**
+     * Draws the outline of a closed contour with the thick pen: joins at every vertex and no caps.
+     * @param xs vertex x-coords, in field coordinates
+     * @param ys vertex y-coords, in field coordinates
+     * @param count number of vertices
+     */
+    void strokeClosedThick(const double *xs, const double *ys, int count) {
+        flushStroke();
+        for (int i = 0; i < count; i++) {
+            strokeThick(xs[i], ys[i], xs[(i + 1) % count], ys[(i + 1) % count], false);
+        }
+        if (!mainTurtleStrokeOpen) {
+            return;
+        }
+
+        // close the loop with the join between the last and the first nonempty side
+        for (int i = 0; i < count; i++) {
+            double dx = xs[(i + 1) % count] - xs[i];
+            double dy = ys[(i + 1) % count] - ys[i];
+            double length = sqrt(dx * dx + dy * dy);
+            if (length > 0.0) {
+                strokeEnd end = mainTurtleStroke;
+                appendJoin(end.x, end.y, end.dx, end.dy, dx / length, dy / length, end.halfWidth);
+                fillShape(end.color);
+                break;
+            }
+        }
+        mainTurtleStrokeOpen = false;
+    }
+
+    /**
+     * Adds the outer corner of a thick stroke at (x,y) to the current shape.
+     * @param x corner, in field coordinates
+     * @param y
+     * @param dx0 unit direction of the incoming segment
+     * @param dy0
+     * @param dx1 unit direction of the outgoing segment
+     * @param dy1
+     * @param halfWidth half the pen width, in field pixels
+     */
+    void appendJoin(double x, double y, double dx0, double dy0, double dx1, double dy1, double halfWidth) {
+        double cross = dx0 * dy1 - dy0 * dx1;
+        double dot = dx0 * dx1 + dy0 * dy1;
+        if (fabs(cross) < 1e-12 && dot > 0.0) {
+            return;  // straight on, the quads already meet
+        }
+
+        // the gap opens on the right of a left turn and vice versa
+        double side = cross >= 0.0 ? -1.0 : 1.0;
+        double ax = x - side * dy0 * halfWidth;
+        double ay = y + side * dx0 * halfWidth;
+        double bx = x - side * dy1 * halfWidth;
+        double by = y + side * dx1 * halfWidth;
+
+        addShapePoint(x, y);
+        addShapePoint(ax, ay);
+        if (mainTurtle.lineJoin == JOIN_ROUND) {
+            appendArc(x, y, halfWidth, atan2(ay - y, ax - x), -side * acos(fmax(-1.0, fmin(1.0, dot))));
+        } else if (mainTurtle.lineJoin == JOIN_MITER && 1.0 + dot >= 2.0 / (MITER_LIMIT * MITER_LIMIT)) {
+            // the tip lies on the bisector of the two offset normals
+            double scale = side * halfWidth / (1.0 + dot);
+            addShapePoint(x - (dy0 + dy1) * scale, y + (dx0 + dx1) * scale);
+        }
+        addShapePoint(bx, by);
+        closeShapeContour();
+    }
+
+    /**
+     * Adds the cap of a thick stroke ending at (x,y) to the current shape.
+     * @param x end, in field coordinates
+     * @param y
+     * @param dx unit direction pointing away from the stroke
+     * @param dy
+     * @param halfWidth half the pen width, in field pixels
+     * @param cap cap style
+     */
+    void appendCap(double x, double y, double dx, double dy, double halfWidth, turtleLineCap cap) {
+        double nx = -dy * halfWidth;
+        double ny = dx * halfWidth;
+        if (cap == CAP_ROUND) {
+            addShapePoint(x, y);
+            appendArc(x, y, halfWidth, atan2(ny, nx), -M_PI);
+            closeShapeContour();
+        } else if (cap == CAP_SQUARE) {
+            addShapePoint(x + nx, y + ny);
+            addShapePoint(x - nx, y - ny);
+            addShapePoint(x - nx + dx * halfWidth, y - ny + dy * halfWidth);
+            addShapePoint(x + nx + dx * halfWidth, y + ny + dy * halfWidth);
+            closeShapeContour();
+        }
+    }
+
+    /**
+     * Adds points along a circular arc to the current contour, both ends included.
+     * Uses as few points as keep the chords within a quarter pixel of the arc.
+     * @param x center, in field coordinates
+     * @param y
+     * @param radius
+     * @param start angle of the first point
+     * @param sweep signed angle covered by the arc
+     */
+    void appendArc(double x, double y, double radius, double start, double sweep) {
+        double step = radius > 0.25 ? 2.0 * acos(1.0 - 0.25 / radius) : M_PI / 2.0;
+        int steps = (int) fmax(1.0, ceil(fabs(sweep) / step));
+        for (int i = 0; i <= steps; i++) {
+            double angle = start + sweep * i / steps;
+            addShapePoint(x + radius * cos(angle), y + radius * sin(angle));
+        }
+    }
+
+    /**
+     * Adds a vertex to the last contour of the current shape.
      * @param x
      * @param y
      */
-    void goTo(double x, double y) {
-        // draw line if pen is down
-        if (mainTurtle.pendown) {
-            drawLine((int) round(mainTurtle.xpos),
-                     (int) round(mainTurtle.ypos),
-                     (int) round(x),
-                     (int) round(y));
+    void addShapePoint(double x, double y) {
+        mainTurtleShapeX.push_back(x);
+        mainTurtleShapeY.push_back(y);
+    }
+
+    /**
+     * Closes the last contour of the current shape, turning it counterclockwise
+     * so that overlapping contours add up under the nonzero rule.
+     */
+    void closeShapeContour() {
+        int start = mainTurtleShapeEnd.empty() ? 0 : mainTurtleShapeEnd.back();
+        int end = (int) mainTurtleShapeX.size();
+
+        double area = 0.0;
+        for (int i = start, j = end - 1; i < end; j = i++) {
+            area += (mainTurtleShapeX[j] - mainTurtleShapeX[i]) * (mainTurtleShapeY[j] + mainTurtleShapeY[i]);
+        }
+        if (area < 0.0) {
+            std::reverse(mainTurtleShapeX.begin() + start, mainTurtleShapeX.end());
+            std::reverse(mainTurtleShapeY.begin() + start, mainTurtleShapeY.end());
+        }
+        mainTurtleShapeEnd.push_back(end);
+    }
+
+    /**
+     * Fills the contours of the current shape with the nonzero rule and starts a new shape.
+     * @param color
+     */
+    void fillShape(rgb color) {
+        if (!mainTurtleShapeEnd.empty()) {
+            fillPolygon(mainTurtleShapeX.data(), mainTurtleShapeY.data(), mainTurtleShapeEnd.data(),
+                        (int) mainTurtleShapeEnd.size(), FILL_NONZERO, color, false);
         }
+        mainTurtleShapeX.clear();
+        mainTurtleShapeY.clear();
+        mainTurtleShapeEnd.clear();
+    }
 
-        // change current turtle position
-        mainTurtle.xpos = (double) x;
-        mainTurtle.ypos = (double) y;
+    /**
+     * Draws an anti-aliased line using Xiaolin Wu's algorithm.
+     * The endpoints are handled in floating point, the main loop steps the intercept in 16.16 fixed point
+     * and derives 8-bit coverage from its fraction.
+     * @param x0
+     * @param y0
+     * @param x1
+     * @param y1
+     */
+    void drawLineAntialiased(double x0, double y0, double x1, double y1) {
+        //   https://en.wikipedia.org/wiki/Xiaolin_Wu%27s_line_algorithm
+        if (!reaches(fmin(x0, x1) - 1.0, fmin(y0, y1) - 1.0, fmax(x0, x1) + 1.0, fmax(y0, y1) + 1.0)) {
+            return;
+        }
+        if (mainFieldReferenceMode) {
+            drawLineAntialiasedReference(x0, y0, x1, y1);
+            return;
+        }
+        bool steep = fabs(y1 - y0) > fabs(x1 - x0);
+        if (steep) {
+            std::swap(x0, y0);
+            std::swap(x1, y1);
+        }
+        if (x0 > x1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
 
-        // track coordinates for filling
-        if (mainTurtle.filled && mainTurtle.pendown &&
-            mainTurtlePolyVertexCount < MAX_POLYGON_VERTICES) {
-            mainTurtlePolyX[mainTurtlePolyVertexCount] = x;
-            mainTurtlePolyY[mainTurtlePolyVertexCount] = y;
-            mainTurtlePolyVertexCount++;
+        double dx = x1 - x0;
+        double gradient = dx == 0.0 ? 1.0 : (y1 - y0) / dx;
+        rgb color = mainTurtle.strokeColor;
+
+        // first endpoint
+        double xend = floor(x0 + 0.5);
+        double yend = y0 + gradient * (xend - x0);
+        double xgap = 1.0 - (x0 + 0.5 - floor(x0 + 0.5));
+        int first = (int) xend;
+        plotEndpoint(steep, first, yend, xgap, color);
+        double intery = yend + gradient;
+
+        // second endpoint
+        xend = floor(x1 + 0.5);
+        yend = y1 + gradient * (xend - x1);
+        xgap = x1 + 0.5 - floor(x1 + 0.5);
+        int last = (int) xend;
+        if (last != first) {
+            plotEndpoint(steep, last, yend, xgap, color);
+        }
+
+        // skip the part of the main loop outside the field (or clip); the fixed-point steps are exact,
+        // so starting later gives the same pixels
+        int columnMin = mainFieldClipLeft - mainFieldCenterX;
+        int columnMax = mainFieldClipRight - mainFieldCenterX;
+        int rowMin = mainFieldClipBottom - mainFieldCenterY;
+        int rowMax = mainFieldClipTop - mainFieldCenterY;
+        int majorMin = steep ? rowMin : columnMin;
+        int majorMax = steep ? rowMax : columnMax;
+        int start = first + 1 > majorMin ? first + 1 : majorMin;
+        int stop = last - 1 < majorMax ? last - 1 : majorMax;
+
+        long long fixedY = llround(intery * 65536.0);
+        long long fixedStep = llround(gradient * 65536.0);
+        fixedY += fixedStep * (start - (first + 1));
+        if (start > stop) {
+            return;
+        }
+
+        // when both pixels of every step are on the field (and no video is recorded),
+        // blend straight into the image with the stroke color converted to linear light once
+        int minorMin = steep ? columnMin : rowMin;
+        int minorMax = steep ? columnMax : rowMax;
+        long long lastY = fixedY + fixedStep * (stop - start);
+        int lowY = (int) ((fixedY < lastY ? fixedY : lastY) >> 16);
+        int highY = (int) ((fixedY > lastY ? fixedY : lastY) >> 16);
+
+        if (mainFieldSaveFrames || lowY < minorMin || highY + 1 > minorMax) {
+            for (int x = start; x <= stop; x++) {
+                int y = (int) (fixedY >> 16);
+                int alpha = (int) ((fixedY >> 8) & 0xFF);
+                if (steep) {
+                    blendPoint(y, x, color, 255 - alpha);
+                    blendPoint(y + 1, x, color, alpha);
+                } else {
+                    blendPoint(x, y, color, 255 - alpha);
+                    blendPoint(x, y + 1, color, alpha);
+                }
+                fixedY += fixedStep;
+            }
+            return;
+        }
+
+        const gammaTables &gamma = gammaLookup();
+        int red = gamma.toLinear[color.red];
+        int green = gamma.toLinear[color.green];
+        int blue = gamma.toLinear[color.blue];
+        auto blend = [&](rgb *pixel, int alpha) {
+            int inverse = 255 - alpha;
+            pixel->red = gamma.toSRGB[(gamma.toLinear[pixel->red] * inverse + red * alpha + 127) / 255];
+            pixel->green = gamma.toSRGB[(gamma.toLinear[pixel->green] * inverse + green * alpha + 127) / 255];
+            pixel->blue = gamma.toSRGB[(gamma.toLinear[pixel->blue] * inverse + blue * alpha + 127) / 255];
+        };
+
+        // step along the major axis: one pixel in x, or one row in y for steep lines
+        ptrdiff_t width = mainFieldWidth;
+        ptrdiff_t majorStride = steep ? width : 1;
+        ptrdiff_t minorStride = steep ? 1 : width;
+        rgb *origin = mainTurtleImage + mainFieldCenterY * width + mainFieldCenterX;
+        for (int x = start; x <= stop; x++) {
+            int y = (int) (fixedY >> 16);
+            int alpha = (int) ((fixedY >> 8) & 0xFF);
+            rgb *pixel = origin + x * majorStride + y * minorStride;
+            blend(pixel, 255 - alpha);
+            blend(pixel + minorStride, alpha);
+            fixedY += fixedStep;
+        }
+    }
+
+    /**
+     * Original (unoptimized) version of drawLineAntialiased(): computes the intercept of every column
+     * from the first one and blends each pixel through blendPoint(), without skipping the part outside the clip.
+     */
+    void drawLineAntialiasedReference(double x0, double y0, double x1, double y1) {
+        bool steep = fabs(y1 - y0) > fabs(x1 - x0);
+        if (steep) {
+            std::swap(x0, y0);
+            std::swap(x1, y1);
+        }
+        if (x0 > x1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+
+        double dx = x1 - x0;
+        double gradient = dx == 0.0 ? 1.0 : (y1 - y0) / dx;
+        rgb color = mainTurtle.strokeColor;
+
+        double xend = floor(x0 + 0.5);
+        double yend = y0 + gradient * (xend - x0);
+        int first = (int) xend;
+        plotEndpoint(steep, first, yend, 1.0 - (x0 + 0.5 - floor(x0 + 0.5)), color);
+        long long fixedY = llround((yend + gradient) * 65536.0);
+        long long fixedStep = llround(gradient * 65536.0);
+
+        xend = floor(x1 + 0.5);
+        int last = (int) xend;
+        if (last != first) {
+            plotEndpoint(steep, last, y1 + gradient * (xend - x1), x1 + 0.5 - floor(x1 + 0.5), color);
+        }
+
+        for (int x = first + 1; x < last; x++) {
+            long long intercept = fixedY + fixedStep * (x - (first + 1));
+            int y = (int) (intercept >> 16);
+            int alpha = (int) ((intercept >> 8) & 0xFF);
+            if (steep) {
+                blendPoint(y, x, color, 255 - alpha);
+                blendPoint(y + 1, x, color, alpha);
+            } else {
+                blendPoint(x, y, color, 255 - alpha);
+                blendPoint(x, y + 1, color, alpha);
+            }
+        }
+    }
+
+    /**
+     * Plots the two pixels of an endpoint of a Wu line.
+     * @param steep are the coordinates swapped (x is the minor axis)?
+     * @param major coordinate along the major axis
+     * @param minor exact coordinate along the minor axis
+     * @param gap fraction of the endpoint pixel covered along the major axis
+     * @param color
+     */
+    void plotEndpoint(bool steep, int major, double minor, double gap, rgb color) {
+        double base = floor(minor);
+        double fraction = minor - base;
+        int lower = (int) round((1.0 - fraction) * gap * 255.0);
+        int upper = (int) round(fraction * gap * 255.0);
+        if (steep) {
+            blendPoint((int) base, major, color, lower);
+            blendPoint((int) base + 1, major, color, upper);
+        } else {
+            blendPoint(major, (int) base, color, lower);
+            blendPoint(major, (int) base + 1, color, upper);
+        }
+    }
+
+    /**
+     * Blends a color over the pixel at the given turtle coordinates, if it lies on the field and inside the clip.
+     * @param x
+     * @param y
+     * @param color
+     * @param alpha opacity, 0 to 255
+     */
+    void blendPoint(int x, int y, rgb color, int alpha) {
+        if (alpha <= 0 || !insideClip(x, y)) {
+            return;
+        }
+
+        blendPixel(mainTurtleImage + mainFieldWidth * (y + mainFieldCenterY) + (x + mainFieldCenterX),
+                   color, alpha);
+
+        // anti-aliased pixels count towards video frames just like plotPixel()
+        if (mainFieldSaveFrames &&
+            mainFieldPixelCount++ % mainFieldFrameInterval == 0) {
+            saveFrame();
+        }
+    }
+
+    /**
+     * Anti-aliased version of fillPolygon(): accumulates the exact signed area covered by each edge
+     * in a row-local buffer, then resolves the row with a prefix sum and blends every pixel once.
+     * @param xs vertex x-coords
+     * @param ys vertex y-coords
+     * @param contourEnd index one past the last vertex of each contour
+     * @param contours number of contours
+     * @param rule fill rule for overlapping contours
+     * @param color fill color
+     */
+    void fillPolygonAntialiased(const double *xs, const double *ys, const int *contourEnd, int contours,
+                                turtleFillRule rule, rgb color) {
+        // convert the edges to field cell coordinates, where pixel centers lie at half-integers
+        std::vector<coverageEdge> edges;
+        double offsetX = mainFieldCenterX + 0.5;
+        double offsetY = mainFieldCenterY + 0.5;
+        double minY = HUGE_VAL;
+        double maxY = -HUGE_VAL;
+        double minX = HUGE_VAL;
+        double maxX = -HUGE_VAL;
+
+        for (int c = 0; c < contours; c++) {
+            int start = c > 0 ? contourEnd[c - 1] : 0;
+            int j = contourEnd[c] - 1;
+            for (int i = start; i < contourEnd[c]; i++) {
+                coverageEdge edge{};
+                bool up = ys[i] > ys[j];
+                int low = up ? j : i;
+                int high = up ? i : j;
+                edge.x0 = xs[low] + offsetX;
+                edge.y0 = ys[low] + offsetY;
+                edge.x1 = xs[high] + offsetX;
+                edge.y1 = ys[high] + offsetY;
+                edge.direction = up ? 1.0 : -1.0;
+                j = i;
+                if (edge.y0 == edge.y1) continue;    // horizontal edges cover no area
+
+                edge.dxdy = (edge.x1 - edge.x0) / (edge.y1 - edge.y0);
+                edges.push_back(edge);
+                minY = fmin(minY, edge.y0);
+                maxY = fmax(maxY, edge.y1);
+                minX = fmin(minX, fmin(edge.x0, edge.x1));
+                maxX = fmax(maxX, fmax(edge.x0, edge.x1));
+            }
+        }
+        if (edges.empty() || !reaches(minX - offsetX - 1.0, minY - offsetY - 1.0, maxX - offsetX + 1.0,
+                                      maxY - offsetY + 1.0)) {
+            return;
+        }
+
+        int firstRow = (int) fmax(mainFieldClipBottom, fmin(floor(minY), (double) mainFieldClipTop + 1.0));
+        int lastRow = (int) fmin(mainFieldClipTop, fmax(ceil(maxY) - 1.0, firstRow - 1.0));
+        double rows = lastRow - firstRow + 1.0;
+        double columns = fmin(maxX, (double) mainFieldWidth) - fmax(minX, 0.0);
+
+        if (rows * columns >= PARALLEL_FILL_PIXELS) {
+            parallelFor((size_t) rows, PARALLEL_FILL_ROWS, [&](size_t begin, size_t end) {
+                fillCoverageRows(edges.data(), (int) edges.size(), rule, color,
+                                 firstRow + (int) begin, firstRow + (int) end - 1);
+            });
+        } else {
+            fillCoverageRows(edges.data(), (int) edges.size(), rule, color, firstRow, lastRow);
+        }
+    }
+
+    /**
+     * Rasterizes the given field rows of an anti-aliased polygon; see fillPolygonAntialiased().
+     * @param edges polygon edges in field cell coordinates
+     * @param count number of edges
+     * @param rule fill rule for overlapping contours
+     * @param color fill color
+     * @param firstRow first field row (0 = bottom)
+     * @param lastRow last field row (inclusive)
+     */
+    void fillCoverageRows(const coverageEdge *edges, int count, turtleFillRule rule, rgb color,
+                          int firstRow, int lastRow) {
+        // accumulation scheme as in font-rs by Raph Levien:
+        //   https://medium.com/@raphlinus/inside-the-fastest-font-renderer-in-the-world-75ae5270c445
+        int width = (int) mainFieldWidth;
+        std::vector<double> area((size_t) width + 2, 0.0);
+
+        for (int row = firstRow; row <= lastRow; row++) {
+            int first = width + 1;
+            int last = -1;
+
+            for (int e = 0; e < count; e++) {
+                const coverageEdge &edge = edges[e];
+                if (edge.y1 <= row || edge.y0 >= row + 1) continue;
+
+                // the part of the edge inside this row, cut where it crosses the sides of the field; pieces
+                // beyond a side are moved onto it, which leaves the coverage of the pixels inside unchanged
+                double ya = fmax((double) row, edge.y0);
+                double yb = fmin(row + 1.0, edge.y1);
+                double xa = edge.x0 + (ya - edge.y0) * edge.dxdy;
+                double xb = edge.x0 + (yb - edge.y0) * edge.dxdy;
+                double d = (yb - ya) * edge.direction;
+                double cuts[4] = {0.0, 1.0, 1.0, 1.0};
+                int pieces = 1;
+                for (double side : {0.0, (double) width}) {
+                    if ((xa < side) != (xb < side) && xa != side && xb != side) {
+                        cuts[pieces++] = (side - xa) / (xb - xa);
+                    }
+                }
+                if (pieces == 3 && cuts[2] < cuts[1]) {
+                    std::swap(cuts[1], cuts[2]);
+                }
+                cuts[pieces] = 1.0;
+                for (int k = 0; k < pieces; k++) {
+                    double x0 = fmin(fmax(xa + (xb - xa) * cuts[k], 0.0), (double) width);
+                    double x1 = fmin(fmax(xa + (xb - xa) * cuts[k + 1], 0.0), (double) width);
+                    accumulateArea(area.data(), x0, x1, d * (cuts[k + 1] - cuts[k]), first, last);
+                }
+            }
+            if (last < 0) continue;
+
+            // the prefix sum of the accumulated areas is the signed coverage of each pixel;
+            // it only changes where an edge deposited area, so runs in between are resolved at once
+            rgb *line = mainTurtleImage + (size_t) row * width;
+            double sum = 0.0;
+            int x = first;
+            while (x <= last) {
+                sum += area[x];
+                area[x] = 0.0;
+                int end = x + 1;
+                while (end <= last && area[end] == 0.0) {
+                    end++;
+                }
+
+                double coverage = fabs(sum);
+                if (rule == FILL_EVEN_ODD) {
+                    coverage = fmod(coverage, 2.0);
+                    if (coverage > 1.0) coverage = 2.0 - coverage;
+                } else if (coverage > 1.0) {
+                    coverage = 1.0;
+                }
+
+                int alpha = coverageAlpha(coverage);
+                int start = x > mainFieldClipLeft ? x : mainFieldClipLeft;
+                int stop = end <= mainFieldClipRight ? end : mainFieldClipRight + 1;
+                if (alpha >= 255) {
+                    if (stop > start) fillRun(line + start, stop - start, color);
+                } else if (alpha > 0) {
+                    for (int i = start; i < stop; i++) {
+                        blendPixel(line + i, color, alpha);
+                    }
+                }
+                x = end;
+            }
+        }
+    }
+
+    /**
+     * Adds the signed area to the right of a line segment crossing one pixel row to the row's area buffer.
+     * @param area row buffer with width + 2 entries
+     * @param xa x-coord where the segment enters the row
+     * @param xb x-coord where the segment leaves the row
+     * @param d signed height of the segment within the row
+     * @param first lowest touched index (updated)
+     * @param last highest touched index (updated)
+     */
+    static void accumulateArea(double *area, double xa, double xb, double d, int &first, int &last) {
+        double x0 = fmin(xa, xb);
+        double x1 = fmax(xa, xb);
+        double x0floor = floor(x0);
+        double x1ceil = ceil(x1);
+        int x0i = (int) x0floor;
+        int x1i = (int) x1ceil;
+
+        if (x1i <= x0i + 1) {
+            // the segment stays within one pixel column
+            double xmf = 0.5 * (xa + xb) - x0floor;
+            area[x0i] += d - d * xmf;
+            area[x0i + 1] += d * xmf;
+            x1i = x0i + 1;
+        } else {
+            double s = 1.0 / (x1 - x0);
+            double x0f = x0 - x0floor;
+            double a0 = 0.5 * s * (1.0 - x0f) * (1.0 - x0f);
+            double x1f = x1 - x1ceil + 1.0;
+            double am = 0.5 * s * x1f * x1f;
+
+            area[x0i] += d * a0;
+            if (x1i == x0i + 2) {
+                area[x0i + 1] += d * (1.0 - a0 - am);
+            } else {
+                double a1 = s * (1.5 - x0f);
+                area[x0i + 1] += d * (a1 - a0);
+                for (int x = x0i + 2; x < x1i - 1; x++) {
+                    area[x] += d * s;
+                }
+                double a2 = a1 + (x1i - x0i - 3) * s;
+                area[x1i - 1] += d * (1.0 - a2 - am);
+            }
+            area[x1i] += d * am;
+        }
+
+        if (x0i < first) first = x0i;
+        if (x1i > last) last = x1i;
+    }
+
+    /**
+     * Converts the coverage of a pixel to the alpha it is filled with. Coverage is first rounded to COVERAGE_BITS
+     * fraction bits, so that differently summed but equal coverages (0.5 and 0.49999999999999994, say) get the same
+     * alpha instead of landing on either side of a rounding tie.
+     * @param coverage covered fraction of the pixel, 0 to 1
+     * @return alpha, 0 to 255
+     */
+    static int coverageAlpha(double coverage) {
+        long long grid = (long long) (coverage * (1 << COVERAGE_BITS) + 0.5);
+        return (int) ((grid * 255 + (1 << (COVERAGE_BITS - 1))) >> COVERAGE_BITS);
+    }
+
+    /**
+     * Blends a color over a pixel, gamma-correctly: both colors are converted to linear light with lookup tables,
+     * mixed with integer arithmetic and converted back.
+     * @param pixel pixel to modify
+     * @param color color to blend in
+     * @param alpha opacity of color, 0 (invisible) to 255 (opaque)
+     */
+    static void blendPixel(rgb *pixel, rgb color, int alpha) {
+        if (alpha >= 255) {
+            *pixel = color;
+            return;
+        }
+
+        const gammaTables &gamma = gammaLookup();
+        int inverse = 255 - alpha;
+        pixel->red = gamma.toSRGB[(gamma.toLinear[pixel->red] * inverse + gamma.toLinear[color.red] * alpha + 127) / 255];
+        pixel->green = gamma.toSRGB[(gamma.toLinear[pixel->green] * inverse + gamma.toLinear[color.green] * alpha + 127) / 255];
+        pixel->blue = gamma.toSRGB[(gamma.toLinear[pixel->blue] * inverse + gamma.toLinear[color.blue] * alpha + 127) / 255];
+    }
+
+    /**
+     * Returns the sRGB <-> linear light conversion tables, built on first use.
+     * @return lookup tables
+     */
+    static const gammaTables &gammaLookup() {
+        static const gammaTables tables = [] {
+            gammaTables result{};
+            for (int i = 0; i < 256; i++) {
+                double c = i / 255.0;
+                double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+                result.toLinear[i] = (unsigned short) lround(linear * (GAMMA_LINEAR_LEVELS - 1));
+            }
+            for (int i = 0; i < GAMMA_LINEAR_LEVELS; i++) {
+                double linear = (double) i / (GAMMA_LINEAR_LEVELS - 1);
+                double c = linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+                result.toSRGB[i] = (unsigned char) lround(c * 255.0);
+            }
+            return result;
+        }();
+        return tables;
+    }
+
+    /**
+     * Serializes the 54-byte BMP file header (little-endian) for a 24-bit image.
+     * @param header output buffer of 54 bytes
+     * @param width image width
+     * @param height image height
+     * @param bytesPerLine padded length of a pixel row
+     */
+    static void writeBMPHeader(unsigned char *header, unsigned int width, unsigned int height,
+                               unsigned int bytesPerLine) {
+        unsigned int fields[13] = {
+                54 + bytesPerLine * height,   // bfSize
+                0,                            // bfReserved
+                54,                           // bfOffBits
+                40,                           // biSize
+                width,                        // biWidth
+                height,                       // biHeight
+                1 | (24 << 16),               // biPlanes, biBitCount
+                0,                            // biCompression
+                bytesPerLine * height,        // biSizeImage
+                0, 0,                         // biXPelsPerMeter, biYPelsPerMeter
+                0, 0                          // biClrUsed, biClrImportant
+        };
+
+        header[0] = 'B';
+        header[1] = 'M';
+        for (int i = 0; i < 13; i++) {
+            for (int b = 0; b < 4; b++) {
+                header[2 + 4 * i + b] = (unsigned char) (fields[i] >> (8 * b));
+            }
+        }
+    }
+
+    /**
+     * Writes the field to a .bmp file, downsampling supersampled fields.
+     * Unlike saveBMP() it leaves an open thick stroke open, so video frames can be taken mid-stroke.
+     * @param filename
+     */
+    void writeBMP(const char *filename) {
+        if (mainFieldReferenceMode && mainFieldScale == 1) {
+            saveBMPReference(filename);
+            return;
+        }
+
+        FILE *file = fopen(filename, "wb");
+        if (file == nullptr) {
+            fprintf(stderr, "Could not write to file: %s\n", filename);
+            exit(EXIT_FAILURE);
+        }
+        setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        encodeBMPTo([file](const unsigned char *data, size_t size) {
+            fwrite(data, size, 1, file);
+        });
+        fclose(file);
+    }
+
+    /**
+     * Returns the size of a .bmp file of the image: the header and rows padded to multiples of 4 bytes.
+     */
+    size_t sizeOfBMP() const {
+        size_t width = mainFieldWidth / mainFieldScale;
+        size_t height = mainFieldHeight / mainFieldScale;
+        return 54 + (3 * (width + 1) / 4) * 4 * height;
+    }
+
+    /**
+     * Encodes the field as a .bmp file, downsampling supersampled fields, and passes the file to
+     * write(data, size) piece by piece: the header, then one row at a time.
+     * @param write callable taking (const unsigned char *data, size_t size)
+     */
+    template<typename Writer>
+    void encodeBMPTo(Writer write) {
+        auto width = mainFieldWidth / mainFieldScale;
+        auto height = mainFieldHeight / mainFieldScale;
+
+        // the length of each line must be a multiple of 4 bytes
+        unsigned int bytesPerLine = (3 * (width + 1) / 4) * 4;
+
+        unsigned char header[54];
+        writeBMPHeader(header, width, height, bytesPerLine);
+        write(header, sizeof(header));
+
+        auto *line = (unsigned char *) calloc(bytesPerLine, 1);
+        if (line == nullptr) {
+            fprintf(stderr, "Can't allocate memory for BMP file.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        if (mainFieldScale > 1) {
+            // each image row is the average of mainFieldScale field rows
+            auto *sums = (unsigned short *) malloc(3 * (size_t) mainFieldWidth * sizeof(unsigned short));
+            if (sums == nullptr) {
+                fprintf(stderr, "Can't allocate memory for BMP file.\n");
+                exit(EXIT_FAILURE);
+            }
+            for (unsigned int i = 0; i < height; i++) {
+                downsampleRow(i * mainFieldScale, sums, line);
+                write(line, bytesPerLine);
+            }
+            free(sums);
+        } else {
+            // BMP stores rows bottom-up in BGR order, which matches the field's row order
+            const rgb *pixel = mainTurtleImage;
+            for (unsigned int i = 0; i < height; i++) {
+                unsigned char *out = line;
+                for (unsigned int j = 0; j < width; j++, pixel++, out += 3) {
+                    out[0] = pixel->blue;
+                    out[1] = pixel->green;
+                    out[2] = pixel->red;
+                }
+                write(line, bytesPerLine);
+            }
+        }
+
+        free(line);
+    }
+
+    /**
+     * Averages one row of mainFieldScale x mainFieldScale blocks into BMP pixels (BGR order).
+     * @param row first field row of the blocks
+     * @param sums scratch space for 3 * mainFieldWidth column sums
+     * @param out destination, 3 bytes per image pixel
+     */
+    void downsampleRow(unsigned int row, unsigned short *sums, unsigned char *out) const {
+        unsigned int scale = mainFieldScale;
+        size_t bytes = 3 * (size_t) mainFieldWidth;
+        const unsigned char *source = (const unsigned char *) (mainTurtleImage + (size_t) row * mainFieldWidth);
+
+        // vertical pass: add up the block rows byte by byte, 16 bytes at a time
+        // (at most MAX_SUPERSAMPLE^2 * 255 per block, so 16-bit sums never overflow)
+        for (unsigned int k = 0; k < scale; k++, source += bytes) {
+            size_t i = 0;
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 16 <= bytes; i += 16) {
+                __m128i pixels = _mm_loadu_si128((const __m128i *) (source + i));
+                __m128i low = _mm_unpacklo_epi8(pixels, zero);
+                __m128i high = _mm_unpackhi_epi8(pixels, zero);
+                auto *sum = (__m128i *) (sums + i);
+                if (k > 0) {
+                    low = _mm_add_epi16(low, _mm_loadu_si128(sum));
+                    high = _mm_add_epi16(high, _mm_loadu_si128(sum + 1));
+                }
+                _mm_storeu_si128(sum, low);
+                _mm_storeu_si128(sum + 1, high);
+            }
+#endif
+            for (; i < bytes; i++) {
+                sums[i] = (unsigned short) ((k > 0 ? sums[i] : 0) + source[i]);
+            }
+        }
+
+        // horizontal pass: add up the block columns and divide by the block area with a rounded
+        // multiply-shift, which is exact because every dividend is below 2^32 / area
+        unsigned int area = scale * scale;
+        unsigned long long reciprocal = ((1ULL << 32) + area - 1) / area;
+        unsigned int width = mainFieldWidth / scale;
+        const unsigned short *sum = sums;
+        for (unsigned int j = 0; j < width; j++, out += 3) {
+            unsigned int red = area / 2;
+            unsigned int green = area / 2;
+            unsigned int blue = area / 2;
+            for (unsigned int k = 0; k < scale; k++, sum += 3) {
+                red += sum[0];
+                green += sum[1];
+                blue += sum[2];
+            }
+            out[0] = (unsigned char) ((blue * reciprocal) >> 32);
+            out[1] = (unsigned char) ((green * reciprocal) >> 32);
+            out[2] = (unsigned char) ((red * reciprocal) >> 32);
         }
     }
 
+    /**
+     * Draws the circles that make up the turtle, in the current stroke and fill colors.
+     * @param x center
+     * @param y
+     * @param degrees heading
+     */
+    void drawTurtleCircles(int x, int y, int degrees) {
+        // We are going to make our own backup of the turtle, since the circles
+        // are drawn by switching the fill color.
+        turtleState original_turtle = mainTurtle;
+        rgb stroke = mainTurtle.strokeColor;
+        rgb fill = mainTurtle.fillColor;
+
+        double radians = degrees * M_PI / 180.0;
+        double c = cos(radians);
+        double s = sin(radians);
+        auto circle = [&](double forward, double left, int radius, rgb color) {
+            mainTurtle.fillColor = color;
+            fillCircle(x + (int) floor(c * forward - s * left + 0.5),
+                       y + (int) floor(s * forward + c * left + 0.5), radius);
+        };
+
+        // Draw the legs
+        for (int i = -1; i < 2; i += 2) {
+            for (int j = -1; j < 2; j += 2) {
+                circle(i * 7, j * 7, 5, stroke);
+                circle(i * 7, j * 7, 3, fill);
+            }
+        }
+
+        // Draw the head
+        circle(10, 0, 5, stroke);
+        circle(10, 0, 3, fill);
+
+        // Draw the body
+        for (int i = 9; i >= 0; i -= 4) {
+            circle(0, 0, i + 2, stroke);
+            circle(0, 0, i, fill);
+        }
+
+        mainTurtle = original_turtle;
+    }
 
     /**
-     * Rotates the turtle to the given heading (in degrees).
-     * 0 degrees means facing to the right.
-     * 90 degrees means facing straight up.
-     * @param angle
+     * Returns the sprite of the turtle at the given heading in the current colors, rendering it on a cache miss.
+     * @param degrees heading
+     * @return cached sprite
      */
-    void setHeading(double angle) {
-        mainTurtle.heading = angle;
-    }
+    const turtleSprite &turtleSpriteFor(int degrees) {
+        rgb stroke = mainTurtle.strokeColor;
+        rgb fill = mainTurtle.fillColor;
+        if (mainFieldTurtleSprites.empty()) {
+            mainFieldTurtleSprites.resize(TURTLE_SPRITE_CACHE);
+        }
 
+        unsigned int key = (unsigned int) degrees;
+        key = key * 16777619u ^ ((unsigned int) stroke.red << 16 | stroke.green << 8 | stroke.blue);
+        key = key * 16777619u ^ ((unsigned int) fill.red << 16 | fill.green << 8 | fill.blue);
+        turtleSpriteEntry &entry = mainFieldTurtleSprites[(key ^ key >> 16) % TURTLE_SPRITE_CACHE];
+        if (entry.valid && entry.degrees == degrees &&
+            sameColor(entry.strokeColor, stroke) && sameColor(entry.fillColor, fill)) {
+            return entry.sprite;
+        }
 
-    /**
-     * Set the current drawing color.
-     * Each component (red, green, and blue) may be any value between 0 and 255 (inclusive).
-     * Black is (0,0,0) and white is (255,255,255).
-     * @param red
-     * @param green
-     * @param blue
-     */
-    void setPenColor(int red, int green, int blue) {
-        mainTurtle.strokeColor.red = red;
-        mainTurtle.strokeColor.green = green;
-        mainTurtle.strokeColor.blue = blue;
-    }
+        // render the turtle on a black and on a white field: pixels that come out equal are covered
+        const unsigned int size = 33;
+        Turtle dark(size, size, mainFieldScale);
+        Turtle light(size, size, mainFieldScale);
+        memset(dark.mainTurtleImage, 0, sizeof(rgb) * dark.mainFieldWidth * dark.mainFieldHeight);
+        for (Turtle *canvas : {&dark, &light}) {
+            canvas->setPenColor(stroke.red, stroke.green, stroke.blue);
+            canvas->setFillColor(fill.red, fill.green, fill.blue);
+            canvas->drawTurtleCircles(0, 0, degrees);
+        }
 
+        entry.valid = true;
+        entry.degrees = degrees;
+        entry.strokeColor = stroke;
+        entry.fillColor = fill;
+        entry.sprite = spriteFromRenders(dark, light);
+        return entry.sprite;
+    }
 
     /**
-     * Set the current filling color.
-     * Each component (red, green, and blue) may be any value between 0 and 255 (inclusive).
-     * Black is (0,0,0) and white is (255,255,255).
-     * @param red
-     * @param green
-     * @param blue
+     * Builds a sprite from two renders of the same drawing, one started on a black and one on a white field.
+     * Pixels that are equal in both renders are covered. Pixels that differ by less than black and white
+     * are partially covered: in linear light the difference is the uncovered fraction.
+     * The sprite is anchored at image pixel (0,0).
+     * @param dark render on black
+     * @param light render on white
+     * @return sprite cropped to the covered pixels
      */
-    void setFillColor(int red, int green, int blue) {
-        mainTurtle.fillColor.red = red;
-        mainTurtle.fillColor.green = green;
-        mainTurtle.fillColor.blue = blue;
-    }
+    static turtleSprite spriteFromRenders(const Turtle &dark, const Turtle &light) {
+        int width = (int) dark.mainFieldWidth;
+        int height = (int) dark.mainFieldHeight;
+        const gammaTables &gamma = gammaLookup();
+        auto coverage = [&](int column, int row) {
+            size_t i = (size_t) row * width + column;
+            rgb d = dark.mainTurtleImage[i];
+            rgb l = light.mainTurtleImage[i];
+            if (sameColor(d, l)) {
+                return 255;
+            }
+            int uncovered = gamma.toLinear[l.red] - gamma.toLinear[d.red] +
+                            gamma.toLinear[l.green] - gamma.toLinear[d.green] +
+                            gamma.toLinear[l.blue] - gamma.toLinear[d.blue];
+            int alpha = 255 - (uncovered * 255 + 3 * (GAMMA_LINEAR_LEVELS - 1) / 2) / (3 * (GAMMA_LINEAR_LEVELS - 1));
+            return alpha < 0 ? 0 : alpha > 254 ? 254 : alpha;
+        };
+        auto covered = [&](int column, int row) {
+            return coverage(column, row) > 0;
+        };
+
+        int minColumn = width;
+        int maxColumn = -1;
+        int minRow = height;
+        int maxRow = -1;
+        for (int row = 0; row < height; row++) {
+            for (int column = 0; column < width; column++) {
+                if (covered(column, row)) {
+                    minColumn = column < minColumn ? column : minColumn;
+                    maxColumn = column > maxColumn ? column : maxColumn;
+                    minRow = row < minRow ? row : minRow;
+                    maxRow = row;
+                }
+            }
+        }
 
+        turtleSprite sprite;
+        if (maxRow < 0) {
+            return sprite;
+        }
+        sprite.width = maxColumn - minColumn + 1;
+        sprite.height = maxRow - minRow + 1;
+        sprite.left = minColumn - dark.mainFieldCenterX - dark.blockX(0);
+        sprite.bottom = minRow - dark.mainFieldCenterY - dark.blockY(0);
+        sprite.pixels.assign(3 * (size_t) sprite.width * sprite.height, 0);
+        sprite.mask.assign(3 * (size_t) sprite.width * sprite.height, 0);
+        sprite.rowFirst.assign(sprite.height, sprite.width);
+        sprite.rowLast.assign(sprite.height, -1);
+
+        for (int r = 0; r < sprite.height; r++) {
+            for (int c = 0; c < sprite.width; c++) {
+                int alpha = coverage(minColumn + c, minRow + r);
+                if (alpha == 0) continue;
+
+                rgb color = dark.mainTurtleImage[(size_t) (minRow + r) * width + minColumn + c];
+                if (alpha < 255) {
+                    // on black the pixel is color * alpha in linear light
+                    auto unmix = [&](unsigned char component) {
+                        int linear = (gamma.toLinear[component] * 255 + alpha / 2) / alpha;
+                        return gamma.toSRGB[linear < GAMMA_LINEAR_LEVELS ? linear : GAMMA_LINEAR_LEVELS - 1];
+                    };
+                    sprite.partial.push_back({c, r, {unmix(color.red), unmix(color.green), unmix(color.blue)}, alpha});
+                    continue;
+                }
 
-    /**
-     * Draws a 1-pixel dot at the current location, regardless of pen status.
-     */
-    void dot() {
-        // draw a pixel at the current location, regardless of pen status
-        drawPixel((int) round(mainTurtle.xpos),
-                  (int) round(mainTurtle.ypos));
+                size_t i = 3 * ((size_t) r * sprite.width + c);
+                sprite.pixels[i] = color.red;
+                sprite.pixels[i + 1] = color.green;
+                sprite.pixels[i + 2] = color.blue;
+                memset(&sprite.mask[i], 0xff, 3);
+                if (c < sprite.rowFirst[r]) sprite.rowFirst[r] = c;
+                sprite.rowLast[r] = c;
+            }
+        }
+        return sprite;
     }
 
-
     /**
-     * Draw a 1-pixel dot at the given location using the current draw color,
-     * regardless of current turtle location or pen status.
-     * @param x
+     * Copies the covered pixels of a sprite onto the field, clipped to the field.
+     * @param sprite
+     * @param x image pixel the sprite is anchored at
      * @param y
+     * @param tint color to draw every pixel in instead of the sprite's colors (taken from mainFieldTintRow),
+     *             or nullptr
      */
-    void drawPixel(int x, int y) {
-        if (x < (-mainFieldWidth / 2) || x > (mainFieldWidth / 2) ||
-            y < (-mainFieldHeight / 2) || y > (mainFieldHeight / 2)) {
-
-            // only print the first 100 error messages (prevents runaway output)
-            if (++numPixelsOutOfBounds < 100) {
-                fprintf(stderr, "Pixel out of bounds: (%d,%d)\n", x, y);
-            }
+    void stampSprite(const turtleSprite &sprite, int x, int y, const rgb *tint = nullptr) {
+        int width = (int) mainFieldWidth;
+        int left = blockX(x) + sprite.left + mainFieldCenterX;
+        int bottom = blockY(y) + sprite.bottom + mainFieldCenterY;
+        if (!reaches(left - mainFieldCenterX, bottom - mainFieldCenterY, left - mainFieldCenterX + sprite.width - 1,
+                     bottom - mainFieldCenterY + sprite.height - 1)) {
             return;
         }
 
-        // calculate pixel offset in image data array
-        int idx = mainFieldWidth * (y + mainFieldHeight / 2)
-                  + (x + mainFieldWidth / 2);
+        for (int r = 0; r < sprite.height; r++) {
+            int row = bottom + r;
+            if (row < mainFieldClipBottom || row > mainFieldClipTop) continue;
 
-        // "draw" the pixel by setting the color values in the image matrix
-        if (idx >= 0 && idx < mainFieldWidth * mainFieldHeight) {
-            mainTurtleImage[idx].red = mainTurtle.strokeColor.red;
-            mainTurtleImage[idx].green = mainTurtle.strokeColor.green;
-            mainTurtleImage[idx].blue = mainTurtle.strokeColor.blue;
+            int first = sprite.rowFirst[r] > mainFieldClipLeft - left ? sprite.rowFirst[r] : mainFieldClipLeft - left;
+            int last = sprite.rowLast[r] < mainFieldClipRight - left ? sprite.rowLast[r] : mainFieldClipRight - left;
+            if (first > last) continue;
+
+            size_t offset = 3 * ((size_t) r * sprite.width + first);
+            const unsigned char *source = tint != nullptr ? &mainFieldTintRow[3 * (size_t) first] : &sprite.pixels[offset];
+            maskedCopy((unsigned char *) (mainTurtleImage + (size_t) row * width + left + first),
+                       source, &sprite.mask[offset], 3 * (size_t) (last - first + 1));
         }
 
-        // track total pixels drawn and emit video frame if a frame interval has
-        // been crossed (and only if video saving is enabled, of course)
-        if (mainFieldSaveFrames &&
-            mainFieldPixelCount++ % mainFieldFrameInterval == 0) {
-            saveFrame();
+        for (const spritePixel &pixel : sprite.partial) {
+            int column = left + pixel.column;
+            int row = bottom + pixel.row;
+            if (column >= mainFieldClipLeft && column <= mainFieldClipRight &&
+                row >= mainFieldClipBottom && row <= mainFieldClipTop) {
+                blendPixel(mainTurtleImage + (size_t) row * width + column, tint != nullptr ? *tint : pixel.color,
+                           pixel.alpha);
+            }
         }
     }
 
-
     /**
-     * Draws a 1-pixel dot at the given location using the current fill color,
-     * regardless of current turtle location or pen status.
-     * @param x
-     * @param y
+     * Copies the bytes of source selected by mask over destination, 16 bytes at a time where SSE2 is available.
+     * @param destination
+     * @param source
+     * @param mask 0xff for bytes to copy, 0 for bytes to keep
+     * @param count number of bytes
      */
-    void fillPixel(int x, int y) {
-        // calculate pixel offset in image data array
-        int idx = mainFieldWidth * (y + mainFieldHeight / 2)
-                  + (x + mainFieldWidth / 2);
-
-        // check to make sure it's not out of bounds
-        if (idx >= 0 && idx < mainFieldWidth * mainFieldHeight) {
-            mainTurtleImage[idx].red = mainTurtle.fillColor.red;
-            mainTurtleImage[idx].green = mainTurtle.fillColor.green;
-            mainTurtleImage[idx].blue = mainTurtle.fillColor.blue;
+    static void maskedCopy(unsigned char *destination, const unsigned char *source, const unsigned char *mask,
+                           size_t count) {
+        size_t i = 0;
+#if defined(__SSE2__)
+        if (count >= 16) {
+            // copying a byte twice does no harm, so the last block may overlap the one before it
+            for (;; i += 16) {
+                if (i + 16 > count) i = count - 16;
+                __m128i select = _mm_loadu_si128((const __m128i *) (mask + i));
+                __m128i from = _mm_and_si128(select, _mm_loadu_si128((const __m128i *) (source + i)));
+                __m128i kept = _mm_andnot_si128(select, _mm_loadu_si128((const __m128i *) (destination + i)));
+                _mm_storeu_si128((__m128i *) (destination + i), _mm_or_si128(from, kept));
+                if (i + 16 == count) return;
+            }
+        }
+#endif
+        for (; i < count; i++) {
+            destination[i] = (unsigned char) ((source[i] & mask[i]) | (destination[i] & ~mask[i]));
         }
     }
 
-
     /**
-     * Draw a straight line between the given coordinates, regardless of current turtle location or pen status.
-     * @param x0
-     * @param y0
-     * @param x1
-     * @param y1
+     * Reference implementation of drawLine(), used in reference mode.
      */
-    void drawLine(int x0, int y0, int x1, int y1) {
+    void drawLineReference(int x0, int y0, int x1, int y1) {
         // uses a variant of Bresenham's line algorithm:
         //   https://en.wikipedia.org/wiki/Talk:Bresenham%27s_line_algorithm
 
+        if (!reaches(std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1))) {
+            return;
+        }
+
         int absX = abs(x1 - x0);          // absolute value of coordinate distances
         int absY = abs(y1 - y0);
         int offX = x0 < x1 ? 1 : -1;      // line-drawing direction offsets
@@ -577,7 +5400,7 @@ public:
         int y = y0;
         int err;
 
-        drawPixel(x, y);
+        plotPixel(x, y);
         if (absX > absY) {
 
             // line is more horizontal; increment along x-axis
@@ -589,7 +5412,7 @@ public:
                     err += absX;
                 }
                 x += offX;
-                drawPixel(x, y);
+                plotPixel(x, y);
             }
         } else {
 
@@ -602,161 +5425,253 @@ public:
                     err += absY;
                 }
                 y += offY;
-                drawPixel(x, y);
+                plotPixel(x, y);
             }
         }
     }
 
 
     /**
-     * Draws a circle at the given coordinates with the given radius, regardless of current turtle location or pen status.
-     * @param x0
-     * @param y0
-     * @param radius
+     * Reference implementation of endFill(), used in reference mode.
+     * Tests every pixel center of the field on its own: it lies inside if the intercepts of the row to its left
+     * wind around it (or, with FILL_EVEN_ODD, are odd in number) and the crossings exactly at it don't end
+     * that run, taken in the order of the outline. Vertices after the last closed contour form one more contour.
+     * Anti-aliased fills go through fillCoverageReference() instead.
+     * @param xs vertex x-coords in field coordinates
+     * @param ys vertex y-coords in field coordinates
      */
-    void drawCircle(int x0, int y0, int radius) {
-        // implementation based on midpoint circle algorithm:
-        //   https://en.wikipedia.org/wiki/Midpoint_circle_algorithm
-
-        int x = radius;
-        int y = 0;
-        int switch_criteria = 1 - x;
-
-        if (mainTurtle.filled) {
-            fillCircle(x0, y0, radius);
+    void endFillReference(const double *xs, const double *ys) {
+        double nodeX[MAX_POLYGON_VERTICES];     // x-coords of polygon intercepts, in the order of the outline
+        int nodeWinding[MAX_POLYGON_VERTICES];  // +1 for upward edges, -1 for downward ones
+        int contourEnd[MAX_POLYGON_VERTICES + 1];
+        int contours = mainTurtleContourCount;
+        std::copy(mainTurtleContourEnd, mainTurtleContourEnd + contours, contourEnd);
+        if (mainTurtlePolyVertexCount > (contours > 0 ? contourEnd[contours - 1] : 0)) {
+            contourEnd[contours++] = mainTurtlePolyVertexCount;
+        }
+        if (mainFieldAntialiasFill) {
+            fillCoverageReference(xs, ys, contourEnd, contours);
+            mainTurtle.filled = false;
+            redrawPolygon();
+            return;
         }
 
-        while (x >= y) {
-            drawPixel(x + x0, y + y0);
-            drawPixel(y + x0, x + y0);
-            drawPixel(-x + x0, y + y0);
-            drawPixel(-y + x0, x + y0);
-            drawPixel(-x + x0, -y + y0);
-            drawPixel(-y + x0, -x + y0);
-            drawPixel(x + x0, -y + y0);
-            drawPixel(y + x0, -x + y0);
-            y++;
-            if (switch_criteria <= 0) {
-                switch_criteria += 2 * y + 1;       // no x-coordinate change
-            } else {
-                x--;
-                switch_criteria += 2 * (y - x) + 1;
+        //  loop through the rows of the image
+        for (int y = -mainFieldCenterY; y < (int) mainFieldHeight - mainFieldCenterY; y++) {
+
+            //  intercepts of every edge with the row, each edge running from vertex j to vertex i
+            int nodes = 0;
+            for (int c = 0; c < contours; c++) {
+                int start = c > 0 ? contourEnd[c - 1] : 0;
+                int j = contourEnd[c] - 1;
+                for (int i = start; i < contourEnd[c]; i++) {
+                    if ((ys[i] < (double) y && ys[j] >= (double) y) ||
+                        (ys[j] < (double) y && ys[i] >= (double) y)) {
+                        nodeWinding[nodes] = ys[i] > ys[j] ? 1 : -1;
+                        nodeX[nodes++] = xs[i] + ((double) y - ys[i]) / (ys[j] - ys[i]) * (xs[j] - xs[i]);
+                    }
+                    j = i;
+                }
+            }
+            if (nodes == 0) {
+                continue;
+            }
+
+            for (int x = -mainFieldCenterX; x < (int) mainFieldWidth - mainFieldCenterX; x++) {
+                int winding = 0;
+                for (int k = 0; k < nodes; k++) {
+                    if (nodeX[k] < (double) x) {
+                        winding += mainTurtle.fillRule == FILL_EVEN_ODD ? 1 : nodeWinding[k];
+                    }
+                }
+                bool inside = mainTurtle.fillRule == FILL_EVEN_ODD ? winding % 2 != 0 : winding != 0;
+                for (int k = 0; k < nodes && inside; k++) {
+                    if (nodeX[k] == (double) x) {
+                        winding += mainTurtle.fillRule == FILL_EVEN_ODD ? 1 : nodeWinding[k];
+                        inside = mainTurtle.fillRule == FILL_EVEN_ODD ? false : winding != 0;
+                    }
+                }
+                if (inside) {
+                    plotFillPixel(x, y);
+                }
             }
         }
+
+        mainTurtle.filled = false;
+
+        // redraw polygon (filling is imperfect and can occasionally occlude sides)
+        redrawPolygon();
     }
 
 
     /**
-     * Fill a circle at the given coordinates with the given radius, regardless of current turtle location or pen status.
-     * @param x0
-     * @param y0
-     * @param radius
+     * Reference implementation of fillPolygonAntialiased(), used in reference mode.
+     * Clips every contour to the square of each pixel (Sutherland-Hodgman) and sums the signed areas of
+     * the pieces, which is the integral of the winding number over the pixel, then folds it by the fill rule.
+     * @param xs vertex x-coords in field coordinates
+     * @param ys vertex y-coords in field coordinates
+     * @param contourEnd index one past the last vertex of each contour
+     * @param contours number of contours
      */
-    void fillCircle(int x0, int y0, int radius) {
-        int rad_sq = radius * radius;
+    void fillCoverageReference(const double *xs, const double *ys, const int *contourEnd, int contours) {
+        if (contours == 0) {
+            return;
+        }
 
-        // Naive algorithm, pretty ugly due to no antialiasing:
-        for (int x = x0 - radius; x < x0 + radius; x++) {
-            for (int y = y0 - radius; y < y0 + radius; y++) {
-                int dx = x - x0;
-                int dy = y - y0;
-                int dsq = (dx * dx) + (dy * dy);
-                if (dsq < rad_sq) fillPixel(x, y);
+        // field cell coordinates, where pixel (column,row) covers [column,column+1) x [row,row+1)
+        int vertices = contourEnd[contours - 1];
+        std::vector<double> cellX((size_t) vertices);
+        std::vector<double> cellY((size_t) vertices);
+        double minX = HUGE_VAL;
+        double minY = HUGE_VAL;
+        double maxX = -HUGE_VAL;
+        double maxY = -HUGE_VAL;
+        for (int i = 0; i < vertices; i++) {
+            cellX[i] = xs[i] + (mainFieldCenterX + 0.5);
+            cellY[i] = ys[i] + (mainFieldCenterY + 0.5);
+            minX = fmin(minX, cellX[i]);
+            minY = fmin(minY, cellY[i]);
+            maxX = fmax(maxX, cellX[i]);
+            maxY = fmax(maxY, cellY[i]);
+        }
+        int left = (int) fmax(mainFieldClipLeft, fmin(floor(minX), mainFieldClipRight + 1.0));
+        int right = (int) fmin(mainFieldClipRight, fmax(floor(maxX), left - 1.0));
+        int bottom = (int) fmax(mainFieldClipBottom, fmin(floor(minY), mainFieldClipTop + 1.0));
+        int top = (int) fmin(mainFieldClipTop, fmax(floor(maxY), bottom - 1.0));
+
+        std::vector<double> pieceX;
+        std::vector<double> pieceY;
+        std::vector<double> nextX;
+        std::vector<double> nextY;
+        for (int row = bottom; row <= top; row++) {
+            for (int column = left; column <= right; column++) {
+                double area = 0.0;
+                for (int c = 0; c < contours; c++) {
+                    int start = c > 0 ? contourEnd[c - 1] : 0;
+                    pieceX.assign(cellX.begin() + start, cellX.begin() + contourEnd[c]);
+                    pieceY.assign(cellY.begin() + start, cellY.begin() + contourEnd[c]);
+
+                    // keep the part on the inner side of each edge of the square in turn
+                    for (int side = 0; side < 4 && !pieceX.empty(); side++) {
+                        auto distance = [side, column, row](double x, double y) {
+                            switch (side) {
+                                case 0: return x - column;
+                                case 1: return column + 1.0 - x;
+                                case 2: return y - row;
+                                default: return row + 1.0 - y;
+                            }
+                        };
+                        nextX.clear();
+                        nextY.clear();
+                        size_t count = pieceX.size();
+                        for (size_t i = 0; i < count; i++) {
+                            size_t j = (i + 1) % count;
+                            double di = distance(pieceX[i], pieceY[i]);
+                            double dj = distance(pieceX[j], pieceY[j]);
+                            if (di >= 0) {
+                                nextX.push_back(pieceX[i]);
+                                nextY.push_back(pieceY[i]);
+                            }
+                            if ((di >= 0) != (dj >= 0)) {
+                                double t = di / (di - dj);
+                                nextX.push_back(pieceX[i] + t * (pieceX[j] - pieceX[i]));
+                                nextY.push_back(pieceY[i] + t * (pieceY[j] - pieceY[i]));
+                            }
+                        }
+                        pieceX.swap(nextX);
+                        pieceY.swap(nextY);
+                    }
+
+                    // shoelace formula, relative to the corner of the pixel to keep the products small
+                    size_t count = pieceX.size();
+                    for (size_t i = 0; i < count; i++) {
+                        size_t j = (i + 1) % count;
+                        area += 0.5 * ((pieceX[i] - column) * (pieceY[j] - row) - (pieceX[j] - column) * (pieceY[i] - row));
+                    }
+                }
+
+                double coverage = fabs(area);
+                if (mainTurtle.fillRule == FILL_EVEN_ODD) {
+                    coverage = fmod(coverage, 2.0);
+                    if (coverage > 1.0) coverage = 2.0 - coverage;
+                } else if (coverage > 1.0) {
+                    coverage = 1.0;
+                }
+                int alpha = coverageAlpha(coverage);
+                if (alpha > 0) {
+                    reaches(column - mainFieldCenterX, row - mainFieldCenterY, column - mainFieldCenterX,
+                            row - mainFieldCenterY);
+                    blendPixel(mainTurtleImage + (size_t) row * mainFieldWidth + column, mainTurtle.fillColor, alpha);
+                }
             }
         }
     }
 
 
     /**
-     * Fills a circle at the current coordinates with the given radius.
-     * @param radius
+     * Draws the outline of the polygon recorded since beginFill().
      */
-    void fillCircle(int radius) {
-        fillCircle(mainTurtle.xpos, mainTurtle.ypos, radius);
+    void redrawPolygon() {
+        int start = 0;
+        int contours = mainTurtleContourCount;
+        if (mainFieldVector != nullptr) {
+            int ends[MAX_POLYGON_VERTICES + 1];
+            std::copy(mainTurtleContourEnd, mainTurtleContourEnd + contours, ends);
+            if (mainTurtlePolyVertexCount > (contours > 0 ? ends[contours - 1] : 0)) {
+                ends[contours++] = mainTurtlePolyVertexCount;
+            }
+            mainFieldVector->polygon(mainTurtlePolyX, mainTurtlePolyY, ends, contours, mainTurtle, true);
+            return;
+        }
+        for (int c = 0; c <= contours; c++) {
+            // vertices after the last closed contour (only left over in reference mode) form one more outline
+            int end = c < contours ? mainTurtleContourEnd[c] : mainTurtlePolyVertexCount;
+            int count = end - start;
+            if (mainTurtle.penWidth > 1.0) {
+                double fieldX[MAX_POLYGON_VERTICES];
+                double fieldY[MAX_POLYGON_VERTICES];
+                for (int i = 0; i < count; i++) {
+                    fieldX[i] = toFieldX(mainTurtlePolyX[start + i]);
+                    fieldY[i] = toFieldY(mainTurtlePolyY[start + i]);
+                }
+                strokeClosedThick(fieldX, fieldY, count);
+            } else {
+                for (int i = 0; i < count; i++) {
+                    strokeVisible(mainTurtlePolyX[start + i], mainTurtlePolyY[start + i],
+                                  mainTurtlePolyX[start + (i + 1) % count], mainTurtlePolyY[start + (i + 1) % count]);
+                }
+            }
+            start = end;
+        }
     }
 
 
     /**
-     * Draws a turtle at the current location.
+     * Reference implementation of fillCircle(), used in reference mode.
      */
-    void drawTurtle() {
-        // We are going to make our own backup of the turtle, since turtle_backup()
-        // only gives us one level of undo.
-        turtleState original_turtle = mainTurtle;
-
-        penUp();
-
-        // Draw the legs
-        for (int i = -1; i < 2; i += 2) {
-            for (int j = -1; j < 2; j += 2) {
-                backup();
-                forward(i * 7);
-                strafeLeft(j * 7);
-
-                setFillColor(
-                        mainTurtle.strokeColor.red,
-                        mainTurtle.strokeColor.green,
-                        mainTurtle.strokeColor.blue
-                );
-                fillCircle(5);
+    void fillCircleReference(int x0, int y0, int radius) {
+        int rad_sq = radius * radius;
+        if (!reaches(x0 - radius, y0 - radius, x0 + radius, y0 + radius)) {
+            return;
+        }
 
-                setFillColor(
-                        original_turtle.fillColor.red,
-                        original_turtle.fillColor.green,
-                        original_turtle.fillColor.blue
-                );
-                fillCircle(3);
-                restore();
+        // Naive algorithm, pretty ugly due to no antialiasing:
+        for (int x = x0 - radius; x < x0 + radius; x++) {
+            for (int y = y0 - radius; y < y0 + radius; y++) {
+                int dx = x - x0;
+                int dy = y - y0;
+                int dsq = (dx * dx) + (dy * dy);
+                if (dsq < rad_sq) plotFillPixel(x, y);
             }
         }
-
-        // Draw the head
-        backup();
-        forward(10);
-        setFillColor(
-                mainTurtle.strokeColor.red,
-                mainTurtle.strokeColor.green,
-                mainTurtle.strokeColor.blue
-        );
-        fillCircle(5);
-
-        setFillColor(
-                original_turtle.fillColor.red,
-                original_turtle.fillColor.green,
-                original_turtle.fillColor.blue
-        );
-        fillCircle(3);
-        restore();
-
-        // Draw the body
-        for (int i = 9; i >= 0; i -= 4) {
-            backup();
-            setFillColor(
-                    mainTurtle.strokeColor.red,
-                    mainTurtle.strokeColor.green,
-                    mainTurtle.strokeColor.blue
-            );
-            fillCircle(i + 2);
-
-            setFillColor(
-                    original_turtle.fillColor.red,
-                    original_turtle.fillColor.green,
-                    original_turtle.fillColor.blue
-            );
-            fillCircle(i);
-            restore();
-        }
-
-        // Restore the original turtle position:
-        mainTurtle = original_turtle;
     }
 
 
     /**
-     * Saves current field to a .bmp file.
+     * Reference implementation of saveBMP(), used in reference mode.
      * @param filename
      */
-    void saveBMP(const char *filename) {
+    void saveBMPReference(const char *filename) {
         int i, j, ipos;
         unsigned int bytesPerLine;
         unsigned char *line;
@@ -828,109 +5743,233 @@ public:
         fclose(file);
     }
 
-
-    /**
-     * Enables the video output.
-     * When enabled, periodic frame bitmaps will be saved with sequentially-ordered filenames matching the following pattern:
-     * "frameXXXX.bmp" (X is a digit).
-     * Frames are emitted after a regular number of pixels have been drawn.
-     * This number is set by the parameter to this function.
-     * Some experimentation may be required to find a optimal values for different shapes.
-     * @param pixelsPerFrame
-     */
-    void beginVideo(int pixelsPerFrame) {
-        mainFieldSaveFrames = true;
-        mainFieldFrameCount = 0;
-        mainFieldFrameInterval = pixelsPerFrame;
-        mainFieldPixelCount = 0;
-    }
-
-
-    /**
-     * Emits a single video frame containing the current field image.
-     */
-    void saveFrame() {
-        char filename[32];
-        sprintf(filename, "frame%05d.bmp", ++mainFieldFrameCount);
-        saveBMP(filename);
-    }
-
-
-    /**
-     * Disables the video output.
-     */
-    void endVideo() {
-        mainFieldSaveFrames = false;
-    }
-
-
-    /**
-     * Returns the current x-coordinate.
-     * @return current x-coordinate
-     */
-    double getX() {
-        return mainTurtle.xpos;
-    }
-
-
     /**
-     * Returns the current y-coordinate.
-     * @return current y-coordinate
+     * Draws one line of text with its top-left corner at the given image pixel.
+     * When the line lies on the field, every field row of a glyph row is written directly, one run of lit
+     * cells at a time; otherwise each lit pixel goes through drawPixel() for clipping and error reporting.
+     * @param text characters to draw
+     * @param length number of characters
+     * @param left
+     * @param top
+     * @param scale image pixels per glyph cell
      */
-    double getY() {
-        return mainTurtle.ypos;
-    }
+    void drawTextLine(const char *text, size_t length, int left, int top, int scale) {
+        if (length == 0) {
+            return;
+        }
 
-    /**
-     * Draws an integer at the current location.
-     * @param number number to draw
-     */
-    void drawInt(int number) {
-        int digitsCount = countDigits(number);
+        if (mainFieldMeasuring) {
+            int cells = 0;
+            for (size_t i = 0; i < length; i++) {
+                for (int row = 0; row < TURTLE_FONT_HEIGHT; row++) {
+                    for (const unsigned char *runs = fontRuns(fontGlyph((unsigned char) text[i])[row]); runs[1] != 0; runs += 2) {
+                        cells += runs[1];
+                    }
+                }
+            }
+            measureBox(left, top - TURTLE_FONT_HEIGHT * scale + 1,
+                       left + ((int) length * TURTLE_FONT_ADVANCE - 1) * scale - 1, top, (double) cells * scale * scale);
+            if (mainFieldVector == nullptr) {
+                return;
+            }
 
-        for (int i = digitsCount - 1; i >= 0; i--) {
-            drawDigit(number % 10, i);
-            number = number / 10;
+            // one rectangle per run of lit cells
+            for (size_t i = 0; i < length; i++) {
+                for (int row = 0; row < TURTLE_FONT_HEIGHT; row++) {
+                    int high = top - row * scale;
+                    for (const unsigned char *runs = fontRuns(fontGlyph((unsigned char) text[i])[row]); runs[1] != 0; runs += 2) {
+                        int first = left + ((int) i * TURTLE_FONT_ADVANCE + runs[0]) * scale;
+                        mainFieldVector->pixels(first, high - scale + 1, first + runs[1] * scale - 1, high,
+                                                mainTurtle.strokeColor);
+                    }
+                }
+            }
+            return;
         }
-    }
 
-private:
-    /**
-     * Cleans up any memory used by the turtle graphics system.
-     */
-    void cleanup() {
-        if (mainTurtleImage != nullptr) {
-            free(mainTurtleImage);
-            mainTurtleImage = nullptr;
+        int field = (int) mainFieldScale;
+        int right = left + ((int) length * TURTLE_FONT_ADVANCE - 1) * scale - 1;
+        int bottom = top - TURTLE_FONT_HEIGHT * scale + 1;
+        if (!reaches(blockX(left), blockY(bottom), blockX(right) + field - 1, blockY(top) + field - 1)) {
+            return;
+        }
+        bool direct = !mainFieldReferenceMode && !mainFieldSaveFrames &&
+                      insideClip(blockX(left), blockY(bottom)) &&
+                      insideClip(blockX(right) + field - 1, blockY(top) + field - 1);
+
+        int cellWidth = scale * field;
+        int firstColumn = blockX(left) + mainFieldCenterX;
+        rgb color = mainTurtle.strokeColor;
+
+        for (int row = 0; row < TURTLE_FONT_HEIGHT; row++) {
+            int high = top - row * scale;
+            int low = high - scale + 1;
+
+            for (int y = low; y <= high; y++) {
+                for (int k = 0; k < (direct ? field : 1); k++) {
+                    rgb *line = direct ? mainTurtleImage + (size_t) (blockY(y) + k + mainFieldCenterY) *
+                                                           mainFieldWidth + firstColumn : nullptr;
+
+                    for (size_t i = 0; i < length; i++) {
+                        const unsigned char *runs = fontRuns(fontGlyph((unsigned char) text[i])[row]);
+                        int cell = (int) i * TURTLE_FONT_ADVANCE;
+
+                        for (; runs[1] != 0; runs += 2) {
+                            int first = cell + runs[0];
+                            if (direct) {
+                                fillRun(line + first * cellWidth, runs[1] * cellWidth, color);
+                                continue;
+                            }
+                            for (int x = left + first * scale; x < left + (first + runs[1]) * scale; x++) {
+                                drawPixel(x, y);
+                            }
+                        }
+                    }
+                }
+            }
         }
     }
 
     /**
-     * Draws single digit depending on it location in the number
-     * @param digit digit to draw
-     * @param digitIndex digit location in the number
+     * Returns the runs of lit cells in a glyph row as (first cell, length) pairs, ending with a zero length.
+     * @param mask glyph row, bit 4 being the leftmost cell
+     * @return runs from left to right
      */
-    void drawDigit(unsigned char digit, int digitIndex) {
-        for (int y = 0; y < 5; y++) {
-            for (int x = 0; x < 4; x++) {
-                if (TURTLE_DIGITS[digit][y * 4 + x] == 1) {
-                    drawPixel(mainTurtle.xpos + digitIndex * 5 + x, mainTurtle.ypos - y);
+    static const unsigned char *fontRuns(unsigned int mask) {
+        struct runTable {
+            unsigned char runs[1 << TURTLE_FONT_WIDTH][8];  // at most three runs and the terminating pair
+        };
+        static const runTable table = [] {
+            runTable result{};
+            for (unsigned int m = 0; m < (1u << TURTLE_FONT_WIDTH); m++) {
+                int count = 0;
+                for (int cell = 0; cell < TURTLE_FONT_WIDTH; cell++) {
+                    bool lit = (m >> (TURTLE_FONT_WIDTH - 1 - cell)) & 1;
+                    bool litBefore = cell > 0 && ((m >> (TURTLE_FONT_WIDTH - cell)) & 1);
+                    if (lit && !litBefore) {
+                        result.runs[m][count * 2] = (unsigned char) cell;
+                        count++;
+                    }
+                    if (lit) {
+                        result.runs[m][count * 2 - 1]++;
+                    }
                 }
             }
-        }
+            return result;
+        }();
+        return table.runs[mask];
     }
 
     /**
-     * Counts the number of digits in the given integer number.
-     * @param number
-     * @return Number of digits in number
+     * Returns the rows of the font glyph for the given character, top row first.
+     * Bit 4 of a row is its leftmost cell; characters outside printable ASCII are drawn as '?'.
+     * @param character
+     * @return TURTLE_FONT_HEIGHT row masks
      */
-    static unsigned short countDigits(int number) {
-        if (number > 9) {
-            (int) (ceil(log10(number)));
-        } else {
-            return 1;
+    static const unsigned char *fontGlyph(unsigned char character) {
+        // 5x7 cells per glyph for the printable ASCII characters ' ' to '~'
+        static const unsigned char TURTLE_FONT[95][TURTLE_FONT_HEIGHT] = {
+                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},  // ' '
+                {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04},  // '!'
+                {0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00},  // '"'
+                {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A},  // '#'
+                {0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04},  // '$'
+                {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03},  // '%'
+                {0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D},  // '&'
+                {0x0C, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00},  // '\''
+                {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02},  // '('
+                {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08},  // ')'
+                {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00},  // '*'
+                {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00},  // '+'
+                {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08},  // ','
+                {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00},  // '-'
+                {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C},  // '.'
+                {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},  // '/'
+                {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},  // '0'
+                {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},  // '1'
+                {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},  // '2'
+                {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},  // '3'
+                {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},  // '4'
+                {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},  // '5'
+                {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},  // '6'
+                {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},  // '7'
+                {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},  // '8'
+                {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},  // '9'
+                {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},  // ':'
+                {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08},  // ';'
+                {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02},  // '<'
+                {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00},  // '='
+                {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08},  // '>'
+                {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04},  // '?'
+                {0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E},  // '@'
+                {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11},  // 'A'
+                {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},  // 'B'
+                {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E},  // 'C'
+                {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},  // 'D'
+                {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F},  // 'E'
+                {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},  // 'F'
+                {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F},  // 'G'
+                {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},  // 'H'
+                {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},  // 'I'
+                {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},  // 'J'
+                {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},  // 'K'
+                {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},  // 'L'
+                {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11},  // 'M'
+                {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},  // 'N'
+                {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},  // 'O'
+                {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},  // 'P'
+                {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D},  // 'Q'
+                {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},  // 'R'
+                {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E},  // 'S'
+                {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},  // 'T'
+                {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E},  // 'U'
+                {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},  // 'V'
+                {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A},  // 'W'
+                {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},  // 'X'
+                {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04},  // 'Y'
+                {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},  // 'Z'
+                {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E},  // '['
+                {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00},  // '\\'
+                {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E},  // ']'
+                {0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00},  // '^'
+                {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F},  // '_'
+                {0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00},  // '`'
+                {0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F},  // 'a'
+                {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E},  // 'b'
+                {0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E},  // 'c'
+                {0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F},  // 'd'
+                {0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E},  // 'e'
+                {0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08},  // 'f'
+                {0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E},  // 'g'
+                {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11},  // 'h'
+                {0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E},  // 'i'
+                {0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C},  // 'j'
+                {0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12},  // 'k'
+                {0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E},  // 'l'
+                {0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11},  // 'm'
+                {0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11},  // 'n'
+                {0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E},  // 'o'
+                {0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10},  // 'p'
+                {0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01},  // 'q'
+                {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10},  // 'r'
+                {0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E},  // 's'
+                {0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06},  // 't'
+                {0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D},  // 'u'
+                {0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04},  // 'v'
+                {0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A},  // 'w'
+                {0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11},  // 'x'
+                {0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E},  // 'y'
+                {0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F},  // 'z'
+                {0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02},  // '{'
+                {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},  // '|'
+                {0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08},  // '}'
+                {0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00}   // '~'
+        };
+
+        if (character < ' ' || character > '~') {
+            character = '?';
         }
+        return TURTLE_FONT[character - ' '];
     }
 };
 
@@ -0,0 +1,368 @@
+/*
+    turtle_batch.cpp
+
+    Renders many scripts (see turtle_script.hpp) to BMP files in one process.
+    Jobs are listed in a manifest, one per line:
+
+        script image.bmp width height [supersample]
+
+    Empty lines and lines starting with '#' are ignored. Jobs run on a pool of worker threads that
+    take jobs from their own queue and steal from the others when it runs dry. Every worker keeps a few
+    canvases and its compiled scripts between jobs, and encodes each image to memory; a writer thread saves
+    the encoded files while the workers render the next images.
+
+    With --cache, encoded images are kept in a directory keyed by the commands that drew them (see
+    turtleRenderCache), and jobs drawing something already in the cache skip rendering.
+
+    Usage: TurtleBatch [--cache directory [--cache-size megabytes]] manifest [threads]
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "turtle.hpp"
+#include "turtle_script.hpp"
+#include "turtle_service.hpp"
+
+// encoded images waiting for the writer, per worker, before workers wait for it
+#define PENDING_IMAGES_PER_WORKER 2
+
+// canvases of different sizes each worker keeps
+#define CANVASES_PER_WORKER 2
+
+// default size limit of the cache
+#define BATCH_CACHE_MB 1024
+
+struct batchJob {
+    std::string script;
+    std::string output;
+    unsigned int width;
+    unsigned int height;
+    unsigned int supersample;
+    int line;                   // line of the manifest
+};
+
+struct encodedImage {
+    const batchJob *job;
+    std::vector<unsigned char> bytes;
+};
+
+/**
+ * Jobs of one worker. The worker takes them from the front; others steal from the back.
+ */
+struct workerQueue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+};
+
+/**
+ * Saves encoded images on its own thread, and hands out empty buffers for encoding, so that
+ * workers don't allocate a buffer for every image.
+ */
+class imageWriter {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::unique_ptr<encodedImage>> pending;
+    std::vector<std::unique_ptr<encodedImage>> spare;
+    size_t limit;
+    bool finished = false;
+    std::thread thread;
+
+public:
+    std::atomic<int> failures{0};
+    std::atomic<long long> writeNanoseconds{0};
+    std::atomic<long long> bytesWritten{0};
+
+    explicit imageWriter(size_t pendingLimit) : limit(pendingLimit) {
+        thread = std::thread([this]() { run(); });
+    }
+
+    /**
+     * Returns an empty image buffer, reusing one that was written already if possible.
+     */
+    std::unique_ptr<encodedImage> take() {
+        std::lock_guard<std::mutex> guard(lock);
+        if (spare.empty()) {
+            return std::unique_ptr<encodedImage>(new encodedImage());
+        }
+        std::unique_ptr<encodedImage> image = std::move(spare.back());
+        spare.pop_back();
+        return image;
+    }
+
+    /**
+     * Queues an image for writing, waiting while too many images are queued already.
+     */
+    void put(std::unique_ptr<encodedImage> image) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this]() { return pending.size() < limit; });
+        pending.push_back(std::move(image));
+        changed.notify_all();
+    }
+
+    /**
+     * Writes the remaining images and stops the writer thread.
+     */
+    void finish() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            finished = true;
+            changed.notify_all();
+        }
+        thread.join();
+    }
+
+private:
+    void run() {
+        for (;;) {
+            std::unique_ptr<encodedImage> image;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [this]() { return !pending.empty() || finished; });
+                if (pending.empty()) {
+                    return;
+                }
+                image = std::move(pending.front());
+                pending.pop_front();
+                changed.notify_all();
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            FILE *file = fopen(image->job->output.c_str(), "wb");
+            if (file == nullptr || fwrite(image->bytes.data(), 1, image->bytes.size(), file) != image->bytes.size()) {
+                fprintf(stderr, "Could not write to file: %s\n", image->job->output.c_str());
+                failures++;
+            } else {
+                bytesWritten += (long long) image->bytes.size();
+            }
+            if (file != nullptr) {
+                fclose(file);
+            }
+            writeNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> guard(lock);
+            spare.push_back(std::move(image));
+        }
+    }
+};
+
+/**
+ * Reads the manifest. Malformed lines are reported and skipped.
+ * @return false if the manifest can't be read or has malformed lines
+ */
+static bool readManifest(const char *filename, std::vector<batchJob> &jobs) {
+    FILE *file = fopen(filename, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "Can't open %s\n", filename);
+        return false;
+    }
+
+    bool valid = true;
+    char text[4096];
+    int line = 0;
+    while (fgets(text, sizeof(text), file) != nullptr) {
+        line++;
+        char script[2048];
+        char output[2048];
+        batchJob job;
+        int count = sscanf(text, " %2047s %2047s %u %u %u", script, output, &job.width, &job.height, &job.supersample);
+        if (count <= 0 || script[0] == '#') {
+            continue;
+        }
+        if (count < 4 || job.width == 0 || job.height == 0 ||
+            (count == 5 && (job.supersample < 1 || job.supersample > MAX_SUPERSAMPLE))) {
+            fprintf(stderr, "%s:%d: expected: script image.bmp width height [supersample]\n", filename, line);
+            valid = false;
+            continue;
+        }
+        if (count == 4) {
+            job.supersample = 1;
+        }
+        job.script = script;
+        job.output = output;
+        job.line = line;
+        jobs.push_back(job);
+    }
+    fclose(file);
+    return valid;
+}
+
+/**
+ * Renders jobs until every queue is empty: first its own, then ones stolen from the other workers.
+ */
+static void work(size_t self, std::vector<workerQueue> &queues, const std::vector<batchJob> &jobs,
+                 imageWriter &writer, turtleRenderCache *cache, std::atomic<int> &failures,
+                 std::atomic<long long> &renderNanoseconds, std::atomic<long long> &encodeNanoseconds) {
+    turtleCanvasPool canvases(CANVASES_PER_WORKER);
+    std::map<std::string, turtleScript> scripts;
+    std::map<std::string, bool> compiled;
+
+    for (;;) {
+        size_t index = jobs.size();
+        for (size_t k = 0; k < queues.size() && index == jobs.size(); k++) {
+            workerQueue &queue = queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.jobs.empty()) {
+                continue;
+            }
+            if (k == 0) {
+                index = queue.jobs.front();
+                queue.jobs.pop_front();
+            } else {
+                index = queue.jobs.back();
+                queue.jobs.pop_back();
+            }
+        }
+        if (index == jobs.size()) {
+            return;
+        }
+        const batchJob &job = jobs[index];
+
+        turtleScript &script = scripts[job.script];
+        if (compiled.find(job.script) == compiled.end()) {
+            compiled[job.script] = script.load(job.script.c_str());
+        }
+        if (!compiled[job.script]) {
+            fprintf(stderr, "%s\n", script.getError());
+            failures++;
+            continue;
+        }
+
+        std::unique_ptr<encodedImage> image = writer.take();
+        image->job = &job;
+
+        // the key is the trace of the commands, recorded without drawing them
+        std::string key;
+        if (cache != nullptr) {
+            auto start = std::chrono::steady_clock::now();
+            Turtle measure(1, 1);
+            measure.setMeasureMode(true);
+            turtleTraceWriter commands;
+            measure.setRecorder(&commands);
+            if (!script.run(measure)) {
+                fprintf(stderr, "%s\n", script.getError());
+                failures++;
+                continue;
+            }
+            measure.setRecorder(nullptr);
+            // a trace missing some drawing does not identify the image; render it uncached
+            if (commands.isComplete()) {
+                key = turtleRenderCache::makeKey(commands.getBytes(), job.width, job.height, job.supersample, 0,
+                                                 "bmp");
+            }
+            cache->addKeyTime((unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+            if (!key.empty() && cache->load(key, image->bytes)) {
+                writer.put(std::move(image));
+                continue;
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        Turtle &canvas = canvases.acquire(job.width, job.height, job.supersample);
+        if (!script.run(canvas)) {
+            fprintf(stderr, "%s\n", script.getError());
+            failures++;
+            continue;
+        }
+        auto rendered = std::chrono::steady_clock::now();
+
+        canvas.encodeBMP(image->bytes);
+        auto encoded = std::chrono::steady_clock::now();
+        if (!key.empty()) {
+            cache->store(key, image->bytes, (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    encoded - start).count());
+        }
+        writer.put(std::move(image));
+
+        renderNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(rendered - start).count();
+        encodeNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(encoded - rendered).count();
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *cacheDirectory = nullptr;
+    unsigned long long cacheMegabytes = BATCH_CACHE_MB;
+    while (argc > 2 && strncmp(argv[1], "--cache", 7) == 0) {
+        if (strcmp(argv[1], "--cache") == 0) {
+            cacheDirectory = argv[2];
+        } else if (strcmp(argv[1], "--cache-size") == 0) {
+            cacheMegabytes = strtoull(argv[2], nullptr, 10);
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: TurtleBatch [--cache directory [--cache-size megabytes]] manifest [threads]\n");
+        return EXIT_FAILURE;
+    }
+    std::unique_ptr<turtleRenderCache> cache;
+    if (cacheDirectory != nullptr) {
+        cache.reset(new turtleRenderCache());
+        if (!cache->open(cacheDirectory, cacheMegabytes << 20)) {
+            perror(cacheDirectory);
+            return EXIT_FAILURE;
+        }
+    }
+    size_t threads = argc > 2 ? (size_t) atoi(argv[2]) : std::thread::hardware_concurrency();
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    std::vector<batchJob> jobs;
+    bool valid = readManifest(argv[1], jobs);
+    if (threads > jobs.size() && !jobs.empty()) {
+        threads = jobs.size();
+    }
+
+    // consecutive jobs go to the same worker, which often lets it reuse its canvas and scripts
+    std::vector<workerQueue> queues(threads);
+    for (size_t i = 0; i < jobs.size(); i++) {
+        queues[i * threads / jobs.size()].jobs.push_back(i);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    imageWriter writer(threads * PENDING_IMAGES_PER_WORKER);
+    std::atomic<int> failures{0};
+    std::atomic<long long> renderNanoseconds{0};
+    std::atomic<long long> encodeNanoseconds{0};
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(work, i, std::ref(queues), std::cref(jobs), std::ref(writer), cache.get(), std::ref(failures),
+                             std::ref(renderNanoseconds), std::ref(encodeNanoseconds));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    writer.finish();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    int failed = failures + writer.failures;
+    printf("%zu jobs on %zu threads in %.3f s (%.1f images/s), %d failed\n", jobs.size(), threads, elapsed.count(),
+           jobs.size() / elapsed.count(), failed);
+    printf("render %.3f s, encode %.3f s, write %.3f s (%.1f MB)\n", renderNanoseconds * 1e-9,
+           encodeNanoseconds * 1e-9, writer.writeNanoseconds * 1e-9, writer.bytesWritten * 1e-6);
+    if (cache) {
+        printf("%s\n", cache->describe().c_str());
+    }
+    return valid && failed == 0 ? 0 : EXIT_FAILURE;
+}
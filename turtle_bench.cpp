@@ -0,0 +1,413 @@
+/*
+    turtle_bench.cpp
+
+    Benchmarks for turtle.hpp.
+    Measures the throughput of saving supersampled fields, i.e. of the box filter
+    that downsamples the field while the BMP file is written, and compares drawing
+    markers with the rasterizers against stamping a prerendered sprite, the overhead of the
+    script interpreter against executing the same commands from an array, redrawing a large
+    canvas after a small edit against drawing it from scratch, rendering tiles of a huge drawing
+    through a spatial index against running every command for each tile, exporting a long
+    turtle path to SVG and EPS, and drawing one list at three sizes at once against one size after another.
+
+    Usage: TurtleBench [width] [height] [repetitions]
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "turtle.hpp"
+#include "turtle_display.hpp"
+#include "turtle_script.hpp"
+
+/**
+ * Draws a scene that touches most of the field, so the saved image is not trivially uniform.
+ */
+static void drawScene(Turtle &turtle, int width, int height) {
+    turtle.setFillColor(30, 144, 255);
+    turtle.fillCircle(0, 0, (width < height ? width : height) / 3);
+    for (int i = 0; i < 64; i++) {
+        turtle.setPenColor(i * 4, 255 - i * 4, 128);
+        turtle.drawLine(-width / 2, -height / 2 + i * height / 64, width / 2 - 1, height / 2 - 1 - i * height / 64);
+    }
+}
+
+/**
+ * Returns a command with the given operands.
+ */
+static turtleCommand command(turtleOpcode op, double a0 = 0, double a1 = 0, double a2 = 0, double a3 = 0) {
+    turtleCommand result{};
+    result.op = op;
+    result.args[0] = a0;
+    result.args[1] = a1;
+    result.args[2] = a2;
+    result.args[3] = a3;
+    return result;
+}
+
+/**
+ * Times drawing count markers (a filled circle with a cross) at pseudo-random places,
+ * once by running the marker commands and once by stamping them as a sprite.
+ */
+static void benchmarkMarkers(unsigned int width, unsigned int height, int count) {
+    const turtleCommand marker[] = {
+            command(OP_SET_FILL_COLOR, 250, 120, 0),
+            command(OP_FILL_CIRCLE, 0, 0, 5),
+            command(OP_SET_PEN_COLOR, 0, 0, 90),
+            command(OP_DRAW_LINE, -6, -6, 6, 6),
+            command(OP_DRAW_LINE, -6, 6, 6, -6),
+            command(OP_DRAW_CIRCLE, 0, 0, 6)
+    };
+    const size_t markerSize = sizeof(marker) / sizeof(marker[0]);
+
+    Turtle direct(width, height);
+    Turtle stamped(width, height);
+    turtleSprite sprite = stamped.createSprite(marker, markerSize, 8);
+
+    unsigned int state = 1;
+    std::vector<int> xs((size_t) count);
+    std::vector<int> ys((size_t) count);
+    for (int i = 0; i < count; i++) {
+        state = state * 1103515245u + 12345u;
+        xs[i] = (int) (state >> 8) % (int) (width - 20) - (int) (width - 20) / 2;
+        state = state * 1103515245u + 12345u;
+        ys[i] = (int) (state >> 8) % (int) (height - 20) - (int) (height - 20) / 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        turtleCommand moved[markerSize];
+        for (size_t k = 0; k < markerSize; k++) {
+            moved[k] = marker[k];
+            if (marker[k].op == OP_SET_FILL_COLOR || marker[k].op == OP_SET_PEN_COLOR) continue;
+            moved[k].args[0] += xs[i];
+            moved[k].args[1] += ys[i];
+            if (marker[k].op == OP_DRAW_LINE) {
+                moved[k].args[2] += xs[i];
+                moved[k].args[3] += ys[i];
+            }
+        }
+        direct.execute(moved, markerSize);
+    }
+    std::chrono::duration<double> rasterized = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        stamped.stamp(sprite, xs[i], ys[i]);
+    }
+    std::chrono::duration<double> blitted = std::chrono::steady_clock::now() - start;
+
+    bool same = memcmp(direct.getImage(), stamped.getImage(), sizeof(rgb) * width * height) == 0;
+    printf("\n%d markers: rasterized %.0f ns each, stamped %.0f ns each (%s)\n", count,
+           rasterized.count() * 1e9 / count, blitted.count() * 1e9 / count, same ? "identical" : "DIFFERENT");
+}
+
+/**
+ * Times a script of count cheap commands (headings and pen widths, so the turtle does little work),
+ * once with constant operands and once through a procedure with a parameter, against executing
+ * the same commands from an array.
+ */
+static void benchmarkScript(int count) {
+    const int half = count / 2;
+    std::vector<turtleCommand> flat;
+    for (int i = 0; i < half; i++) {
+        flat.push_back(command(OP_SET_HEADING, 1));
+        flat.push_back(command(OP_SET_PEN_WIDTH, 1));
+    }
+
+    char constant[128];
+    char procedure[160];
+    snprintf(constant, sizeof(constant), "repeat %d [ setheading 1 penwidth 1 ]", half);
+    snprintf(procedure, sizeof(procedure), "to step :d setheading :d penwidth :d end repeat %d [ step 1 ]", half);
+    const char *sources[] = {constant, procedure};
+    const char *labels[] = {"constant operands", "procedure calls"};
+
+    Turtle executed(64, 64);
+    auto start = std::chrono::steady_clock::now();
+    executed.execute(flat.data(), flat.size());
+    std::chrono::duration<double> array = std::chrono::steady_clock::now() - start;
+    printf("\n%d commands: execute() from an array %.1f ns each\n", count, array.count() * 1e9 / count);
+
+    for (int k = 0; k < 2; k++) {
+        turtleScript script;
+        if (!script.compile(sources[k])) {
+            fprintf(stderr, "%s\n", script.getError());
+            exit(EXIT_FAILURE);
+        }
+        Turtle interpreted(64, 64);
+        start = std::chrono::steady_clock::now();
+        script.run(interpreted);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        printf("  script with %s: %.1f ns each, %.1f ns interpreter overhead (%zu bytes of bytecode)\n",
+               labels[k], elapsed.count() * 1e9 / count, (elapsed.count() - array.count()) * 1e9 / count,
+               script.getCodeSize());
+    }
+}
+
+/**
+ * Times a turtleIncrementalCanvas: drawing count random circles and lines on a side x side canvas,
+ * then moving one circle and redrawing, against drawing the edited commands on a new canvas.
+ */
+static void benchmarkIncremental(unsigned int side, int count) {
+    turtleDisplayList list;
+    unsigned int state = 7;
+    auto next = [&state](int range) {
+        state = state * 1103515245u + 12345u;
+        return (int) (state >> 8) % range - range / 2;
+    };
+    int range = (int) side - 200;
+    for (int i = 0; i < count; i++) {
+        list.add(command(OP_SET_PEN_COLOR, next(256) + 128, next(256) + 128, next(256) + 128));
+        if (i % 2 == 0) {
+            list.add(command(OP_FILL_CIRCLE, next(range), next(range), next(30) + 16));
+        } else {
+            int x = next(range);
+            int y = next(range);
+            list.add(command(OP_DRAW_LINE, x, y, x + next(80), y + next(80)));
+        }
+    }
+
+    turtleIncrementalCanvas incremental(side, side);
+    auto start = std::chrono::steady_clock::now();
+    incremental.render(list);
+    std::chrono::duration<double> first = std::chrono::steady_clock::now() - start;
+
+    // move a circle in the middle of the list
+    turtleCommand &edited = list.getCommands()[list.size() / 2 + 1];
+    edited.args[0] += 25;
+    edited.args[1] -= 10;
+    start = std::chrono::steady_clock::now();
+    size_t redrawn = incremental.render(list);
+    std::chrono::duration<double> update = std::chrono::steady_clock::now() - start;
+
+    Turtle scratch(side, side);
+    start = std::chrono::steady_clock::now();
+    scratch.execute(list.data(), list.size());
+    std::chrono::duration<double> full = std::chrono::steady_clock::now() - start;
+
+    bool same = memcmp(incremental.getTurtle().getImage(), scratch.getImage(), sizeof(rgb) * side * side) == 0;
+    printf("\n%ux%u canvas, %zu commands: first render %.2f ms, from scratch %.2f ms, "
+           "after moving a circle %.2f ms (%zu of %zu tiles redrawn, %s)\n", side, side, list.size(),
+           first.count() * 1e3, full.count() * 1e3, update.count() * 1e3, redrawn, incremental.getTileCount(),
+           same ? "identical" : "DIFFERENT");
+}
+
+/**
+ * Times turtleSpatialIndex: count random circles and lines spread over a side x side drawing, indexed once,
+ * then tiles of it rendered through the index against running the whole list on a tile-sized window.
+ */
+static void benchmarkTiles(int side, int count, int tile) {
+    turtleDisplayList list;
+    unsigned int state = 11;
+    auto next = [&state](int range) {
+        state = state * 1103515245u + 12345u;
+        return (int) ((state >> 8) % (unsigned int) range) - range / 2;
+    };
+    for (int i = 0; i < count; i++) {
+        list.add(command(OP_SET_PEN_COLOR, next(256) + 128, next(256) + 128, next(256) + 128));
+        int x = next(side);
+        int y = next(side);
+        if (i % 2 == 0) {
+            list.add(command(OP_FILL_CIRCLE, x, y, next(30) + 16));
+        } else {
+            list.add(command(OP_DRAW_LINE, x, y, x + next(80), y + next(80)));
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    turtleSpatialIndex index(list);
+    std::chrono::duration<double> build = std::chrono::steady_clock::now() - start;
+
+    // tiles along the diagonal, each also drawn by running every command on a window of the drawing
+    Turtle tileCanvas((unsigned int) tile, (unsigned int) tile);
+    Turtle window((unsigned int) tile, (unsigned int) tile);
+    std::chrono::duration<double> indexed{0};
+    std::chrono::duration<double> full{0};
+    size_t commands = 0;
+    bool same = true;
+    const int tiles = 8;
+    for (int i = 0; i < tiles; i++) {
+        int x0 = -side / 2 + i * (side - tile) / (tiles - 1);
+        int y0 = x0;
+        start = std::chrono::steady_clock::now();
+        commands += index.renderRegion(x0, y0, x0 + tile - 1, y0 + tile - 1, tileCanvas);
+        indexed += std::chrono::steady_clock::now() - start;
+
+        start = std::chrono::steady_clock::now();
+        window.setOrigin(x0 + tile / 2, y0 + tile / 2);
+        window.reset();
+        window.clear();
+        window.execute(list.data(), list.size());
+        full += std::chrono::steady_clock::now() - start;
+        same = same && memcmp(tileCanvas.getImage(), window.getImage(), sizeof(rgb) * tile * tile) == 0;
+    }
+    printf("\n%dx%d drawing, %zu commands: index built in %.2f ms; %dx%d tiles %.3f ms each "
+           "(%.0f commands run), %.2f ms running every command (%s)\n", side, side, list.size(),
+           build.count() * 1e3, tile, tile, indexed.count() * 1e3 / tiles, (double) commands / tiles,
+           full.count() * 1e3 / tiles, same ? "identical" : "DIFFERENT");
+}
+
+/**
+ * Times exporting a random walk of count segments, in a new color every thousand steps, as SVG and EPS.
+ */
+static void benchmarkVector(int count) {
+    turtleDisplayList list;
+    unsigned int state = 5;
+    auto next = [&state](int range) {
+        state = state * 1103515245u + 12345u;
+        return (int) ((state >> 8) % (unsigned int) range);
+    };
+    for (int i = 0; i < count; i++) {
+        if (i % 1000 == 0) {
+            list.add(command(OP_SET_PEN_COLOR, next(256), next(256), next(256)));
+        }
+        list.add(command(OP_TURN_LEFT, next(91) - 45));
+        list.add(command(OP_FORWARD, next(8) + 1));
+    }
+
+    printf("\n%d segments exported:", count);
+    const char *filename = "turtle_bench.vector";
+    for (turtleVectorFormat format : {VECTOR_SVG, VECTOR_EPS}) {
+        auto start = std::chrono::steady_clock::now();
+        {
+            turtleVectorWriter drawing(filename, format, 4096, 4096);
+            Turtle turtle(1, 1);
+            turtle.setVectorOutput(&drawing);
+            turtle.execute(list.data(), list.size());
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        FILE *file = fopen(filename, "rb");
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fclose(file);
+        printf(" %s %.2f s, %.1f MB (%.1f bytes per segment)%s", format == VECTOR_SVG ? "SVG" : "EPS",
+               elapsed.count(), size * 1e-6, (double) size / count, format == VECTOR_SVG ? "," : "\n");
+    }
+    remove(filename);
+}
+
+/**
+ * Times a turtleMultiCanvas drawing a random walk of count segments and filled squares at three sizes,
+ * against executing the list on each canvas in turn.
+ */
+static void benchmarkSizes(int count) {
+    turtleDisplayList list;
+    unsigned int state = 3;
+    auto next = [&state](int range) {
+        state = state * 1103515245u + 12345u;
+        return (int) ((state >> 8) % (unsigned int) range);
+    };
+    for (int i = 0; i < count; i++) {
+        if (i % 1000 == 0) {
+            list.add(command(OP_SET_PEN_COLOR, next(256), next(256), next(256)));
+            list.add(command(OP_BEGIN_FILL));
+            for (int side = 0; side < 4; side++) {
+                list.add(command(OP_FORWARD, 20));
+                list.add(command(OP_TURN_LEFT, 90));
+            }
+            list.add(command(OP_END_FILL));
+        }
+        list.add(command(OP_TURN_LEFT, next(91) - 45));
+        list.add(command(OP_FORWARD, next(8) + 1));
+    }
+
+    const unsigned int sides[] = {2048, 512, 128};
+    turtleMultiCanvas sizes;
+    for (unsigned int side : sides) {
+        sizes.add(side, side);
+    }
+    auto start = std::chrono::steady_clock::now();
+    sizes.render(list, true);
+    std::chrono::duration<double> together = std::chrono::steady_clock::now() - start;
+
+    std::chrono::duration<double> apart{0};
+    bool same = true;
+    for (size_t i = 0; i < sizeof(sides) / sizeof(sides[0]); i++) {
+        Turtle measure(1, 1);
+        Turtle canvas(sides[i], sides[i]);
+        start = std::chrono::steady_clock::now();
+        measure.setMeasureMode(true);
+        measure.execute(list.data(), list.size());
+        canvas.fitToImage(measure.getMeasurement(), sides[i] / 32.0);
+        canvas.execute(list.data(), list.size());
+        apart += std::chrono::steady_clock::now() - start;
+        same = same && memcmp(canvas.getImage(), sizes.getCanvas(i).getImage(),
+                              sizeof(rgb) * sides[i] * sides[i]) == 0;
+    }
+    printf("\n%zu commands fitted to %u, %u and %u pixels: %.2f ms at once, %.2f ms one after another (%s)\n",
+           list.size(), sides[0], sides[1], sides[2], together.count() * 1e3, apart.count() * 1e3,
+           same ? "identical" : "DIFFERENT");
+}
+
+/**
+ * Times a long chain of short lines drawn with double and with fixed-point positions (see Turtle::setFixedPoint()).
+ */
+static void benchmarkFixed(unsigned int side, int count) {
+    for (int fixed = 0; fixed < 2; fixed++) {
+        Turtle turtle(side, side);
+        turtle.setFixedPoint(fixed != 0);
+        unsigned int state = 7;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            state = state * 1103515245u + 12345u;
+            turtle.turnLeft((int) ((state >> 8) % 181) - 90);
+            turtle.forward((int) ((state >> 20) % 24) + 1);
+            if (fabs(turtle.getX()) > side / 2.0 || fabs(turtle.getY()) > side / 2.0) {
+                turtle.penUp();
+                turtle.goTo(0, 0);
+                turtle.penDown();
+            }
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        printf("%s%d lines with %s positions: %.2f ms (%.1f ns per line)\n", fixed ? "" : "\n", count,
+               fixed ? "fixed-point" : "double", elapsed.count() * 1e3, elapsed.count() * 1e9 / count);
+    }
+}
+
+int main(int argc, char **argv) {
+    unsigned int width = argc > 1 ? (unsigned int) atoi(argv[1]) : 1024;
+    unsigned int height = argc > 2 ? (unsigned int) atoi(argv[2]) : 1024;
+    int repetitions = argc > 3 ? atoi(argv[3]) : 10;
+    const char *filename = "turtle_bench.bmp";
+
+    printf("saveBMP of a %ux%u image, best of %d\n", width, height, repetitions);
+    printf("%6s %12s %12s %14s\n", "scale", "ms", "Mpixel/s", "field MB/s");
+
+    const unsigned int scales[] = {1, 2, 3, 4, 8};
+    for (unsigned int scale : scales) {
+        Turtle turtle(width, height, scale);
+        drawScene(turtle, (int) width, (int) height);
+
+        double best = 1e30;
+        for (int i = 0; i < repetitions; i++) {
+            auto start = std::chrono::steady_clock::now();
+            turtle.saveBMP(filename);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() < best) best = elapsed.count();
+        }
+
+        double fieldPixels = (double) width * height * scale * scale;
+        printf("%6u %12.2f %12.1f %14.1f\n", scale, best * 1e3,
+               width * (double) height / best / 1e6, fieldPixels * sizeof(rgb) / best / 1e6);
+    }
+
+    remove(filename);
+
+    benchmarkMarkers(width, height, 100000);
+    benchmarkScript(10000000);
+    benchmarkIncremental(4096, 20000);
+    benchmarkTiles(32768, 200000, 256);
+    benchmarkVector(10000000);
+    benchmarkSizes(2000000);
+    benchmarkFixed(1024, 10000000);
+    return 0;
+}
@@ -0,0 +1,195 @@
+/*
+    turtle_client.cpp
+
+    Client and latency benchmark for TurtleServer. Sends a script or binary trace file to the server
+    and saves the image it returns. With -n, sends the request that many times over -c connections
+    and reports the latency percentiles.
+
+    Usage: TurtleClient socket input [width] [height] [supersample] [options]
+           TurtleClient socket -t
+      -o image.bmp    save the returned image
+      -s path         have the server save the image to path instead of returning it
+      -f              fit the drawing to the image
+      -n requests     number of requests to send (default 1)
+      -c connections  number of concurrent connections (default 1)
+      -t              print the server's statistics instead of rendering
+
+    The input is sent as a trace if it starts with the trace signature ("YTRC"), and as a script otherwise.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "turtle_service.hpp"
+
+static int connectTo(const char *path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, (sockaddr *) &address, sizeof(address)) != 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return connection;
+}
+
+/**
+ * Sends count requests over one connection, recording the latency of each one that succeeds in seconds.
+ * @return number of requests that failed
+ */
+static int sendRequests(const char *path, const serviceRequest &request, int count, std::vector<double> &latencies,
+                        serviceResponse &response) {
+    int connection = connectTo(path);
+    int failures = 0;
+    for (int i = 0; i < count; i++) {
+        auto start = std::chrono::steady_clock::now();
+        if (!serviceSendRequest(connection, request) || !serviceReceiveResponse(connection, response)) {
+            fprintf(stderr, "Connection to %s closed\n", path);
+            close(connection);
+            return failures + count - i;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (response.status != 0) {
+            fprintf(stderr, "%s\n", response.body.c_str());
+            failures++;
+        } else {
+            latencies.push_back(elapsed.count());
+        }
+    }
+    close(connection);
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    serviceRequest request;
+    const char *output = nullptr;
+    int requests = 1;
+    int connections = 1;
+    bool stats = false;
+    std::vector<const char *> positional;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "-o") == 0 && hasValue) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0 && hasValue) {
+            request.flags |= SERVICE_SAVE;
+            request.path = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0) {
+            request.flags |= SERVICE_FIT;
+        } else if (strcmp(argv[i], "-n") == 0 && hasValue) {
+            requests = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && hasValue) {
+            connections = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            stats = true;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+    if (positional.size() < (stats ? 1u : 2u) || requests < 1 || connections < 1) {
+        fprintf(stderr, "Usage: TurtleClient socket input [width] [height] [supersample] "
+                        "[-o image.bmp] [-s path] [-f] [-n requests] [-c connections]\n"
+                        "       TurtleClient socket -t\n");
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (stats) {
+        serviceResponse response;
+        request.input = SERVICE_STATS;
+        std::vector<double> latency;
+        if (sendRequests(positional[0], request, 1, latency, response) != 0) {
+            return EXIT_FAILURE;
+        }
+        printf("%s", response.body.c_str());
+        return 0;
+    }
+    request.width = positional.size() > 2 ? (unsigned int) atoi(positional[2]) : 900;
+    request.height = positional.size() > 3 ? (unsigned int) atoi(positional[3]) : request.width;
+    request.supersample = positional.size() > 4 ? (unsigned int) atoi(positional[4]) : 1;
+
+    FILE *file = fopen(positional[1], "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Can't open %s\n", positional[1]);
+        return EXIT_FAILURE;
+    }
+    char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        request.payload.append(buffer, count);
+    }
+    fclose(file);
+    request.input = request.payload.compare(0, 4, "YTRC") == 0 ? SERVICE_TRACE : SERVICE_SCRIPT;
+
+    if (connections > requests) {
+        connections = requests;
+    }
+
+    // spread the requests over the connections, each on its own thread
+    std::vector<std::vector<double>> connectionLatencies((size_t) connections);
+    std::vector<serviceResponse> responses((size_t) connections);
+    std::atomic<int> failures{0};
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < connections; c++) {
+        int first = (int) ((long long) requests * c / connections);
+        int last = (int) ((long long) requests * (c + 1) / connections);
+        threads.emplace_back([&, c, first, last]() {
+            failures += sendRequests(positional[0], request, last - first, connectionLatencies[c], responses[c]);
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    const serviceResponse &response = responses[0];
+    if (output != nullptr && response.status == 0 && !(request.flags & SERVICE_SAVE)) {
+        file = fopen(output, "wb");
+        if (file == nullptr || fwrite(response.body.data(), 1, response.body.size(), file) != response.body.size()) {
+            fprintf(stderr, "Could not write to file: %s\n", output);
+            return EXIT_FAILURE;
+        }
+        fclose(file);
+    } else if (request.flags & SERVICE_SAVE && response.status == 0 && requests == 1) {
+        printf("%s\n", response.body.c_str());
+    }
+
+    if (requests > 1) {
+        // failed requests have no latency to speak of; they are only counted
+        std::vector<double> latencies;
+        for (const std::vector<double> &some : connectionLatencies) {
+            latencies.insert(latencies.end(), some.begin(), some.end());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](double p) {
+            return latencies[std::min(latencies.size() - 1, (size_t) (p * (double) latencies.size()))] * 1e3;
+        };
+        printf("%d requests over %d connections in %.3f s (%.1f requests/s), %d failed\n", requests, connections,
+               elapsed.count(), requests / elapsed.count(), (int) failures);
+        if (!latencies.empty()) {
+            printf("latency of %zu successful requests: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+                   latencies.size(), percentile(0.5), percentile(0.9), percentile(0.99), latencies.back() * 1e3);
+        }
+    }
+    return failures == 0 ? 0 : EXIT_FAILURE;
+}
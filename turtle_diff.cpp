@@ -0,0 +1,1281 @@
+/*
+    turtle_diff.cpp
+
+    Differential test harness for turtle.hpp.
+    Generates random turtle programs, renders each of them with the optimized rasterizers
+    and with the reference implementations, and compares the resulting fields and BMP files.
+    The reference render replays a binary trace recorded from the optimized one, so the trace
+    format is checked along the way.
+    Each program is also drawn on a turtleIncrementalCanvas, edited (one command moved a little) and
+    drawn again, which must give the same image as drawing the edited program from scratch, and a random
+    region of it is drawn through a turtleSpatialIndex, which must match that part of the whole image.
+    A turtleMultiCanvas draws it at its own size and at half that size, which must match executing the
+    program on each canvas.
+    Thick strokes are drawn by the same code in both renders, so every case also draws a random thick
+    polyline and checks its pixels against the shape worked out from its segments, joins and caps.
+    A small drawing is also written as SVG and EPS, which must be well formed and map back to the raster.
+    Failing programs are shrunk automatically and printed as C++ code; a few that once failed are
+    checked before the random ones.
+
+    Usage: TurtleDiff [iterations] [seed]
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// send even small polygons through the parallel fill
+#define PARALLEL_FILL_PIXELS 2048
+#define PARALLEL_FILL_ROWS 4
+
+#include "turtle.hpp"
+#include "turtle_display.hpp"
+
+struct diffCase {
+    unsigned int width;                    // field size
+    unsigned int height;
+    std::vector<turtleCommand> program;    // commands to render
+    size_t editAt;                         // command to edit (modulo the program size) for the incremental render
+    double editDelta[4];                   // added to its position operands
+    unsigned int region[4];                // image column, row, width and height of the region to render alone
+    bool fixedPoint;                       // render with fixed-point positions (see Turtle::setFixedPoint())?
+    int strokePoints;                      // thick polyline checked against its geometry (see checkThickStroke())
+    double strokeX[5];
+    double strokeY[5];
+    double strokeWidth;
+    int strokeJoin;
+    int strokeCap;
+};
+
+/**
+ * Piece of a thick stroke: a convex polygon, or the part of a disk on the inner side of up to two lines
+ * through its center.
+ */
+struct strokePiece {
+    bool disk;
+    double x[4];          // polygon vertices, counterclockwise, or the center of the disk
+    double y[4];
+    int count;            // vertices, or lines cutting the disk
+    double radius;
+    double normalX[2];    // unit normals of the lines, pointing into the piece
+    double normalY[2];
+};
+
+static const char *OPCODE_NAMES[] = {
+        "forward", "backward", "strafeLeft", "strafeRight", "turnLeft", "turnRight", "setHeading",
+        "goTo", "penUp", "penDown", "setPenColor", "setFillColor", "beginFill", "endFill", "dot",
+        "drawPixel", "drawLine", "drawCircle", "fillCircle", "drawTurtle", "drawInt",
+        "backup", "restore", "reset", "floodFill", "closeContour", "setFillRule",
+        "setFillAntialiasing", "setLineAntialiasing", "setPenWidth", "setLineJoin", "setLineCap",
+        "pushTransform", "popTransform", "translate", "rotate", "scale", "resetTransform", "clear"
+};
+
+static const int OPCODE_ARGS[] = {
+        1, 1, 1, 1, 1, 1, 1,
+        2, 0, 0, 3, 3, 0, 0, 0,
+        2, 4, 3, 3, 0, 2,
+        0, 0, 0, 2, 0, 1,
+        1, 1, 1, 1, 1,
+        0, 0, 2, 1, 2, 0, 3
+};
+
+static unsigned long long randomState = 1;
+
+/**
+ * Returns the next value of a xorshift64* generator (identical on every platform).
+ */
+static unsigned long long nextRandom() {
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState * 2685821657736338717ULL;
+}
+
+/**
+ * Returns a random integer in [low, high].
+ */
+static int randomInt(int low, int high) {
+    return low + (int) (nextRandom() % (unsigned long long) (high - low + 1));
+}
+
+/**
+ * Returns a random real number in [low, high), sometimes snapped to an integer.
+ */
+static double randomReal(double low, double high) {
+    double value = low + (high - low) * (double) (nextRandom() >> 11) / 9007199254740992.0;
+    return randomInt(0, 3) == 0 ? floor(value) : value;
+}
+
+static turtleCommand command(turtleOpcode op, double a0 = 0, double a1 = 0, double a2 = 0, double a3 = 0) {
+    turtleCommand result{};
+    result.op = op;
+    result.args[0] = a0;
+    result.args[1] = a1;
+    result.args[2] = a2;
+    result.args[3] = a3;
+    return result;
+}
+
+/**
+ * Generates a random field size and turtle program.
+ * Coordinates mostly stay on the field but regularly leave it to exercise clipping.
+ */
+static diffCase generateCase() {
+    diffCase result;
+    result.width = (unsigned int) randomInt(16, 320);
+    result.height = (unsigned int) randomInt(16, 320);
+
+    double w = result.width * 0.75;
+    double h = result.height * 0.75;
+    int length = randomInt(1, 60);
+    result.editAt = (size_t) randomInt(0, 1000);
+    for (double &delta : result.editDelta) {
+        delta = randomInt(-12, 12);
+    }
+    result.region[0] = (unsigned int) randomInt(0, (int) result.width - 1);
+    result.region[1] = (unsigned int) randomInt(0, (int) result.height - 1);
+    result.region[2] = (unsigned int) randomInt(1, (int) (result.width - result.region[0]));
+    result.region[3] = (unsigned int) randomInt(1, (int) (result.height - result.region[1]));
+    result.fixedPoint = randomInt(0, 2) == 0;
+    result.strokePoints = randomInt(2, 5);
+    for (int i = 0; i < result.strokePoints; i++) {
+        result.strokeX[i] = randomReal(-20, 20);
+        result.strokeY[i] = randomReal(-20, 20);
+        if (i > 0 && fabs(result.strokeX[i] - result.strokeX[i - 1]) + fabs(result.strokeY[i] - result.strokeY[i - 1]) < 1) {
+            result.strokeX[i] += 2;
+        }
+    }
+    result.strokeWidth = randomReal(2, 12);
+    result.strokeJoin = randomInt(0, 2);
+    result.strokeCap = randomInt(0, 2);
+    int transforms = 0;
+
+    for (int i = 0; i < length; i++) {
+        int choice = randomInt(0, 24);
+        switch (choice) {
+            case 0:
+            case 1:
+                result.program.push_back(command(OP_FORWARD, randomInt(-100, 100)));
+                break;
+            case 2:
+                result.program.push_back(command(OP_TURN_LEFT, randomReal(-360, 360)));
+                break;
+            case 3:
+                result.program.push_back(command(OP_GO_TO, randomReal(-w, w), randomReal(-h, h)));
+                break;
+            case 4:
+                result.program.push_back(command(randomInt(0, 1) ? OP_PEN_UP : OP_PEN_DOWN));
+                break;
+            case 5:
+                result.program.push_back(command(randomInt(0, 1) ? OP_SET_PEN_COLOR : OP_SET_FILL_COLOR,
+                                                 randomInt(0, 255), randomInt(0, 255), randomInt(0, 255)));
+                break;
+            case 6:
+            case 7: {
+                // a polygon: random vertices, a random walk or a regular (convex) polygon, sometimes made of
+                // several contours (holes or islands) under either fill rule
+                int sides = randomInt(1, 40);
+                bool regular = randomInt(0, 1) == 1;
+                int side = randomInt(1, 120);
+                int contours = randomInt(0, 2) == 0 ? randomInt(2, 4) : 1;
+                if (randomInt(0, 2) == 0) {
+                    result.program.push_back(command(OP_SET_FILL_RULE, randomInt(0, 1)));
+                }
+                result.program.push_back(command(OP_PEN_DOWN));
+                result.program.push_back(command(OP_BEGIN_FILL));
+                for (int j = 0; j < sides; j++) {
+                    if (j > 0 && j % (sides / contours + 1) == 0) {
+                        result.program.push_back(command(OP_CLOSE_CONTOUR));
+                        if (randomInt(0, 1) == 0) {
+                            result.program.push_back(command(OP_PEN_UP));
+                            result.program.push_back(command(OP_GO_TO, randomReal(-w, w), randomReal(-h, h)));
+                            result.program.push_back(command(OP_PEN_DOWN));
+                        }
+                    }
+                    if (choice == 6) {
+                        result.program.push_back(command(OP_GO_TO, randomReal(-w, w), randomReal(-h, h)));
+                    } else {
+                        result.program.push_back(command(OP_FORWARD, regular ? side : randomInt(1, 120)));
+                        result.program.push_back(command(OP_TURN_LEFT, regular ? 360.0 / sides : randomReal(-180, 180)));
+                    }
+                }
+                result.program.push_back(command(OP_END_FILL));
+                break;
+            }
+            case 8:
+                result.program.push_back(command(OP_DRAW_LINE, randomInt((int) -w, (int) w), randomInt((int) -h, (int) h),
+                                                 randomInt((int) -w, (int) w), randomInt((int) -h, (int) h)));
+                break;
+            case 9:
+                result.program.push_back(command(randomInt(0, 1) ? OP_DRAW_CIRCLE : OP_FILL_CIRCLE,
+                                                 randomInt((int) -w, (int) w), randomInt((int) -h, (int) h),
+                                                 randomInt(-2, 80)));
+                break;
+            case 10:
+                result.program.push_back(command(OP_DRAW_TURTLE));
+                break;
+            case 11:
+                result.program.push_back(command(randomInt(0, 1) ? OP_BACKUP : OP_RESTORE));
+                break;
+            case 12:
+                result.program.push_back(command(OP_SET_HEADING, randomInt(0, 7) * 45.0));
+                break;
+            case 13:
+                result.program.push_back(command(OP_DOT));
+                break;
+            case 14:
+                result.program.push_back(command(OP_DRAW_PIXEL, randomInt((int) -w, (int) w), randomInt((int) -h, (int) h)));
+                break;
+            case 15:
+                result.program.push_back(command(OP_FLOOD_FILL, randomInt((int) -w, (int) w), randomInt((int) -h, (int) h)));
+                break;
+            case 16:
+                // thick strokes are drawn by the same code in reference mode, which checks that they don't
+                // disturb the rasterizers around them; their shape is checked by checkThickStroke()
+                switch (randomInt(0, 2)) {
+                    case 0: result.program.push_back(command(OP_SET_PEN_WIDTH, randomInt(0, 3) ? 1 : randomReal(1, 12))); break;
+                    case 1: result.program.push_back(command(OP_SET_LINE_JOIN, randomInt(0, 2))); break;
+                    default: result.program.push_back(command(OP_SET_LINE_CAP, randomInt(0, 2))); break;
+                }
+                break;
+            case 17:
+                result.program.push_back(command(OP_DRAW_INT, randomInt(-100000, 100000), randomInt(0, 2)));
+                break;
+            case 18:
+                // world transforms, sometimes zoomed far enough that most of the path is clipped away
+                if (transforms > 0 && randomInt(0, 2) == 0) {
+                    result.program.push_back(command(OP_POP_TRANSFORM));
+                    transforms--;
+                    break;
+                }
+                result.program.push_back(command(OP_PUSH_TRANSFORM));
+                transforms++;
+                switch (randomInt(0, 2)) {
+                    case 0: result.program.push_back(command(OP_TRANSLATE, randomReal(-w, w), randomReal(-h, h))); break;
+                    case 1: result.program.push_back(command(OP_ROTATE, randomReal(-180, 180))); break;
+                    default: {
+                        double factor = randomInt(0, 3) ? randomReal(0.2, 3) : randomReal(10, 200);
+                        result.program.push_back(command(OP_SCALE, factor, randomInt(0, 1) ? factor : randomReal(0.2, 3)));
+                        break;
+                    }
+                }
+                break;
+            case 19:
+                result.program.push_back(command(OP_SET_FILL_ANTIALIASING, randomInt(0, 1)));
+                break;
+            case 20:
+                result.program.push_back(command(OP_SET_LINE_ANTIALIASING, randomInt(0, 1)));
+                break;
+            case 21:
+                // rare, so that most programs still keep what they drew
+                switch (randomInt(0, 2)) {
+                    case 0:
+                        result.program.push_back(command(OP_CLEAR, randomInt(0, 255), randomInt(0, 255),
+                                                         randomInt(0, 255)));
+                        break;
+                    case 1:
+                        result.program.push_back(command(OP_RESET));
+                        transforms = 0;
+                        break;
+                    default:
+                        result.program.push_back(command(OP_RESET_TRANSFORM));
+                        break;
+                }
+                break;
+            default:
+                result.program.push_back(command(randomInt(0, 1) ? OP_STRAFE_LEFT : OP_STRAFE_RIGHT, randomInt(-50, 50)));
+                break;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Finds the first differing byte of two buffers, 16 bytes at a time where SSE2 is available.
+ * @return offset of the first difference, or -1 if the buffers are equal
+ */
+static long long firstDifference(const unsigned char *a, const unsigned char *b, size_t size) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 64 <= size; i += 64) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                     _mm_loadu_si128((const __m128i *) (b + i)));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 16)),
+                                     _mm_loadu_si128((const __m128i *) (b + i + 16)));
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 32)),
+                                     _mm_loadu_si128((const __m128i *) (b + i + 32)));
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 48)),
+                                     _mm_loadu_si128((const __m128i *) (b + i + 48)));
+        __m128i all = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(all) != 0xFFFF) {
+            break;  // locate the exact byte below
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        if (a[i] != b[i]) {
+            return (long long) i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Reads a whole file into memory.
+ */
+static std::vector<unsigned char> readFile(const char *filename) {
+    std::vector<unsigned char> data;
+    FILE *file = fopen(filename, "rb");
+    if (file == nullptr) {
+        return data;
+    }
+    unsigned char buffer[1 << 16];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.insert(data.end(), buffer, buffer + count);
+    }
+    fclose(file);
+    return data;
+}
+
+/**
+ * Returns the program of a case with its edit applied: the command at editAt moved by editDelta,
+ * if it takes a position or a distance.
+ */
+static std::vector<turtleCommand> editedProgram(const diffCase &test) {
+    std::vector<turtleCommand> edited = test.program;
+    if (edited.empty()) {
+        return edited;
+    }
+    turtleCommand &command = edited[test.editAt % edited.size()];
+    turtleTraceLayout layout = turtleTraceLayout::of(command.op);
+    int operands = layout.points * 2;
+    if (command.op <= OP_SET_HEADING || command.op == OP_DRAW_CIRCLE || command.op == OP_FILL_CIRCLE) {
+        operands = layout.operands;
+    }
+    for (int i = 0; i < operands; i++) {
+        command.args[i] += test.editDelta[i];
+    }
+    return edited;
+}
+
+/**
+ * Draws a case on a turtleIncrementalCanvas, then its edited program, and compares the result with
+ * the edited program drawn from scratch. Odd edits use supersampling, to exercise the clip on blocks.
+ * @return true if both images are identical
+ */
+static bool renderIncrementally(const diffCase &test, bool report) {
+    fflush(stderr);
+    int savedStderr = dup(2);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 2);
+
+    unsigned int supersample = 1 + (unsigned int) (test.editAt % 2);
+    turtleIncrementalCanvas incremental(test.width, test.height, supersample, 16);
+    incremental.getTurtle().setThreads(4);
+    incremental.render(test.program.data(), test.program.size());
+    std::vector<turtleCommand> edited = editedProgram(test);
+    size_t redrawn = incremental.render(edited.data(), edited.size());
+
+    Turtle scratch(test.width, test.height, supersample);
+    scratch.execute(edited.data(), edited.size());
+
+    fflush(stderr);
+    dup2(savedStderr, 2);
+    close(savedStderr);
+    close(devNull);
+
+    long long pixelBytes = (long long) test.width * test.height * supersample * supersample * sizeof(rgb);
+    long long diff = firstDifference((const unsigned char *) incremental.getTurtle().getImage(),
+                                     (const unsigned char *) scratch.getImage(), (size_t) pixelBytes);
+    if (diff >= 0 && report) {
+        long long pixel = diff / (long long) sizeof(rgb);
+        long long fieldWidth = (long long) test.width * supersample;
+        long long fieldHeight = (long long) test.height * supersample;
+        printf("Incremental render (supersample %u, %zu of %zu tiles redrawn) differs at field (%lld,%lld) "
+               "after editing command %zu\n", supersample, redrawn, incremental.getTileCount(),
+               pixel % fieldWidth - fieldWidth / 2, pixel / fieldWidth - fieldHeight / 2,
+               test.program.empty() ? 0 : test.editAt % test.program.size());
+    }
+    return diff < 0;
+}
+
+/**
+ * Draws the region of a case through a turtleSpatialIndex and compares it with the same part of the whole
+ * image. Flood fills stop at the border of the region, so programs with one are skipped. Every other case
+ * uses supersampling.
+ * @return true if the region is identical
+ */
+static bool renderRegion(const diffCase &test, bool report) {
+    for (const turtleCommand &c : test.program) {
+        if (c.op == OP_FLOOD_FILL) return true;
+    }
+    fflush(stderr);
+    int savedStderr = dup(2);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 2);
+
+    unsigned int supersample = 1 + (unsigned int) (test.editAt / 2 % 2);
+    Turtle whole(test.width, test.height, supersample);
+    whole.setOrigin(0, 0);
+    whole.execute(test.program.data(), test.program.size());
+
+    turtleDisplayList list(test.program);
+    turtleSpatialIndex index(list);
+    int x0 = (int) test.region[0] - (int) (test.width / 2);
+    int y0 = (int) test.region[1] - (int) (test.height / 2);
+    Turtle &region = index.renderRegion(x0, y0, x0 + (int) test.region[2] - 1, y0 + (int) test.region[3] - 1,
+                                        supersample);
+
+    fflush(stderr);
+    dup2(savedStderr, 2);
+    close(savedStderr);
+    close(devNull);
+
+    size_t wholeWidth = test.width * supersample;
+    size_t regionWidth = test.region[2] * supersample;
+    for (size_t row = 0; row < test.region[3] * supersample; row++) {
+        const rgb *expected = whole.getImage() + (test.region[1] * supersample + row) * wholeWidth +
+                              test.region[0] * supersample;
+        const rgb *got = region.getImage() + row * regionWidth;
+        long long diff = firstDifference((const unsigned char *) got, (const unsigned char *) expected,
+                                         regionWidth * sizeof(rgb));
+        if (diff >= 0) {
+            if (report) {
+                printf("Region %ux%u at (%u,%u) (supersample %u) differs in field row %zu, column %lld\n",
+                       test.region[2], test.region[3], test.region[0], test.region[1], supersample, row,
+                       diff / (long long) sizeof(rgb));
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Returns how far a point lies inside a stroke piece: its distance to the outline if inside, or at most
+ * minus its distance if outside.
+ */
+static double insideDistance(const strokePiece &piece, double x, double y) {
+    if (piece.disk) {
+        double distance = piece.radius - hypot(x - piece.x[0], y - piece.y[0]);
+        for (int i = 0; i < piece.count; i++) {
+            distance = fmin(distance, (x - piece.x[0]) * piece.normalX[i] + (y - piece.y[0]) * piece.normalY[i]);
+        }
+        return distance;
+    }
+    double distance = HUGE_VAL;
+    for (int i = 0; i < piece.count; i++) {
+        int j = (i + 1) % piece.count;
+        double ex = piece.x[j] - piece.x[i];
+        double ey = piece.y[j] - piece.y[i];
+        double length = hypot(ex, ey);
+        if (length > 1e-9) {
+            distance = fmin(distance, (ex * (y - piece.y[i]) - ey * (x - piece.x[i])) / length);
+        }
+    }
+    return distance;
+}
+
+static strokePiece polygonPiece(std::initializer_list<double> coordinates) {
+    strokePiece piece{};
+    const double *c = coordinates.begin();
+    piece.count = (int) coordinates.size() / 2;
+    double area = 0.0;
+    for (int i = 0; i < piece.count; i++) {
+        piece.x[i] = c[2 * i];
+        piece.y[i] = c[2 * i + 1];
+    }
+    for (int i = 0; i < piece.count; i++) {
+        int j = (i + 1) % piece.count;
+        area += piece.x[i] * piece.y[j] - piece.x[j] * piece.y[i];
+    }
+    if (area < 0) {
+        std::reverse(piece.x, piece.x + piece.count);
+        std::reverse(piece.y, piece.y + piece.count);
+    }
+    return piece;
+}
+
+static strokePiece diskPiece(double x, double y, double radius, std::initializer_list<double> normals) {
+    strokePiece piece{};
+    piece.disk = true;
+    piece.x[0] = x;
+    piece.y[0] = y;
+    piece.radius = radius;
+    piece.count = (int) normals.size() / 2;
+    for (int i = 0; i < piece.count; i++) {
+        piece.normalX[i] = normals.begin()[2 * i];
+        piece.normalY[i] = normals.begin()[2 * i + 1];
+    }
+    return piece;
+}
+
+/**
+ * Draws the thick polyline of a case and checks every pixel against the shape it should have, worked out
+ * from the stroke's geometry rather than the turtle's: a rectangle per segment reaching half a pixel past its
+ * ends, the pen's join filling the wedge outside every corner and its cap at both ends. Pixels whose centers lie more than a margin
+ * inside the shape must be drawn, and pixels more than the margin outside must not be; the margin covers the
+ * chords of round joins and caps. Corners close to the miter limit may be mitered or beveled.
+ * @return true if the stroke has the expected shape
+ */
+static bool checkThickStroke(const diffCase &test, bool report) {
+    const int side = 64;
+    const double margin = 0.3;
+    double halfWidth = test.strokeWidth / 2.0;
+    std::vector<strokePiece> inner;     // drawn for sure
+    std::vector<strokePiece> outer;     // may be drawn
+    auto both = [&](const strokePiece &piece) {
+        inner.push_back(piece);
+        outer.push_back(piece);
+    };
+    auto direction = [&](int i, double &dx, double &dy) {
+        dx = test.strokeX[i + 1] - test.strokeX[i];
+        dy = test.strokeY[i + 1] - test.strokeY[i];
+        double length = sqrt(dx * dx + dy * dy);
+        dx /= length;
+        dy /= length;
+    };
+    auto cap = [&](double x, double y, double dx, double dy) {
+        double nx = -dy * halfWidth;
+        double ny = dx * halfWidth;
+        if (test.strokeCap == CAP_ROUND) {
+            both(diskPiece(x, y, halfWidth, {dx, dy}));
+        } else if (test.strokeCap == CAP_SQUARE) {
+            both(polygonPiece({x + nx, y + ny, x - nx, y - ny, x - nx + dx * halfWidth, y - ny + dy * halfWidth,
+                               x + nx + dx * halfWidth, y + ny + dy * halfWidth}));
+        }
+    };
+
+    int last = test.strokePoints - 1;
+    for (int i = 0; i < last; i++) {
+        double dx, dy;
+        direction(i, dx, dy);
+        double nx = -dy * halfWidth;
+        double ny = dx * halfWidth;
+        double ax = test.strokeX[i] - dx * 0.5;
+        double ay = test.strokeY[i] - dy * 0.5;
+        double bx = test.strokeX[i + 1] + dx * 0.5;
+        double by = test.strokeY[i + 1] + dy * 0.5;
+        both(polygonPiece({ax - nx, ay - ny, bx - nx, by - ny, bx + nx, by + ny, ax + nx, ay + ny}));
+        if (i == 0) {
+            cap(test.strokeX[0], test.strokeY[0], -dx, -dy);
+        }
+        if (i == last - 1) {
+            cap(test.strokeX[last], test.strokeY[last], dx, dy);
+            continue;
+        }
+
+        // the join with the next segment fills the wedge on the outside of the turn
+        double dx1, dy1;
+        direction(i + 1, dx1, dy1);
+        double x = test.strokeX[i + 1];
+        double y = test.strokeY[i + 1];
+        double cross = dx * dy1 - dy * dx1;
+        double dot = dx * dx1 + dy * dy1;
+        if (fabs(cross) < 1e-12 && dot > 0.0) {
+            continue;
+        }
+        double turn = cross >= 0.0 ? -1.0 : 1.0;
+        double jx0 = x - turn * dy * halfWidth;
+        double jy0 = y + turn * dx * halfWidth;
+        double jx1 = x - turn * dy1 * halfWidth;
+        double jy1 = y + turn * dx1 * halfWidth;
+        strokePiece bevel = polygonPiece({x, y, jx0, jy0, jx1, jy1});
+        double scale = turn * halfWidth / (1.0 + dot);
+        double tipX = x - (dy + dy1) * scale;
+        double tipY = y + (dx + dx1) * scale;
+        double limit = 2.0 / (MITER_LIMIT * MITER_LIMIT);
+        if (test.strokeJoin == JOIN_ROUND) {
+            both(diskPiece(x, y, halfWidth, {dx, dy, -dx1, -dy1}));
+        } else if (test.strokeJoin == JOIN_BEVEL || 1.0 + dot < limit - 1e-9) {
+            both(bevel);
+        } else if (1.0 + dot > limit + 1e-9) {
+            both(polygonPiece({x, y, jx0, jy0, tipX, tipY, jx1, jy1}));
+        } else {
+            inner.push_back(bevel);
+            outer.push_back(polygonPiece({x, y, jx0, jy0, tipX, tipY, jx1, jy1}));
+        }
+    }
+
+    fflush(stderr);
+    int savedStderr = dup(2);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 2);
+
+    Turtle turtle(side, side);
+    turtle.setPenColor(0, 0, 0);
+    turtle.setPenWidth(test.strokeWidth);
+    turtle.setLineJoin((turtleLineJoin) test.strokeJoin);
+    turtle.setLineCap((turtleLineCap) test.strokeCap);
+    turtle.penUp();
+    turtle.goTo(test.strokeX[0], test.strokeY[0]);
+    turtle.penDown();
+    for (int i = 1; i < test.strokePoints; i++) {
+        turtle.goTo(test.strokeX[i], test.strokeY[i]);
+    }
+    const rgb *image = turtle.getImage();
+
+    fflush(stderr);
+    dup2(savedStderr, 2);
+    close(savedStderr);
+    close(devNull);
+
+    for (int y = -side / 2; y < side / 2; y++) {
+        for (int x = -side / 2; x < side / 2; x++) {
+            const rgb &pixel = image[(y + side / 2) * side + x + side / 2];
+            bool drawn = pixel.red != 255 || pixel.green != 255 || pixel.blue != 255;
+            double inside = -HUGE_VAL;
+            for (const strokePiece &piece : drawn ? outer : inner) {
+                inside = fmax(inside, insideDistance(piece, x, y));
+            }
+            if (drawn ? inside < -margin : inside > margin) {
+                if (report) {
+                    printf("Thick stroke %s pixel (%d,%d), %.3f from its outline\n", drawn ? "covers" : "misses",
+                           x, y, fabs(inside));
+                }
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Draws a case with a turtleMultiCanvas at its own size and half of it, and compares each image with
+ * executing the program on a canvas of the same size and world scale, which resets bring back.
+ * @return true if both images are identical
+ */
+static bool renderSizes(const diffCase &test, bool report) {
+    fflush(stderr);
+    int savedStderr = dup(2);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 2);
+
+    unsigned int widths[] = {test.width, (test.width + 1) / 2};
+    unsigned int heights[] = {test.height, (test.height + 1) / 2};
+    turtleMultiCanvas sizes;
+    sizes.setFixedPoint(test.fixedPoint);
+    for (int i = 0; i < 2; i++) {
+        sizes.add(widths[i], heights[i]);
+    }
+    turtleDisplayList list(test.program);
+    sizes.render(list);
+
+    long long diff = -1;
+    int size = 0;
+    for (; size < 2 && diff < 0; size++) {
+        Turtle direct(widths[size], heights[size]);
+        direct.setFixedPoint(test.fixedPoint);
+        for (size_t i = 0; i <= test.program.size(); i++) {
+            if (i == 0 || test.program[i - 1].op == OP_RESET || test.program[i - 1].op == OP_RESET_TRANSFORM) {
+                direct.resetTransform();
+                if (size > 0) {
+                    direct.scale((double) widths[size] / widths[0]);
+                }
+            }
+            if (i < test.program.size()) {
+                direct.execute(test.program[i]);
+            }
+        }
+        diff = firstDifference((const unsigned char *) sizes.getCanvas(size).getImage(),
+                               (const unsigned char *) direct.getImage(),
+                               (size_t) widths[size] * heights[size] * sizeof(rgb));
+    }
+
+    fflush(stderr);
+    dup2(savedStderr, 2);
+    close(savedStderr);
+    close(devNull);
+
+    if (diff >= 0 && report) {
+        long long pixel = diff / (long long) sizeof(rgb);
+        printf("Multi-size render at %ux%u differs at pixel (%lld,%lld)\n", widths[size - 1], heights[size - 1],
+               pixel % widths[size - 1] - widths[size - 1] / 2, pixel / widths[size - 1] - heights[size - 1] / 2);
+    }
+    return diff < 0;
+}
+
+/**
+ * Returns why an SVG document is not well-formed XML with a single svg root element, or nullptr.
+ */
+static const char *xmlProblem(const std::string &text) {
+    std::vector<std::string> open;
+    bool root = false;
+    size_t i = 0;
+    while (i < text.size()) {
+        if (text[i] != '<') {
+            if (!isspace((unsigned char) text[i])) return "text outside the elements";
+            i++;
+            continue;
+        }
+        bool closing = i + 1 < text.size() && text[i + 1] == '/';
+        size_t j = i + 1 + (closing ? 1 : 0);
+        size_t nameStart = j;
+        while (j < text.size() && isalnum((unsigned char) text[j])) j++;
+        if (j == nameStart) return "element without a name";
+        std::string name = text.substr(nameStart, j - nameStart);
+        if (closing) {
+            if (open.empty() || open.back() != name || j >= text.size() || text[j] != '>') return "unbalanced end tag";
+            open.pop_back();
+            i = j + 1;
+            continue;
+        }
+        if (open.empty() && (root || name != "svg")) return "not a single svg element";
+        root = true;
+
+        while (true) {
+            while (j < text.size() && isspace((unsigned char) text[j])) j++;
+            if (j >= text.size()) return "unterminated tag";
+            if (text[j] == '>') {
+                open.push_back(name);
+                i = j + 1;
+                break;
+            }
+            if (text.compare(j, 2, "/>") == 0) {
+                i = j + 2;
+                break;
+            }
+            size_t attribute = j;
+            while (j < text.size() && (isalnum((unsigned char) text[j]) || text[j] == '-' || text[j] == ':')) j++;
+            if (j == attribute || text.compare(j, 2, "=\"") != 0) return "malformed attribute";
+            size_t end = text.find('"', j + 2);
+            if (end == std::string::npos) return "unterminated attribute";
+            if (text.substr(j + 2, end - j - 2).find_first_of("<&") != std::string::npos) return "markup in an attribute";
+            j = end + 1;
+            if (j < text.size() && !isspace((unsigned char) text[j]) && text[j] != '>' && text[j] != '/') {
+                return "attributes not separated";
+            }
+        }
+    }
+    return root && open.empty() ? nullptr : "unclosed element";
+}
+
+/**
+ * Splits PostScript into tokens, leaving out comments. Braces are tokens of their own, and a literal
+ * name keeps its slash.
+ */
+static std::vector<std::string> postScriptTokens(const std::string &text) {
+    std::vector<std::string> tokens;
+    size_t i = 0;
+    while (i < text.size()) {
+        char c = text[i];
+        if (c == '%') {
+            while (i < text.size() && text[i] != '\n') i++;
+        } else if (isspace((unsigned char) c)) {
+            i++;
+        } else if (c == '{' || c == '}') {
+            tokens.emplace_back(1, c);
+            i++;
+        } else {
+            size_t start = i++;
+            while (i < text.size() && !isspace((unsigned char) text[i]) && strchr("{}/%", text[i]) == nullptr) i++;
+            tokens.push_back(text.substr(start, i - start));
+        }
+    }
+    return tokens;
+}
+
+/**
+ * Returns the first executable name in EPS tokens that is neither a PostScript operator the vector writer
+ * uses nor a name the document defined before, or an empty string.
+ */
+static std::string undefinedOperator(const std::vector<std::string> &tokens) {
+    std::vector<std::string> known = {"def", "load", "bind", "repeat", "div", "roll", "setrgbcolor", "arc",
+                                      "newpath", "moveto", "rlineto", "closepath", "stroke", "fill", "eofill",
+                                      "rectfill", "setmiterlimit", "setlinewidth", "setlinecap", "setlinejoin",
+                                      "showpage"};
+    for (const std::string &token : tokens) {
+        char *end;
+        strtod(token.c_str(), &end);
+        if (*end == '\0' || token == "{" || token == "}") {
+            continue;
+        }
+        if (token[0] == '/') {
+            known.push_back(token.substr(1));
+        } else if (std::find(known.begin(), known.end(), token) == known.end()) {
+            return token;
+        }
+    }
+    return "";
+}
+
+/**
+ * Reads the points of an SVG path made of absolute moves (M), relative lines (l) and closes (z).
+ * @param contours points of every subpath, x and y interleaved, in drawing coordinates (output)
+ * @param closes number of closed subpaths (output)
+ * @return false if the path data is malformed
+ */
+static bool svgContours(const char *d, std::vector<std::vector<double>> &contours, size_t &closes) {
+    contours.clear();
+    closes = 0;
+    char command = 0;
+    while (*d != '"' && *d != '\0') {
+        if (*d == 'M' || *d == 'l' || *d == 'z') {
+            command = *d++;
+            if (command == 'M') contours.emplace_back();
+            if (command == 'z') closes++;
+            continue;
+        }
+        if (*d == ' ') {
+            d++;
+            continue;
+        }
+        char *end;
+        double x = strtod(d, &end);
+        if (end == d || *end != ' ' || contours.empty() || (command != 'M' && command != 'l')) return false;
+        d = end + 1;
+        double y = strtod(d, &end);
+        if (end == d) return false;
+        d = end;
+        std::vector<double> &points = contours.back();
+        bool relative = command == 'l';
+        points.push_back(x + (relative ? points[points.size() - 2] : 0));
+        points.push_back(y + (relative ? points[points.size() - 2] : 0));
+        command = 'l';
+    }
+    return *d == '"';
+}
+
+/**
+ * Reads the points of an EPS path: "x y m" starts a subpath, "dx dy r" adds a line and "h" closes it.
+ * @param first token after the path's start
+ * @param end token of the painting operator
+ * @param contours points of every subpath, x and y interleaved, in drawing coordinates (output)
+ * @param closes number of closed subpaths (output)
+ * @return false if the path is malformed
+ */
+static bool epsContours(const std::vector<std::string> &tokens, size_t first, size_t end,
+                        std::vector<std::vector<double>> &contours, size_t &closes) {
+    contours.clear();
+    closes = 0;
+    for (size_t i = first; i < end;) {
+        if (tokens[i] == "h") {
+            closes++;
+            i++;
+            continue;
+        }
+        if (i + 2 >= end || (tokens[i + 2] != "m" && tokens[i + 2] != "r")) return false;
+        double x = atof(tokens[i].c_str());
+        double y = atof(tokens[i + 1].c_str());
+        if (tokens[i + 2] == "m") {
+            contours.emplace_back();
+        } else if (contours.empty()) {
+            return false;
+        } else {
+            std::vector<double> &points = contours.back();
+            x += points[points.size() - 2];
+            y += points[points.size() - 1];
+        }
+        contours.back().push_back(x);
+        contours.back().push_back(y);
+        i += 3;
+    }
+    return true;
+}
+
+/**
+ * Writes a small drawing as SVG and as EPS: a thin polyline through the stroke points of a case, then a
+ * filled square with a square hole under the even-odd rule. Both documents must be well formed (the SVG as
+ * XML, the EPS using only PostScript operators and the ones it defines), the polyline must come out as a
+ * single path whose points map back to the pixels the rasterizer drew at its ends and corners, and the
+ * fill must keep both contours and its rule.
+ * @return true if the drawings are as expected
+ */
+static bool checkVectorOutput(const diffCase &test, bool report) {
+    int width = (int) test.width;
+    int height = (int) test.height;
+    std::vector<turtleCommand> polyline = {command(OP_PEN_UP)};
+    std::vector<double> corners;
+    for (int i = 0; i < test.strokePoints; i++) {
+        double x = round(test.strokeX[i] * width / 50);
+        double y = round(test.strokeY[i] * height / 50);
+        if (!corners.empty() && x == corners[corners.size() - 2] && y == corners.back()) x++;
+        polyline.push_back(command(OP_GO_TO, x, y));
+        polyline.push_back(command(OP_PEN_DOWN));
+        corners.push_back(x);
+        corners.push_back(y);
+    }
+    polyline.push_back(command(OP_PEN_UP));
+
+    double s = std::min(width, height) / 4;
+    std::vector<std::vector<double>> squares = {{s, -s, s, s, -s, s, -s, -s},
+                                                {s / 2, -s / 2, s / 2, s / 2, -s / 2, s / 2, -s / 2, -s / 2}};
+    // another pen, so that the outline can't continue the polyline's path
+    std::vector<turtleCommand> fill = {command(OP_SET_FILL_RULE, FILL_EVEN_ODD), command(OP_SET_FILL_COLOR, 0, 128, 255),
+                                       command(OP_SET_PEN_COLOR, 0, 0, 255),
+                                       command(OP_GO_TO, -s, -s), command(OP_PEN_DOWN), command(OP_BEGIN_FILL)};
+    for (const std::vector<double> &square : squares) {
+        if (&square != &squares[0]) {
+            fill.push_back(command(OP_CLOSE_CONTOUR));
+            fill.push_back(command(OP_PEN_UP));
+            fill.push_back(command(OP_GO_TO, square[6], square[7]));
+            fill.push_back(command(OP_PEN_DOWN));
+        }
+        for (size_t k = 0; k < square.size(); k += 2) {
+            fill.push_back(command(OP_GO_TO, square[k], square[k + 1]));
+        }
+    }
+    fill.push_back(command(OP_END_FILL));
+
+    Turtle raster(test.width, test.height);
+    raster.execute(polyline.data(), polyline.size());
+
+    const char *problem = nullptr;
+    for (int format = 0; format < 2 && problem == nullptr; format++) {
+        Turtle vector(test.width, test.height);
+        turtleVectorWriter drawing(format == 0 ? VECTOR_SVG : VECTOR_EPS, test.width, test.height);
+        vector.setVectorOutput(&drawing);
+        vector.execute(polyline.data(), polyline.size());
+        vector.execute(fill.data(), fill.size());
+        vector.setVectorOutput(nullptr);
+        drawing.close();
+        const std::string &text = drawing.getText();
+
+        // the paths of the polyline and of the fill, in drawing coordinates
+        std::vector<std::vector<double>> lines, contours;
+        size_t lineCloses, closes;
+        if (format == 0) {
+            problem = xmlProblem(text);
+            size_t path = text.find("<path d=\"");
+            size_t filled = text.find("fill-rule=\"evenodd\">\n<path d=\"");
+            if (problem == nullptr && (path == std::string::npos || filled == std::string::npos ||
+                                       !svgContours(text.c_str() + path + 9, lines, lineCloses) ||
+                                       !svgContours(text.c_str() + text.find("d=\"", filled) + 3, contours, closes))) {
+                problem = "SVG paths missing or malformed";
+            }
+        } else {
+            std::vector<std::string> tokens = postScriptTokens(text);
+            std::string unknown = undefinedOperator(tokens);
+            size_t move = std::find(tokens.begin(), tokens.end(), "m") - tokens.begin();
+            size_t stroke = std::find(tokens.begin() + (long) std::min(move, tokens.size()), tokens.end(), "s") -
+                            tokens.begin();
+            size_t evenOdd = std::find(tokens.begin(), tokens.end(), "e") - tokens.begin();
+            size_t start = evenOdd;
+            while (start > 0 && start < tokens.size() && tokens[start] != "n") start--;
+            if (!unknown.empty()) {
+                static std::string message;
+                message = "EPS uses undefined operator " + unknown;
+                problem = message.c_str();
+            } else if (text.compare(0, 23, "%!PS-Adobe-3.0 EPSF-3.0") != 0 || move < 2 || stroke >= tokens.size() ||
+                       evenOdd >= tokens.size() || !epsContours(tokens, move - 2, stroke, lines, lineCloses) ||
+                       !epsContours(tokens, start + 1, evenOdd, contours, closes)) {
+                problem = "EPS paths missing or malformed";
+            }
+        }
+        if (problem != nullptr) break;
+
+        // image pixel (x,y) is centered at column x + width / 2 and storage row y + height / 2, counted from
+        // the bottom as in the BMP file, plus half a pixel; the SVG counts rows from the top
+        auto toImage = [&](std::vector<double> &points) {
+            for (size_t k = 0; k < points.size(); k += 2) {
+                double row = format == 0 ? height - points[k + 1] : points[k + 1];
+                points[k] = points[k] - 0.5 - width / 2;
+                points[k + 1] = row - 0.5 - height / 2;
+            }
+        };
+        if (lines.size() != 1 || lines[0].size() != corners.size() || lineCloses != 0) {
+            problem = "polyline not written as one path";
+            break;
+        }
+        toImage(lines[0]);
+        for (size_t k = 0; k < corners.size() && problem == nullptr; k += 2) {
+            int column = (int) corners[k] + width / 2;
+            int row = (int) corners[k + 1] + height / 2;
+            if (lines[0][k] != corners[k] || lines[0][k + 1] != corners[k + 1]) {
+                problem = "polyline point does not map back to its image point";
+            } else if (column >= 0 && column < width && row >= 0 && row < height) {
+                const rgb &pixel = raster.getImage()[(size_t) row * test.width + (size_t) column];
+                if (pixel.red != 0 || pixel.green != 0 || pixel.blue != 0) {
+                    problem = "polyline point is not a pixel of the raster line";
+                }
+            }
+        }
+        if (problem != nullptr) break;
+
+        if (contours.size() != squares.size() || closes != squares.size()) {
+            problem = "fill does not keep its closed contours";
+            break;
+        }
+        for (size_t c = 0; c < contours.size() && problem == nullptr; c++) {
+            toImage(contours[c]);
+            if (contours[c] != squares[c]) {
+                problem = "fill contour does not map back to its vertices";
+            }
+        }
+    }
+
+    if (problem != nullptr && report) {
+        printf("Vector output: %s\n", problem);
+    }
+    return problem == nullptr;
+}
+
+/**
+ * Renders a case with both implementations and compares the results.
+ * @param test case to render
+ * @param report print details about the first difference?
+ * @return true if both renders are identical
+ */
+static bool renderAndCompare(const diffCase &test, bool report) {
+    // the turtles complain about every out-of-bounds pixel; keep the harness output readable
+    fflush(stderr);
+    int savedStderr = dup(2);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, 2);
+
+    Turtle optimized(test.width, test.height);
+    Turtle reference(test.width, test.height);
+    reference.setReferenceMode(true);
+    optimized.setFixedPoint(test.fixedPoint);
+    reference.setFixedPoint(test.fixedPoint);
+    optimized.setThreads(4);  // exercise the parallel paths even on small machines
+
+    turtleTraceWriter trace;
+    optimized.setRecorder(&trace);
+    optimized.execute(test.program.data(), test.program.size());
+    optimized.setRecorder(nullptr);
+    const std::vector<unsigned char> &traceBytes = trace.getBytes();
+    reference.replayTrace(traceBytes.data(), traceBytes.size());
+
+    optimized.saveBMP("turtle_diff_optimized.bmp");
+    reference.saveBMP("turtle_diff_reference.bmp");
+
+    fflush(stderr);
+    dup2(savedStderr, 2);
+    close(savedStderr);
+    close(devNull);
+
+    std::vector<unsigned char> optimizedFile = readFile("turtle_diff_optimized.bmp");
+    std::vector<unsigned char> referenceFile = readFile("turtle_diff_reference.bmp");
+    remove("turtle_diff_optimized.bmp");
+    remove("turtle_diff_reference.bmp");
+
+    // the hashes are the quick check; the byte comparison below pinpoints a difference
+    if (!report && optimized.hashImage() != reference.hashImage()) {
+        return false;
+    }
+
+    long long pixelBytes = (long long) test.width * test.height * sizeof(rgb);
+    long long diff = firstDifference((const unsigned char *) optimized.getImage(),
+                                     (const unsigned char *) reference.getImage(), (size_t) pixelBytes);
+    if (diff >= 0) {
+        if (report) {
+            long long pixel = diff / (long long) sizeof(rgb);
+            const rgb &got = optimized.getImage()[pixel];
+            const rgb &expected = reference.getImage()[pixel];
+            printf("Field differs at (%lld,%lld): got (%d,%d,%d), expected (%d,%d,%d)\n",
+                   pixel % test.width - test.width / 2, pixel / test.width - test.height / 2,
+                   got.red, got.green, got.blue, expected.red, expected.green, expected.blue);
+        }
+        return false;
+    }
+
+    if (optimizedFile.size() != referenceFile.size() ||
+        firstDifference(optimizedFile.data(), referenceFile.data(), optimizedFile.size()) >= 0) {
+        if (report) {
+            printf("BMP files differ (%zu vs %zu bytes)\n", optimizedFile.size(), referenceFile.size());
+        }
+        return false;
+    }
+
+    return renderIncrementally(test, report) && renderRegion(test, report) && renderSizes(test, report) &&
+           checkThickStroke(test, report) && checkVectorOutput(test, report);
+}
+
+/**
+ * Checks that every popTransform in a program has a matching pushTransform before it, with no reset between.
+ */
+static bool transformsBalanced(const std::vector<turtleCommand> &program) {
+    int depth = 0;
+    for (const turtleCommand &c : program) {
+        if (c.op == OP_RESET) depth = 0;
+        if (c.op == OP_PUSH_TRANSFORM) depth++;
+        if (c.op == OP_POP_TRANSFORM && --depth < 0) return false;
+    }
+    return true;
+}
+
+/**
+ * Shrinks a failing case by repeatedly removing chunks of commands while it keeps failing.
+ */
+static diffCase minimize(diffCase test) {
+    size_t chunk = test.program.size() / 2;
+    if (chunk == 0) chunk = 1;
+
+    while (true) {
+        bool removed = false;
+        for (size_t start = 0; start < test.program.size();) {
+            diffCase candidate = test;
+            size_t end = start + chunk < candidate.program.size() ? start + chunk : candidate.program.size();
+            candidate.program.erase(candidate.program.begin() + (long) start, candidate.program.begin() + (long) end);
+
+            if (transformsBalanced(candidate.program) && !renderAndCompare(candidate, false)) {
+                test = candidate;
+                removed = true;
+            } else {
+                start += chunk;
+            }
+        }
+        if (!removed) {
+            if (chunk == 1) break;
+            chunk /= 2;
+        }
+    }
+
+    return test;
+}
+
+/**
+ * Returns a case that draws the given program on the whole field, with a short thin stroke.
+ */
+static diffCase fixedCase(unsigned int width, unsigned int height, bool fixedPoint,
+                          std::initializer_list<turtleCommand> program) {
+    diffCase result{};
+    result.width = width;
+    result.height = height;
+    result.program = program;
+    result.region[2] = width;
+    result.region[3] = height;
+    result.fixedPoint = fixedPoint;
+    result.strokePoints = 2;
+    result.strokeX[0] = -5;
+    result.strokeX[1] = 5;
+    result.strokeWidth = 2;
+    return result;
+}
+
+/**
+ * Returns programs that once rendered differently, checked before the random ones.
+ * Each of them fills a pixel whose exact coverage is a tie between two alpha levels (seeds 7, 46 and 57).
+ */
+static std::vector<diffCase> regressionCases() {
+    return {
+            fixedCase(234, 41, true, {
+                    command(OP_SET_FILL_ANTIALIASING, 1), command(OP_SET_LINE_ANTIALIASING, 1),
+                    command(OP_BEGIN_FILL), command(OP_GO_TO, -172, 15), command(OP_GO_TO, 148.00058721707302, 27),
+                    command(OP_GO_TO, 158.31717607980477, -29.560179399963868), command(OP_END_FILL)}),
+            fixedCase(104, 135, false, {
+                    command(OP_SET_FILL_ANTIALIASING, 1), command(OP_SET_LINE_ANTIALIASING, 1),
+                    command(OP_BEGIN_FILL), command(OP_GO_TO, 65.60926192032511, 54.280060936872559), command(OP_GO_TO, -51, -56),
+                    command(OP_GO_TO, -37, 19), command(OP_END_FILL)}),
+            fixedCase(70, 270, false, {
+                    command(OP_SET_FILL_COLOR, 178, 173, 194), command(OP_SET_FILL_ANTIALIASING, 1),
+                    command(OP_SET_LINE_ANTIALIASING, 1),
+                    command(OP_CLEAR, 126, 58, 199), command(OP_BEGIN_FILL), command(OP_GO_TO, -5, 91),
+                    command(OP_GO_TO, 32, 1), command(OP_GO_TO, -14.665814599729522, 76), command(OP_END_FILL)})
+    };
+}
+
+/**
+ * Returns an operand of a command as C++ code that passes it to the turtle's method: enumerators by name, and
+ * reals with a decimal point, so that goTo(27.0, 3.5) does not become an ambiguous goTo(27, 3.5).
+ */
+static std::string operandCode(turtleOpcode op, double value) {
+    static const char *FILL_RULES[] = {"FILL_EVEN_ODD", "FILL_NONZERO"};
+    static const char *LINE_JOINS[] = {"JOIN_ROUND", "JOIN_MITER", "JOIN_BEVEL"};
+    static const char *LINE_CAPS[] = {"CAP_BUTT", "CAP_ROUND", "CAP_SQUARE"};
+    const char *type = nullptr;
+    const char **names = nullptr;
+    int count = 0;
+    bool real = false;
+    switch (op) {
+        case OP_SET_FILL_RULE: type = "turtleFillRule"; names = FILL_RULES; count = 2; break;
+        case OP_SET_LINE_JOIN: type = "turtleLineJoin"; names = LINE_JOINS; count = 3; break;
+        case OP_SET_LINE_CAP:  type = "turtleLineCap"; names = LINE_CAPS; count = 3; break;
+        case OP_TURN_LEFT: case OP_TURN_RIGHT: case OP_SET_HEADING: case OP_GO_TO: case OP_SET_PEN_WIDTH:
+        case OP_TRANSLATE: case OP_ROTATE: case OP_SCALE:
+            real = true;
+            break;
+        default:
+            break;
+    }
+
+    char text[64];
+    if (type) {
+        int index = (int) value;
+        if (index >= 0 && index < count) return names[index];
+        snprintf(text, sizeof(text), "(%s) %d", type, index);
+        return text;
+    }
+    snprintf(text, sizeof(text), "%.17g", value);
+    if (real && !strpbrk(text, ".eni")) {
+        strcat(text, ".0");
+    }
+    return text;
+}
+
+/**
+ * Prints a case as a C++ snippet that reproduces it.
+ */
+static void printCase(const diffCase &test) {
+    printf("Turtle turtle(%u, %u);\n", test.width, test.height);
+    if (test.fixedPoint) {
+        printf("turtle.setFixedPoint(true);\n");
+    }
+    for (const turtleCommand &c : test.program) {
+        printf("turtle.%s(", OPCODE_NAMES[c.op]);
+        for (int i = 0; i < OPCODE_ARGS[c.op]; i++) {
+            printf(i == 0 ? "%s" : ", %s", operandCode(c.op, c.args[i]).c_str());
+        }
+        printf(");\n");
+    }
+    if (!test.program.empty()) {
+        printf("// incremental edit: command %zu moved by (%g, %g, %g, %g)\n", test.editAt % test.program.size(),
+               test.editDelta[0], test.editDelta[1], test.editDelta[2], test.editDelta[3]);
+    }
+    printf("// region: %ux%u at image column %u, row %u\n", test.region[2], test.region[3], test.region[0],
+           test.region[1]);
+    printf("// thick stroke: width %.17g, join %d, cap %d, through", test.strokeWidth, test.strokeJoin, test.strokeCap);
+    for (int i = 0; i < test.strokePoints; i++) {
+        printf(" (%.17g, %.17g)", test.strokeX[i], test.strokeY[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 500;
+    randomState = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1;
+    if (randomState == 0) randomState = 1;
+
+    for (const diffCase &test : regressionCases()) {
+        if (!renderAndCompare(test, true)) {
+            printf("Mismatch in a regression case\n");
+            printCase(test);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        diffCase test = generateCase();
+        if (!renderAndCompare(test, false)) {
+            printf("Mismatch in case %d (%zu commands), minimizing...\n", i, test.program.size());
+            diffCase smallest = minimize(test);
+            renderAndCompare(smallest, true);
+            printCase(smallest);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%d random programs rendered identically\n", iterations);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,729 @@
+/*
+    turtle_display.hpp
+
+    Display lists: the turtle commands of a drawing kept in memory (loaded from a binary trace or
+    recorded from a script), canvases that redraw them after an edit, and an index for drawing parts of them.
+
+    turtleIncrementalCanvas splits its image into tiles and remembers, for every tile, a signature of the
+    commands that drew on it. A command's signature covers its operands and the turtle state it starts from
+    (see Turtle::hashState()), so a tile whose commands all start from the same state and draw the same
+    things gets the same signature. After an edit only the tiles whose signature changed are cleared and
+    drawn again, with the clip of the turtle (see Turtle::setClip()) limiting the redraw to them.
+
+    turtleSpatialIndex keeps, for every command that draws, the box it draws in and the turtle state it
+    starts from (see Turtle::saveState()), with the boxes in a uniform grid. Drawing a region of the image
+    runs only the commands whose boxes reach it, each from its saved state, in their original order.
+
+    turtleMultiCanvas draws one display list at several image sizes. The commands are interpreted once:
+    moves that depend on the heading become moves to the point they reach, and runs of turns a single
+    heading, so the outputs only map points to their own pixels. Each output is then drawn on its own thread.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TURTLEGRAPHICS_YATG_DISPLAY_HPP
+#define TURTLEGRAPHICS_YATG_DISPLAY_HPP
+
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "turtle.hpp"
+
+#define INCREMENTAL_TILE 64     // default tile size of turtleIncrementalCanvas, in image pixels
+#define INDEX_CELL 64           // smallest grid cell of turtleSpatialIndex, in image pixels
+#define INDEX_MAX_CELLS 256     // boxes covering more cells are checked by every query instead
+
+/**
+ * The commands of a drawing, in order.
+ */
+class turtleDisplayList {
+    std::vector<turtleCommand> commands;
+
+public:
+    turtleDisplayList() = default;
+
+    explicit turtleDisplayList(std::vector<turtleCommand> list) : commands(std::move(list)) {
+    }
+
+    /**
+     * Replaces the list with the commands of a binary trace held in memory.
+     * @param bytes
+     * @param count
+     */
+    void loadTrace(const unsigned char *bytes, size_t count) {
+        turtleTraceReader reader(bytes, count);
+        load(reader);
+    }
+
+    /**
+     * Replaces the list with the commands of a binary trace file.
+     * @param filename
+     */
+    void loadTrace(const char *filename) {
+        turtleTraceReader reader(filename);
+        load(reader);
+    }
+
+    /**
+     * Appends a command.
+     * @param command
+     */
+    void add(const turtleCommand &command) {
+        commands.push_back(command);
+    }
+
+    void clear() {
+        commands.clear();
+    }
+
+    const std::vector<turtleCommand> &getCommands() const {
+        return commands;
+    }
+
+    std::vector<turtleCommand> &getCommands() {
+        return commands;
+    }
+
+    const turtleCommand *data() const {
+        return commands.data();
+    }
+
+    size_t size() const {
+        return commands.size();
+    }
+
+private:
+    void load(turtleTraceReader &reader) {
+        commands.clear();
+        turtleCommand command{};
+        while (reader.next(command)) {
+            commands.push_back(command);
+        }
+    }
+};
+
+/**
+ * A canvas that keeps its image between renders and redraws only the tiles that a change of the
+ * commands affects. Flood fills depend on everything drawn before them, so a list containing one (now or
+ * in the previous render) is drawn in full.
+ */
+class turtleIncrementalCanvas {
+    Turtle canvas;
+    int tileSize;
+    int columns;                                // tiles across and down the image
+    int rows;
+    std::vector<unsigned long long> tiles;      // signature of every tile after the previous render
+    std::vector<unsigned long long> next;       // signatures being computed
+    bool rendered = false;                      // has the image been drawn yet?
+    bool floodFilled = false;                   // did the previous commands have a flood fill?
+
+public:
+    /**
+     * @param width image size in pixels
+     * @param height
+     * @param supersample field pixels per image pixel along each axis
+     * @param tile tile size in image pixels
+     */
+    turtleIncrementalCanvas(unsigned int width, unsigned int height, unsigned int supersample = 1,
+                            int tile = INCREMENTAL_TILE)
+            : canvas(width, height, supersample), tileSize(tile > 0 ? tile : INCREMENTAL_TILE) {
+        columns = ((int) width + tileSize - 1) / tileSize;
+        rows = ((int) height + tileSize - 1) / tileSize;
+        tiles.assign((size_t) columns * rows, 0);
+    }
+
+    /**
+     * Brings the image up to date with the given commands, as if a new Turtle had executed them.
+     * @param commands
+     * @param count
+     * @return number of tiles drawn again
+     */
+    size_t render(const turtleCommand *commands, size_t count) {
+        bool floodFill = false;
+        for (size_t i = 0; i < count; i++) {
+            floodFill |= commands[i].op == OP_FLOOD_FILL;
+        }
+
+        // find where every command draws, without drawing anything
+        next.assign(tiles.size(), 0);
+        canvas.setClip(0, 0, -1, -1);
+        start(false);
+        canvas.takeTouched();
+        for (size_t i = 0; i < count; i++) {
+            const turtleCommand &command = commands[i];
+            unsigned long long signature = canvas.hashState();
+            signature = Turtle::hashBytes((const unsigned char *) &command.op, sizeof(command.op), signature);
+            signature = Turtle::hashBytes((const unsigned char *) command.args,
+                                          turtleTraceLayout::of(command.op).operands * sizeof(double), signature);
+            canvas.execute(command);
+            mark(canvas.takeTouched(), signature);
+        }
+        unsigned long long finish = canvas.hashState();
+        canvas.resetClip();     // draws the end of an open stroke
+        mark(canvas.takeTouched(), finish);
+
+        if (!rendered || floodFill || floodFilled) {
+            start(true);
+            canvas.execute(commands, count);
+            canvas.getImage();
+            canvas.takeTouched();
+            tiles.swap(next);
+            rendered = true;
+            floodFilled = floodFill;
+            return tiles.size();
+        }
+
+        // redraw rectangles of changed tiles: runs along each row, extended upwards while they match
+        struct tileRect {
+            int left, bottom, right, top;   // tiles, inclusive
+        };
+        std::vector<tileRect> rects;
+        size_t redrawn = 0;
+        for (int r = 0; r < rows; r++) {
+            const unsigned long long *now = &next[(size_t) r * columns];
+            const unsigned long long *before = &tiles[(size_t) r * columns];
+            for (int c = 0; c < columns; c++) {
+                if (now[c] == before[c]) {
+                    continue;
+                }
+                int first = c;
+                while (c + 1 < columns && now[c + 1] != before[c + 1]) {
+                    c++;
+                }
+                redrawn += (size_t) (c - first + 1);
+
+                auto above = std::find_if(rects.begin(), rects.end(), [first, c, r](const tileRect &rect) {
+                    return rect.left == first && rect.right == c && rect.top == r - 1;
+                });
+                if (above != rects.end()) {
+                    above->top = r;
+                } else {
+                    rects.push_back({first, r, c, r});
+                }
+            }
+        }
+
+        int width = (int) canvas.getWidth();
+        int height = (int) canvas.getHeight();
+        for (const tileRect &rect : rects) {
+            canvas.setClip(rect.left * tileSize - width / 2, rect.bottom * tileSize - height / 2,
+                           std::min((rect.right + 1) * tileSize, width) - 1 - width / 2,
+                           std::min((rect.top + 1) * tileSize, height) - 1 - height / 2);
+            start(true);
+            canvas.execute(commands, count);
+        }
+        canvas.resetClip();
+        canvas.takeTouched();
+        tiles.swap(next);
+        floodFilled = floodFill;
+        return redrawn;
+    }
+
+    size_t render(const turtleDisplayList &list) {
+        return render(list.data(), list.size());
+    }
+
+    /**
+     * Returns the canvas, to save or inspect the image. Drawing on it directly is not tracked.
+     */
+    Turtle &getTurtle() {
+        return canvas;
+    }
+
+    size_t getTileCount() const {
+        return tiles.size();
+    }
+
+private:
+    /**
+     * Puts the turtle in its initial state, like a new Turtle, optionally clearing the clip to white.
+     */
+    void start(bool clear) {
+        canvas.reset();
+        canvas.setFillAntialiasing(false);
+        canvas.setLineAntialiasing(false);
+        if (clear) {
+            canvas.clear();
+        }
+        canvas.backup();
+    }
+
+    /**
+     * Adds a command's signature to the tiles of the given box of image pixels.
+     */
+    void mark(const turtleBounds &box, unsigned long long signature) {
+        if (box.left > box.right) {
+            return;
+        }
+        int width = (int) canvas.getWidth();
+        int height = (int) canvas.getHeight();
+        int left = std::max(box.left + width / 2, 0);
+        int right = std::min(box.right + width / 2, width - 1);
+        int bottom = std::max(box.bottom + height / 2, 0);
+        int top = std::min(box.top + height / 2, height - 1);
+        if (left > right || bottom > top) {
+            return;
+        }
+        for (int r = bottom / tileSize; r <= top / tileSize; r++) {
+            for (int c = left / tileSize; c <= right / tileSize; c++) {
+                unsigned long long &tile = next[(size_t) r * columns + c];
+                tile = Turtle::hashBytes((const unsigned char *) &signature, sizeof(signature), tile);
+            }
+        }
+    }
+};
+
+/**
+ * Draws any region of a display list at any supersampling, running only the commands that draw there.
+ * The display list must outlive the index and not change. Clearing and flood fills reach every region;
+ * a flood fill stops at the border of the region, so regions of drawings with flood fills may differ
+ * from the same part of the whole image.
+ */
+class turtleSpatialIndex {
+    struct indexedPrimitive {
+        turtleBounds box;       // image pixels it may draw
+        size_t command;         // index in the display list (its size for the end of the last stroke)
+        size_t snapshot;        // state it starts from
+    };
+
+    const turtleDisplayList *list = nullptr;
+    std::vector<indexedPrimitive> primitives;
+    std::vector<turtleSnapshot> snapshots;      // the first one is the initial state
+    std::vector<size_t> unbounded;              // primitives checked by every query
+    int cellSize = INDEX_CELL;
+    int gridLeft = 0;                           // image pixel at the corner of cell (0,0)
+    int gridBottom = 0;
+    int columns = 0;
+    int rows = 0;
+    std::vector<size_t> cellStart;              // entries of cell i are cellEntries[cellStart[i] .. cellStart[i + 1])
+    std::vector<size_t> cellEntries;
+    std::unique_ptr<Turtle> region;             // canvas of the last renderRegion() without one
+
+public:
+    explicit turtleSpatialIndex(const turtleDisplayList &displayList) {
+        build(displayList);
+    }
+
+    /**
+     * Indexes a display list, running it once without drawing anything.
+     * @param displayList
+     */
+    void build(const turtleDisplayList &displayList) {
+        list = &displayList;
+        primitives.clear();
+        snapshots.clear();
+        unbounded.clear();
+
+        // a 1x1 canvas with an empty clip finds where commands draw (see Turtle::takeTouched())
+        Turtle scout(1, 1);
+        scout.setFillAntialiasing(false);
+        scout.setLineAntialiasing(false);
+        scout.setClip(0, 0, -1, -1);
+        scout.takeTouched();
+        snapshots.emplace_back();
+        scout.saveState(snapshots.back(), false);
+        unsigned long long savedHash = scout.hashState();
+
+        turtleSnapshot pending;
+        const std::vector<turtleCommand> &commands = displayList.getCommands();
+        for (size_t i = 0; i <= commands.size(); i++) {
+            unsigned long long hash = scout.hashState();
+            bool same = hash == savedHash;
+            bool polygon = i < commands.size() && commands[i].op == OP_END_FILL;
+            if (!same || polygon) {
+                scout.saveState(pending, polygon);
+            }
+            if (i < commands.size()) {
+                scout.execute(commands[i]);
+            } else {
+                scout.resetClip();   // draws the end of an open stroke
+            }
+
+            turtleBounds box = scout.takeTouched();
+            if (i < commands.size() && (commands[i].op == OP_CLEAR || commands[i].op == OP_FLOOD_FILL)) {
+                box = {INT_MIN / 2, INT_MIN / 2, INT_MAX / 2, INT_MAX / 2};
+            }
+            if (box.left > box.right) {
+                continue;
+            }
+            if (!same || polygon) {
+                snapshots.push_back(std::move(pending));
+                savedHash = polygon ? ~hash : hash;    // a polygon snapshot isn't shared
+            }
+            primitives.push_back({box, i, snapshots.size() - 1});
+        }
+        buildGrid();
+    }
+
+    /**
+     * Finds the commands that may draw in the given region of image pixels.
+     * @param x0 corners of the region, inclusive
+     * @param y0
+     * @param x1
+     * @param y1
+     * @param found primitives, in drawing order (output)
+     */
+    void query(int x0, int y0, int x1, int y1, std::vector<size_t> &found) const {
+        found.clear();
+        auto reaches = [x0, y0, x1, y1](const turtleBounds &box) {
+            return box.right >= x0 && box.left <= x1 && box.top >= y0 && box.bottom <= y1;
+        };
+        for (size_t p : unbounded) {
+            if (reaches(primitives[p].box)) found.push_back(p);
+        }
+
+        int firstColumn = std::max(floorDivide(x0 - gridLeft, cellSize), 0);
+        int lastColumn = std::min(floorDivide(x1 - gridLeft, cellSize), columns - 1);
+        int firstRow = std::max(floorDivide(y0 - gridBottom, cellSize), 0);
+        int lastRow = std::min(floorDivide(y1 - gridBottom, cellSize), rows - 1);
+        for (int r = firstRow; r <= lastRow; r++) {
+            for (int c = firstColumn; c <= lastColumn; c++) {
+                size_t cell = (size_t) r * columns + c;
+                for (size_t k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+                    if (reaches(primitives[cellEntries[k]].box)) found.push_back(cellEntries[k]);
+                }
+            }
+        }
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+    }
+
+    /**
+     * Draws the image pixels from (x0,y0) to (x1,y1), inclusive, of the display list on the given canvas,
+     * which must be (x1 - x0 + 1) by (y1 - y0 + 1) pixels. With supersampling, its field shows the region
+     * that many times larger. The result is the same as the region of an image of the whole drawing with
+     * the same supersampling, after setOrigin().
+     * @return number of commands run
+     */
+    size_t renderRegion(int x0, int y0, int x1, int y1, Turtle &canvas) const {
+        int width = x1 - x0 + 1;
+        int height = y1 - y0 + 1;
+        if ((int) canvas.getWidth() != width || (int) canvas.getHeight() != height) {
+            fprintf(stderr, "renderRegion(): the region is %dx%d, the canvas %ux%u\n", width, height,
+                    canvas.getWidth(), canvas.getHeight());
+            exit(EXIT_FAILURE);
+        }
+        canvas.setRecorder(nullptr);
+        canvas.setMeasureMode(false);
+        canvas.setOrigin(x0 + width / 2, y0 + height / 2);
+        canvas.reset();
+        canvas.setFillAntialiasing(false);
+        canvas.setLineAntialiasing(false);
+        canvas.clear();
+        canvas.backup();
+
+        // a pixel of the region may be touched by lines rounded from the neighboring pixel
+        std::vector<size_t> found;
+        query(x0 - 1, y0 - 1, x1 + 1, y1 + 1, found);
+        const std::vector<turtleCommand> &commands = list->getCommands();
+        size_t next = SIZE_MAX;     // command following the last one run
+        for (size_t p : found) {
+            const indexedPrimitive &primitive = primitives[p];
+            // a fill needs all of its vertices, which earlier commands may have added outside the region
+            if (primitive.command != next ||
+                (primitive.command < commands.size() && commands[primitive.command].op == OP_END_FILL)) {
+                canvas.loadState(snapshots[primitive.snapshot]);
+            }
+            if (primitive.command < commands.size()) {
+                canvas.execute(commands[primitive.command]);
+            } else {
+                canvas.getImage();
+            }
+            next = primitive.command + 1;
+        }
+
+        // the rest of an open stroke draws outside the region
+        canvas.loadState(snapshots[0]);
+        return found.size();
+    }
+
+    /**
+     * Version of renderRegion() that draws on a canvas of its own, kept until the next call.
+     * @param scale supersampling
+     */
+    Turtle &renderRegion(int x0, int y0, int x1, int y1, unsigned int scale = 1) {
+        unsigned int width = (unsigned int) (x1 - x0 + 1);
+        unsigned int height = (unsigned int) (y1 - y0 + 1);
+        if (!region || region->getWidth() != width || region->getHeight() != height || region->getScale() != scale) {
+            region.reset(new Turtle(width, height, scale));
+        }
+        renderRegion(x0, y0, x1, y1, *region);
+        return *region;
+    }
+
+    /**
+     * Returns the box of image pixels the display list may draw in.
+     */
+    turtleBounds getBounds() const {
+        turtleBounds bounds{0, 0, -1, -1};
+        for (const indexedPrimitive &primitive : primitives) {
+            const turtleBounds &box = primitive.box;
+            if (box.left == INT_MIN / 2) continue;
+            bounds = bounds.left > bounds.right ? box :
+                     turtleBounds{std::min(bounds.left, box.left), std::min(bounds.bottom, box.bottom),
+                                  std::max(bounds.right, box.right), std::max(bounds.top, box.top)};
+        }
+        return bounds;
+    }
+
+    size_t getPrimitiveCount() const {
+        return primitives.size();
+    }
+
+    size_t getSnapshotCount() const {
+        return snapshots.size();
+    }
+
+private:
+    static int floorDivide(int a, int b) {
+        return a >= 0 ? a / b : -((b - 1 - a) / b);
+    }
+
+    /**
+     * Sorts the boxes into grid cells, doubling the cells until there are at most about four per primitive.
+     */
+    void buildGrid() {
+        turtleBounds bounds = getBounds();
+        columns = 0;
+        rows = 0;
+        cellStart.assign(1, 0);
+        cellEntries.clear();
+        if (bounds.left > bounds.right) {
+            for (size_t p = 0; p < primitives.size(); p++) unbounded.push_back(p);
+            return;
+        }
+
+        long long width = (long long) bounds.right - bounds.left + 1;
+        long long height = (long long) bounds.top - bounds.bottom + 1;
+        cellSize = INDEX_CELL;
+        while (((width + cellSize - 1) / cellSize) * ((height + cellSize - 1) / cellSize) >
+               4 * (long long) primitives.size() + 16) {
+            cellSize *= 2;
+        }
+        gridLeft = bounds.left;
+        gridBottom = bounds.bottom;
+        columns = (int) ((width + cellSize - 1) / cellSize);
+        rows = (int) ((height + cellSize - 1) / cellSize);
+
+        // count, then place the entries of every cell
+        cellStart.assign((size_t) columns * rows + 1, 0);
+        for (int pass = 0; pass < 2; pass++) {
+            std::vector<size_t> next;
+            if (pass == 1) {
+                for (size_t i = 1; i < cellStart.size(); i++) cellStart[i] += cellStart[i - 1];
+                cellEntries.resize(cellStart.back());
+                next.assign(cellStart.begin(), cellStart.end() - 1);
+            }
+            for (size_t p = 0; p < primitives.size(); p++) {
+                const turtleBounds &box = primitives[p].box;
+                int firstColumn = std::max(floorDivide(box.left - gridLeft, cellSize), 0);
+                int lastColumn = std::min(floorDivide(box.right - gridLeft, cellSize), columns - 1);
+                int firstRow = std::max(floorDivide(box.bottom - gridBottom, cellSize), 0);
+                int lastRow = std::min(floorDivide(box.top - gridBottom, cellSize), rows - 1);
+                // clears and flood fills reach beyond the grid, which only spans the bounded boxes
+                if (box.left == INT_MIN / 2 ||
+                    (long long) (lastColumn - firstColumn + 1) * (lastRow - firstRow + 1) > INDEX_MAX_CELLS) {
+                    if (pass == 0) unbounded.push_back(p);
+                    continue;
+                }
+                for (int r = firstRow; r <= lastRow; r++) {
+                    for (int c = firstColumn; c <= lastColumn; c++) {
+                        size_t cell = (size_t) r * columns + c;
+                        if (pass == 0) {
+                            cellStart[cell + 1]++;
+                        } else {
+                            cellEntries[next[cell]++] = p;
+                        }
+                    }
+                }
+            }
+        }
+    }
+};
+
+/**
+ * Canvases of different sizes showing the same display list, such as a thumbnail, a preview and a
+ * full-size image. Each image is exactly what its canvas draws when it executes the list itself, after the
+ * same world transform: either fitted to the drawing, or scaled from the size of the first canvas. Resets in
+ * the list bring back that transform rather than image coordinates.
+ */
+class turtleMultiCanvas {
+    std::vector<std::unique_ptr<Turtle>> canvases;
+    std::vector<turtleCommand> resolved;        // the list, with heading-dependent moves replaced
+    std::vector<size_t> resets;                 // index after every reset() and resetTransform() in resolved
+    bool fixedPoint = false;                    // draw with fixed-point positions?
+    turtleMeasurement measurement{};            // of the list, without a world transform
+
+public:
+    /**
+     * Adds a canvas.
+     * @param width image size in pixels
+     * @param height
+     * @param supersample field pixels per image pixel along each axis
+     * @return index of the canvas
+     */
+    size_t add(unsigned int width, unsigned int height, unsigned int supersample = 1) {
+        canvases.emplace_back(new Turtle(width, height, supersample));
+        return canvases.size() - 1;
+    }
+
+    /**
+     * Switches fixed-point positions (see Turtle::setFixedPoint()) on or off for every canvas, and for the
+     * pass that resolves moves along the heading, so that it reaches the same points as the canvases would.
+     * @param enabled true to keep positions in fixed point
+     */
+    void setFixedPoint(bool enabled) {
+        fixedPoint = enabled;
+    }
+
+    /**
+     * Draws the list on every canvas, each starting from a new turtle on a cleared field. The canvases are
+     * drawn on up to one thread per core, and their parallel work shares the cores (see Turtle::setThreads()).
+     * @param list
+     * @param fit fit the drawing to each image (see Turtle::fitToImage()), leaving padding free around it;
+     *            otherwise world coordinates are scaled by the ratio of each image's width to the first one's,
+     *            which shows the list as drawn on the first canvas
+     * @param padding part of the smaller side of each image kept free around a fitted drawing
+     */
+    void render(const turtleDisplayList &list, bool fit = false, double padding = 1.0 / 32) {
+        resolve(list);
+
+        auto frame = [this, fit, padding](size_t i) {
+            Turtle &canvas = *canvases[i];
+            if (fit) {
+                canvas.fitToImage(measurement, std::min(canvas.getWidth(), canvas.getHeight()) * padding);
+            } else {
+                canvas.resetTransform();
+                if (i > 0) {
+                    canvas.scale((double) canvas.getWidth() / canvases[0]->getWidth());
+                }
+            }
+        };
+        auto draw = [this, &frame](size_t i) {
+            Turtle &canvas = *canvases[i];
+            canvas.reset();
+            canvas.setFixedPoint(fixedPoint);
+            canvas.setFillAntialiasing(false);
+            canvas.setLineAntialiasing(false);
+            canvas.clear();
+            canvas.backup();
+            frame(i);
+            size_t start = 0;
+            for (size_t end : resets) {
+                canvas.execute(resolved.data() + start, end - start);
+                frame(i);
+                start = end;
+            }
+            canvas.execute(resolved.data() + start, resolved.size() - start);
+        };
+
+        // workers take the canvases in order, the largest (usually first) on this thread
+        size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+        size_t workers = std::min(canvases.size(), cores);
+        for (std::unique_ptr<Turtle> &canvas : canvases) {
+            canvas->setThreads((unsigned int) std::max(cores / std::max(workers, (size_t) 1), (size_t) 1));
+        }
+        std::atomic<size_t> next{0};
+        auto work = [this, &draw, &next]() {
+            for (size_t i = next++; i < canvases.size(); i = next++) {
+                draw(i);
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t w = 1; w < workers; w++) {
+            threads.emplace_back(work);
+        }
+        work();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+
+    Turtle &getCanvas(size_t index) {
+        return *canvases[index];
+    }
+
+    size_t getCanvasCount() const {
+        return canvases.size();
+    }
+
+    /**
+     * Returns the commands the canvases execute for the list of the last render().
+     */
+    const std::vector<turtleCommand> &getResolved() const {
+        return resolved;
+    }
+
+private:
+    /**
+     * Runs the list once in measure mode, replacing forward, backward and strafe commands by moves to the
+     * point they reach, and each run of turns by the heading it ends at. As Turtle::forward() itself moves
+     * to the point it computes, in fixed point as well when the scout shares the canvases' mode, the canvases
+     * draw exactly the same lines from the resolved list.
+     */
+    void resolve(const turtleDisplayList &list) {
+        Turtle scout(1, 1);
+        scout.setMeasureMode(true);
+        scout.setFixedPoint(fixedPoint);
+        resolved.clear();
+        resolved.reserve(list.size());
+        resets.clear();
+
+        bool turned = false;    // has the heading changed since the last command copied?
+        for (const turtleCommand &command : list.getCommands()) {
+            double heading = scout.getState().heading;
+            scout.execute(command);
+            const turtleState &turtle = scout.getState();
+            switch (command.op) {
+                case OP_FORWARD:
+                case OP_BACKWARD:
+                case OP_STRAFE_LEFT:
+                case OP_STRAFE_RIGHT:
+                    // strafes turn there and back, which may not give back the exact heading
+                    turned = turned || command.op == OP_STRAFE_LEFT || command.op == OP_STRAFE_RIGHT;
+                    resolved.push_back({OP_GO_TO, {turtle.xpos, turtle.ypos, 0, 0}});
+                    break;
+                case OP_TURN_LEFT:
+                case OP_TURN_RIGHT:
+                case OP_SET_HEADING:
+                    turned = true;
+                    break;
+                case OP_GO_TO:
+                    resolved.push_back(command);
+                    break;
+                default:
+                    if (turned) {
+                        resolved.push_back({OP_SET_HEADING, {heading, 0, 0, 0}});
+                    }
+                    resolved.push_back(command);
+                    turned = false;
+                    if (command.op == OP_RESET || command.op == OP_RESET_TRANSFORM) {
+                        resets.push_back(resolved.size());
+                    }
+                    break;
+            }
+        }
+        if (turned) {
+            resolved.push_back({OP_SET_HEADING, {scout.getState().heading, 0, 0, 0}});
+        }
+        measurement = scout.getMeasurement();
+    }
+};
+
+#endif //TURTLEGRAPHICS_YATG_DISPLAY_HPP
@@ -0,0 +1,90 @@
+/*
+    turtle_render.cpp
+
+    Renders a script in the turtle command language (see turtle_script.hpp) to a BMP file, or, if the
+    output name ends in .svg or .eps, writes it as a vector drawing of the same size (see turtleVectorWriter).
+    With --fit, the script is first run in measure mode and the drawing is scaled to fill the image.
+
+    Usage: TurtleRender [--fit] script image.bmp|image.svg|image.eps [width] [height] [supersample]
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "turtle.hpp"
+#include "turtle_script.hpp"
+
+/**
+ * Checks if a file name ends with the given extension.
+ */
+static bool hasExtension(const char *filename, const char *extension) {
+    size_t length = strlen(filename);
+    size_t suffix = strlen(extension);
+    return length >= suffix && strcmp(filename + length - suffix, extension) == 0;
+}
+
+int main(int argc, char **argv) {
+    bool fit = argc > 1 && strcmp(argv[1], "--fit") == 0;
+    if (fit) {
+        argc--;
+        argv++;
+    }
+    if (argc < 3) {
+        fprintf(stderr, "Usage: TurtleRender [--fit] script image.bmp|image.svg|image.eps [width] [height] [supersample]\n");
+        return EXIT_FAILURE;
+    }
+
+    unsigned int width = argc > 3 ? (unsigned int) atoi(argv[3]) : 900;
+    unsigned int height = argc > 4 ? (unsigned int) atoi(argv[4]) : width;
+    unsigned int supersample = argc > 5 ? (unsigned int) atoi(argv[5]) : 1;
+    if (width == 0 || height == 0) {
+        fprintf(stderr, "Image size must be positive.\n");
+        return EXIT_FAILURE;
+    }
+
+    turtleScript script;
+    if (!script.load(argv[1])) {
+        fprintf(stderr, "%s\n", script.getError());
+        return EXIT_FAILURE;
+    }
+
+    bool svg = hasExtension(argv[2], ".svg");
+    bool vector = svg || hasExtension(argv[2], ".eps");
+    Turtle turtle(width, height, vector ? 1 : supersample);
+    if (fit) {
+        Turtle measure(1, 1);
+        measure.setMeasureMode(true);
+        if (!script.run(measure)) {
+            fprintf(stderr, "%s\n", script.getError());
+            return EXIT_FAILURE;
+        }
+        turtle.fitToImage(measure.getMeasurement(), (width < height ? width : height) / 32.0);
+    }
+
+    if (vector) {
+        turtleVectorWriter drawing(argv[2], svg ? VECTOR_SVG : VECTOR_EPS, width, height);
+        turtle.setVectorOutput(&drawing);
+        if (!script.run(turtle)) {
+            fprintf(stderr, "%s\n", script.getError());
+            return EXIT_FAILURE;
+        }
+        turtle.setVectorOutput(nullptr);
+        if (drawing.getSkipped() > 0) {
+            fprintf(stderr, "%llu flood fills left out of %s\n", drawing.getSkipped(), argv[2]);
+        }
+        return 0;
+    }
+
+    if (!script.run(turtle)) {
+        fprintf(stderr, "%s\n", script.getError());
+        return EXIT_FAILURE;
+    }
+    turtle.saveBMP(argv[2]);
+    return 0;
+}
@@ -0,0 +1,857 @@
+/*
+    turtle_script.hpp
+
+    Small Logo-like command language for turtle.hpp.
+    Scripts are compiled to a compact bytecode and run by an interpreter that drives a Turtle
+    through turtle commands (see turtleOpcode).
+
+    Example:
+        to square :size
+            repeat 4 [ forward :size right 90 ]
+        end
+        pencolor 200 30 30
+        repeat 36 [ square 10 + repcount * 4 right 10 ]
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TURTLEGRAPHICS_YATG_SCRIPT_HPP
+#define TURTLEGRAPHICS_YATG_SCRIPT_HPP
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "turtle.hpp"
+
+#define SCRIPT_MAX_CALL_DEPTH 4096  // most procedure calls that can be active at once
+#define SCRIPT_MAX_NESTING 256      // most brackets and parentheses that can be open at once
+#define SCRIPT_MAX_OPERAND 0xFFFFFF // largest operand of an instruction (24 bits)
+
+/**
+ * Instructions of compiled scripts. Each instruction is a 32-bit word: the bytecode in the low 8 bits
+ * and its operand in the high 24 bits. Values live on a stack of doubles.
+ */
+enum scriptBytecode {
+    BC_PUSH_CONST,      // operand: constant index; pushes the constant
+    BC_PUSH_ARG,        // operand: parameter index; pushes a parameter of the running procedure
+    BC_PUSH_REPCOUNT,   // pushes the iteration (from 1) of the innermost repeat
+    BC_ADD,             // pops two values, pushes their sum
+    BC_SUB,
+    BC_MUL,
+    BC_DIV,
+    BC_LESS,            // pops two values, pushes 1 if the first is less than the second, 0 otherwise
+    BC_GREATER,
+    BC_EQUAL,
+    BC_NEGATE,          // negates the top value
+    BC_COMMAND,         // operand: opcode | arity << 8; pops arity values and executes them as a command
+    BC_COMMAND_CONST,   // operand: command index; executes a command whose operands are constants
+    BC_COMMAND_ARG,     // operand: opcode | parameter index << 8; executes a command whose one operand is a parameter
+    BC_REPEAT,          // operand: exit address; pops a count and starts a loop, or skips it if below 1
+    BC_REPEAT_END,      // operand: body address; starts the next iteration, or ends the loop
+    BC_JUMP,            // operand: address
+    BC_JUMP_IF_FALSE,   // operand: address; pops a value and jumps if it is 0
+    BC_CALL,            // operand: procedure index; its arguments are on the stack
+    BC_RETURN,          // returns from a procedure, dropping its arguments
+    BC_HALT             // ends the script
+};
+
+/**
+ * Program in the turtle command language, compiled from source with compile() or load()
+ * and executed with run().
+ *
+ * Scripts are sequences of commands. Words are case-insensitive, and ';' or '#' start a comment.
+ * Every command takes a fixed number of inputs, each an expression built from numbers, procedure
+ * parameters (:name), repcount (the iteration of the innermost repeat, from 1), parentheses,
+ * + - * / and the comparisons < > = (1 if true, 0 if false). A '-' written right before a value
+ * and after a space negates it, so "goto 10 -20" takes two inputs while "forward :a - 1" takes one.
+ *
+ * Drawing commands:
+ *   forward (fd), back (bk, backward), strafeleft, straferight, left (lt), right (rt),
+ *   setheading (seth), goto (setxy) x y, penup (pu), pendown (pd), pencolor r g b, fillcolor r g b,
+ *   beginfill, endfill, closecontour, dot, pixel x y, line x0 y0 x1 y1, circle x y r, fillcircle x y r,
+ *   floodfill x y, drawturtle, number n, backup, restore, reset, fillrule n, fillantialias n,
+ *   lineantialias n, penwidth (setpensize) w, linejoin n, linecap n, push (pushtransform),
+ *   pop (poptransform), translate dx dy, rotate angle, scale sx sy, resettransform, clear r g b
+ *   (enumerations take the numeric values of turtleFillRule, turtleLineJoin and turtleLineCap).
+ *
+ * Control:
+ *   repeat count [ commands ]
+ *   if condition [ commands ]
+ *   ifelse condition [ commands ] [ commands ]
+ *   stop                          leaves the running procedure, or the script at the top level
+ *   to name :param1 :param2 ...   defines a procedure, used like a command; procedures can be
+ *     commands                    called before their definition and may call themselves
+ *   end
+ */
+class turtleScript {
+    enum scriptTokenType {
+        TOKEN_WORD,         // command, keyword or procedure name (lower case)
+        TOKEN_NUMBER,
+        TOKEN_PARAMETER,    // :name (without the colon, lower case)
+        TOKEN_OPERATOR,     // + - * / < > = (in text)
+        TOKEN_NEGATE,       // '-' directly before a value
+        TOKEN_OPEN_BLOCK,
+        TOKEN_CLOSE_BLOCK,
+        TOKEN_OPEN_PAREN,
+        TOKEN_CLOSE_PAREN,
+        TOKEN_END           // end of the source
+    };
+
+    struct scriptToken {
+        scriptTokenType type;
+        std::string text;
+        double number;
+        int line;
+    };
+
+    struct scriptBuiltin {
+        const char *name;
+        turtleOpcode op;
+        int arity;
+    };
+
+    struct scriptProcedure {
+        std::string name;
+        std::vector<std::string> parameters;
+        uint32_t entry;     // address of the first instruction
+    };
+
+    struct scriptLoop {
+        long long count;    // iterations of the loop
+        long long index;    // current iteration, from 1
+    };
+
+    struct scriptFrame {
+        const uint32_t *returnAddress;
+        double *arguments;  // parameters of the caller
+        scriptLoop *loop;   // loops of the caller
+    };
+
+    std::string name;                       // name of the script in messages
+    std::string error;                      // last compilation or run error
+
+    std::vector<uint32_t> code;             // compiled instructions
+    std::vector<double> constants;          // operands of BC_PUSH_CONST
+    std::vector<turtleCommand> commands;    // operands of BC_COMMAND_CONST
+    std::vector<scriptProcedure> procedures;
+    int maxStack = 0;                       // most values one procedure (or the top level) keeps on the stack
+    int maxLoops = 0;                       // most loops one procedure (or the top level) nests
+
+    std::vector<double> valueStack;         // run() state, kept between runs
+    std::vector<scriptLoop> loopStack;
+    std::vector<scriptFrame> frameStack;
+
+    // compiler state
+    std::vector<scriptToken> tokens;
+    size_t position = 0;                    // next token
+    int procedure = -1;                     // procedure being compiled, or -1 at the top level
+    int stack = 0;                          // values on the stack of the code being compiled
+    int loops = 0;                          // open loops of the procedure being compiled
+    int nesting = 0;                        // open brackets and parentheses
+    size_t statementStart = 0;              // first instruction of the current statement
+
+public:
+    turtleScript() {
+        clear();
+    }
+
+    /**
+     * Compiles a script, replacing the previous one.
+     * @param source text of the script
+     * @param scriptName name of the script in error messages
+     * @return false if the script has errors (see getError()); the script is then empty
+     */
+    bool compile(const char *source, const char *scriptName = "script") {
+        clear();
+        code.clear();
+        name = scriptName;
+        error.clear();
+
+        bool compiled = tokenize(source) && declareProcedures();
+        while (compiled && tokens[position].type != TOKEN_END) {
+            compiled = statement();
+        }
+        if (compiled && code.size() >= SCRIPT_MAX_OPERAND) {
+            compiled = fail("script is too long");
+        }
+        tokens.clear();
+
+        if (!compiled) {
+            std::string message = error;
+            clear();
+            error = message;
+            return false;
+        }
+        emit(BC_HALT, 0, 0);
+        return true;
+    }
+
+    /**
+     * Reads and compiles a script file.
+     * @param filename
+     * @return false if the file can't be read or the script has errors (see getError())
+     */
+    bool load(const char *filename) {
+        FILE *file = fopen(filename, "rb");
+        if (file == nullptr) {
+            clear();
+            error = std::string("Can't open ") + filename;
+            return false;
+        }
+        std::string source;
+        char buffer[65536];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            source.append(buffer, count);
+        }
+        fclose(file);
+        return compile(source.c_str(), filename);
+    }
+
+    /**
+     * Describes the last error of compile(), load() or run(), as "name:line: message".
+     */
+    const char *getError() const {
+        return error.c_str();
+    }
+
+    /**
+     * Returns the size of the compiled bytecode in bytes, including constants and constant commands.
+     */
+    size_t getCodeSize() const {
+        return code.size() * sizeof(uint32_t) + constants.size() * sizeof(double) +
+               commands.size() * sizeof(turtleCommand);
+    }
+
+    /**
+     * Runs the compiled script on a turtle, from its current state.
+     * @param turtle
+     * @return false if procedure calls nest deeper than SCRIPT_MAX_CALL_DEPTH or a pop has no matching push
+     *         (see getError()); the commands before that are carried out
+     */
+    bool run(Turtle &turtle) {
+        // every active procedure keeps at most maxStack values and maxLoops loops
+        valueStack.resize((size_t) (SCRIPT_MAX_CALL_DEPTH + 1) * (maxStack + 1));
+        loopStack.resize((size_t) (SCRIPT_MAX_CALL_DEPTH + 1) * (maxLoops + 1));
+        frameStack.resize(SCRIPT_MAX_CALL_DEPTH);
+
+        const uint32_t *program = code.data();
+        const double *constant = constants.data();
+        const turtleCommand *command = commands.data();
+        const scriptProcedure *callee = procedures.data();
+        const uint32_t *pc = program;
+        double *sp = valueStack.data();
+        double *arguments = sp;
+        scriptLoop *loop = loopStack.data();
+        scriptFrame *frame = frameStack.data();
+        scriptFrame *frameEnd = frame + SCRIPT_MAX_CALL_DEPTH;
+
+        for (;;) {
+            uint32_t instruction = *pc++;
+            uint32_t operand = instruction >> 8;
+
+            switch ((scriptBytecode) (instruction & 0xFF)) {
+                case BC_PUSH_CONST:     *sp++ = constant[operand]; break;
+                case BC_PUSH_ARG:       *sp++ = arguments[operand]; break;
+                case BC_PUSH_REPCOUNT:  *sp++ = (double) loop[-1].index; break;
+                case BC_ADD:            sp--; sp[-1] += sp[0]; break;
+                case BC_SUB:            sp--; sp[-1] -= sp[0]; break;
+                case BC_MUL:            sp--; sp[-1] *= sp[0]; break;
+                case BC_DIV:            sp--; sp[-1] /= sp[0]; break;
+                case BC_LESS:           sp--; sp[-1] = sp[-1] < sp[0] ? 1 : 0; break;
+                case BC_GREATER:        sp--; sp[-1] = sp[-1] > sp[0] ? 1 : 0; break;
+                case BC_EQUAL:          sp--; sp[-1] = sp[-1] == sp[0] ? 1 : 0; break;
+                case BC_NEGATE:         sp[-1] = -sp[-1]; break;
+
+                case BC_COMMAND: {
+                    turtleCommand dynamic{};
+                    int arity = (int) (operand >> 8);
+                    dynamic.op = (turtleOpcode) (operand & 0xFF);
+                    sp -= arity;
+                    for (int i = 0; i < arity; i++) {
+                        dynamic.args[i] = sp[i];
+                    }
+                    if (dynamic.op == OP_POP_TRANSFORM && turtle.getTransformDepth() == 0) {
+                        return unmatchedPop();
+                    }
+                    turtle.execute(dynamic);
+                    break;
+                }
+
+                case BC_COMMAND_CONST:
+                    // the turtle exits on a pop without a push; a script error only stops the script
+                    if (command[operand].op == OP_POP_TRANSFORM && turtle.getTransformDepth() == 0) {
+                        return unmatchedPop();
+                    }
+                    turtle.execute(command[operand]);
+                    break;
+
+                case BC_COMMAND_ARG: {
+                    turtleCommand dynamic{};
+                    dynamic.op = (turtleOpcode) (operand & 0xFF);
+                    dynamic.args[0] = arguments[operand >> 8];
+                    turtle.execute(dynamic);
+                    break;
+                }
+
+                case BC_REPEAT: {
+                    double count = *--sp;
+                    if (!(count >= 1)) {
+                        pc = program + operand;
+                        break;
+                    }
+                    loop->count = count < 9e18 ? (long long) count : (long long) 9e18;
+                    loop->index = 1;
+                    loop++;
+                    break;
+                }
+
+                case BC_REPEAT_END:
+                    if (loop[-1].index < loop[-1].count) {
+                        loop[-1].index++;
+                        pc = program + operand;
+                    } else {
+                        loop--;
+                    }
+                    break;
+
+                case BC_JUMP:
+                    pc = program + operand;
+                    break;
+
+                case BC_JUMP_IF_FALSE:
+                    if (*--sp == 0) pc = program + operand;
+                    break;
+
+                case BC_CALL:
+                    if (frame == frameEnd) {
+                        error = name + ": procedure calls nested deeper than " +
+                                std::to_string(SCRIPT_MAX_CALL_DEPTH) + " levels in " + callee[operand].name;
+                        return false;
+                    }
+                    frame->returnAddress = pc;
+                    frame->arguments = arguments;
+                    frame->loop = loop;
+                    frame++;
+                    arguments = sp - callee[operand].parameters.size();
+                    pc = program + callee[operand].entry;
+                    break;
+
+                case BC_RETURN:
+                    frame--;
+                    sp = arguments;
+                    arguments = frame->arguments;
+                    loop = frame->loop;
+                    pc = frame->returnAddress;
+                    break;
+
+                case BC_HALT:
+                    return true;
+            }
+        }
+    }
+
+private:
+    /**
+     * Records the run error of a pop without a matching push.
+     * @return false
+     */
+    bool unmatchedPop() {
+        error = name + ": pop without a matching push";
+        return false;
+    }
+
+    /**
+     * Empties the script; running it does nothing.
+     */
+    void clear() {
+        code.clear();
+        constants.clear();
+        commands.clear();
+        procedures.clear();
+        tokens.clear();
+        maxStack = 0;
+        maxLoops = 0;
+        position = 0;
+        procedure = -1;
+        stack = 0;
+        loops = 0;
+        nesting = 0;
+        statementStart = 0;
+        code.push_back(BC_HALT);
+    }
+
+    /**
+     * Records a compilation error at the current token.
+     * @return false
+     */
+    bool fail(const std::string &message) {
+        int line = tokens.empty() ? 1 : tokens[std::min(position, tokens.size() - 1)].line;
+        return failAt(line, message);
+    }
+
+    bool failAt(int line, const std::string &message) {
+        error = name + ":" + std::to_string(line) + ": " + message;
+        return false;
+    }
+
+    /**
+     * Returns the built-in command with the given name, or nullptr.
+     */
+    static const scriptBuiltin *builtin(const std::string &word) {
+        static const scriptBuiltin BUILTINS[] = {
+                {"forward", OP_FORWARD, 1}, {"fd", OP_FORWARD, 1},
+                {"back", OP_BACKWARD, 1}, {"bk", OP_BACKWARD, 1}, {"backward", OP_BACKWARD, 1},
+                {"strafeleft", OP_STRAFE_LEFT, 1}, {"straferight", OP_STRAFE_RIGHT, 1},
+                {"left", OP_TURN_LEFT, 1}, {"lt", OP_TURN_LEFT, 1},
+                {"right", OP_TURN_RIGHT, 1}, {"rt", OP_TURN_RIGHT, 1},
+                {"setheading", OP_SET_HEADING, 1}, {"seth", OP_SET_HEADING, 1},
+                {"goto", OP_GO_TO, 2}, {"setxy", OP_GO_TO, 2},
+                {"penup", OP_PEN_UP, 0}, {"pu", OP_PEN_UP, 0},
+                {"pendown", OP_PEN_DOWN, 0}, {"pd", OP_PEN_DOWN, 0},
+                {"pencolor", OP_SET_PEN_COLOR, 3}, {"fillcolor", OP_SET_FILL_COLOR, 3},
+                {"beginfill", OP_BEGIN_FILL, 0}, {"endfill", OP_END_FILL, 0},
+                {"closecontour", OP_CLOSE_CONTOUR, 0}, {"dot", OP_DOT, 0},
+                {"pixel", OP_DRAW_PIXEL, 2}, {"line", OP_DRAW_LINE, 4},
+                {"circle", OP_DRAW_CIRCLE, 3}, {"fillcircle", OP_FILL_CIRCLE, 3},
+                {"floodfill", OP_FLOOD_FILL, 2}, {"drawturtle", OP_DRAW_TURTLE, 0},
+                {"number", OP_DRAW_INT, 1},
+                {"backup", OP_BACKUP, 0}, {"restore", OP_RESTORE, 0}, {"reset", OP_RESET, 0},
+                {"fillrule", OP_SET_FILL_RULE, 1},
+                {"fillantialias", OP_SET_FILL_ANTIALIASING, 1}, {"lineantialias", OP_SET_LINE_ANTIALIASING, 1},
+                {"penwidth", OP_SET_PEN_WIDTH, 1}, {"setpensize", OP_SET_PEN_WIDTH, 1},
+                {"linejoin", OP_SET_LINE_JOIN, 1}, {"linecap", OP_SET_LINE_CAP, 1},
+                {"push", OP_PUSH_TRANSFORM, 0}, {"pushtransform", OP_PUSH_TRANSFORM, 0},
+                {"pop", OP_POP_TRANSFORM, 0}, {"poptransform", OP_POP_TRANSFORM, 0},
+                {"translate", OP_TRANSLATE, 2}, {"rotate", OP_ROTATE, 1}, {"scale", OP_SCALE, 2},
+                {"resettransform", OP_RESET_TRANSFORM, 0}, {"clear", OP_CLEAR, 3}
+        };
+
+        for (const scriptBuiltin &entry : BUILTINS) {
+            if (word == entry.name) return &entry;
+        }
+        return nullptr;
+    }
+
+    static bool isKeyword(const std::string &word) {
+        return word == "to" || word == "end" || word == "repeat" || word == "if" || word == "ifelse" ||
+               word == "stop" || word == "repcount";
+    }
+
+    int findProcedure(const std::string &word) const {
+        for (size_t i = 0; i < procedures.size(); i++) {
+            if (procedures[i].name == word) return (int) i;
+        }
+        return -1;
+    }
+
+    static bool isWordChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               c == '_' || c == '.' || c == '?';
+    }
+
+    /**
+     * Splits the source into tokens.
+     */
+    bool tokenize(const char *source) {
+        int line = 1;
+        const char *p = source;
+        while (*p != '\0') {
+            char c = *p;
+            if (c == '\n') {
+                line++;
+                p++;
+            } else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v') {
+                p++;
+            } else if (c == ';' || c == '#') {
+                while (*p != '\0' && *p != '\n') p++;
+            } else if ((c >= '0' && c <= '9') || (c == '.' && p[1] >= '0' && p[1] <= '9')) {
+                char *end;
+                double value = strtod(p, &end);
+                if (isWordChar(*end)) {
+                    while (isWordChar(*end)) end++;
+                    return failAt(line, "bad number " + std::string(p, (const char *) end));
+                }
+                tokens.push_back({TOKEN_NUMBER, std::string(), value, line});
+                p = end;
+            } else if (c == ':' || isWordChar(c)) {
+                const char *start = c == ':' ? p + 1 : p;
+                const char *end = start;
+                while (isWordChar(*end)) end++;
+                if (end == start) {
+                    return failAt(line, "':' must be followed by a parameter name");
+                }
+                std::string word(start, end);
+                for (char &letter : word) {
+                    if (letter >= 'A' && letter <= 'Z') letter = (char) (letter - 'A' + 'a');
+                }
+                tokens.push_back({c == ':' ? TOKEN_PARAMETER : TOKEN_WORD, word, 0, line});
+                p = end;
+            } else if (c == '-' && (p == source || strchr(" \t\r\n[(", p[-1]) != nullptr) &&
+                       p[1] != '\0' && strchr(" \t\r\n", p[1]) == nullptr) {
+                tokens.push_back({TOKEN_NEGATE, "-", 0, line});
+                p++;
+            } else if (strchr("+-*/<>=", c) != nullptr) {
+                tokens.push_back({TOKEN_OPERATOR, std::string(1, c), 0, line});
+                p++;
+            } else if (c == '[' || c == ']' || c == '(' || c == ')') {
+                scriptTokenType type = c == '[' ? TOKEN_OPEN_BLOCK : c == ']' ? TOKEN_CLOSE_BLOCK :
+                                       c == '(' ? TOKEN_OPEN_PAREN : TOKEN_CLOSE_PAREN;
+                tokens.push_back({type, std::string(1, c), 0, line});
+                p++;
+            } else {
+                return failAt(line, std::string("unexpected character '") + c + "'");
+            }
+        }
+        tokens.push_back({TOKEN_END, std::string(), 0, line});
+        return true;
+    }
+
+    /**
+     * Finds the procedure definitions, so procedures can be called before they are defined.
+     * The parameters of a procedure are the parameter names on the line of its "to".
+     */
+    bool declareProcedures() {
+        for (size_t i = 0; i < tokens.size(); i++) {
+            if (tokens[i].type != TOKEN_WORD || tokens[i].text != "to") continue;
+
+            const scriptToken &title = tokens[i + 1];
+            if (title.type != TOKEN_WORD) {
+                return failAt(tokens[i].line, "\"to\" must be followed by a procedure name");
+            }
+            if (builtin(title.text) != nullptr || isKeyword(title.text)) {
+                return failAt(title.line, "can't redefine " + title.text);
+            }
+            if (findProcedure(title.text) >= 0) {
+                return failAt(title.line, title.text + " is already defined");
+            }
+
+            scriptProcedure declared;
+            declared.name = title.text;
+            declared.entry = 0;
+            for (size_t k = i + 2; tokens[k].type == TOKEN_PARAMETER && tokens[k].line == title.line; k++) {
+                declared.parameters.push_back(tokens[k].text);
+            }
+            procedures.push_back(declared);
+        }
+        return true;
+    }
+
+    /**
+     * Appends an instruction.
+     * @param stackEffect number of values the instruction pushes minus the number it pops
+     */
+    void emit(scriptBytecode bytecode, uint32_t operand, int stackEffect) {
+        code.push_back((uint32_t) bytecode | operand << 8);
+        stack += stackEffect;
+        if (stack > maxStack) maxStack = stack;
+    }
+
+    void patch(size_t address, uint32_t operand) {
+        code[address] = (code[address] & 0xFF) | operand << 8;
+    }
+
+    uint32_t here() const {
+        return (uint32_t) code.size();
+    }
+
+    static scriptBytecode bytecodeOf(uint32_t instruction) {
+        return (scriptBytecode) (instruction & 0xFF);
+    }
+
+    /**
+     * Returns true if the last count instructions of the current statement push constants.
+     */
+    bool constantsOnTop(size_t count) const {
+        if (code.size() < statementStart + count) return false;
+        for (size_t i = code.size() - count; i < code.size(); i++) {
+            if (bytecodeOf(code[i]) != BC_PUSH_CONST) return false;
+        }
+        return true;
+    }
+
+    /**
+     * Removes the last count instructions, which push the last count constants, and returns the constants.
+     */
+    void popConstants(size_t count, double *values) {
+        for (size_t i = 0; i < count; i++) {
+            values[i] = constants[constants.size() - count + i];
+        }
+        code.resize(code.size() - count);
+        constants.resize(constants.size() - count);
+        stack -= (int) count;
+    }
+
+    bool pushConstant(double value) {
+        if (constants.size() >= SCRIPT_MAX_OPERAND) {
+            return fail("too many constants");
+        }
+        emit(BC_PUSH_CONST, (uint32_t) constants.size(), 1);
+        constants.push_back(value);
+        return true;
+    }
+
+    /**
+     * Compiles one command, including any block it takes.
+     */
+    bool statement() {
+        const scriptToken &token = tokens[position];
+        if (token.type != TOKEN_WORD) {
+            return fail(token.type == TOKEN_CLOSE_BLOCK ? "unexpected ]" : "expected a command");
+        }
+        statementStart = code.size();
+        position++;
+
+        if (token.text == "to") {
+            return define();
+        }
+        if (token.text == "end") {
+            return fail("\"end\" without \"to\"");
+        }
+        if (token.text == "repeat") {
+            if (!expression(1)) return false;
+            size_t start = here();
+            emit(BC_REPEAT, 0, -1);
+            loops++;
+            if (loops > maxLoops) maxLoops = loops;
+            if (!block()) return false;
+            loops--;
+            emit(BC_REPEAT_END, (uint32_t) start + 1, 0);
+            patch(start, here());
+            return true;
+        }
+        if (token.text == "if" || token.text == "ifelse") {
+            if (!expression(1)) return false;
+            size_t test = here();
+            emit(BC_JUMP_IF_FALSE, 0, -1);
+            if (!block()) return false;
+            if (token.text == "if") {
+                patch(test, here());
+                return true;
+            }
+            size_t skip = here();
+            emit(BC_JUMP, 0, 0);
+            patch(test, here());
+            if (!block()) return false;
+            patch(skip, here());
+            return true;
+        }
+        if (token.text == "stop") {
+            emit(procedure >= 0 ? BC_RETURN : BC_HALT, 0, 0);
+            return true;
+        }
+
+        const scriptBuiltin *command = builtin(token.text);
+        if (command != nullptr) {
+            int operands = command->arity;
+            for (int i = 0; i < command->arity; i++) {
+                if (!expression(1)) return false;
+            }
+            // "number n" draws at scale 1 (a recorded scale of 0 draws nothing)
+            if (command->op == OP_DRAW_INT) {
+                if (!pushConstant(1)) return false;
+                operands++;
+            }
+            // commands with constant operands are prebuilt
+            if (constantsOnTop((size_t) operands) && commands.size() < SCRIPT_MAX_OPERAND) {
+                turtleCommand prebuilt{};
+                prebuilt.op = command->op;
+                popConstants((size_t) operands, prebuilt.args);
+                emit(BC_COMMAND_CONST, (uint32_t) commands.size(), 0);
+                commands.push_back(prebuilt);
+            } else if (operands == 1 && bytecodeOf(code.back()) == BC_PUSH_ARG &&
+                       code.size() == statementStart + 1) {
+                uint32_t parameter = code.back() >> 8;
+                code.pop_back();
+                stack--;
+                emit(BC_COMMAND_ARG, (uint32_t) command->op | parameter << 8, 0);
+            } else {
+                emit(BC_COMMAND, (uint32_t) command->op | (uint32_t) operands << 8, -operands);
+            }
+            return true;
+        }
+
+        int called = findProcedure(token.text);
+        if (called >= 0) {
+            int parameters = (int) procedures[called].parameters.size();
+            for (int i = 0; i < parameters; i++) {
+                if (!expression(1)) return false;
+            }
+            emit(BC_CALL, (uint32_t) called, -parameters);
+            return true;
+        }
+
+        position--;
+        return fail("I don't know how to " + token.text);
+    }
+
+    /**
+     * Compiles a procedure definition; "to" has been read.
+     */
+    bool define() {
+        if (procedure >= 0 || nesting > 0) {
+            return fail("procedures can only be defined at the top level");
+        }
+        procedure = findProcedure(tokens[position].text);
+        position += 1 + procedures[procedure].parameters.size();
+
+        size_t skip = here();
+        emit(BC_JUMP, 0, 0);
+        procedures[procedure].entry = here();
+        while (!(tokens[position].type == TOKEN_WORD && tokens[position].text == "end")) {
+            if (tokens[position].type == TOKEN_END) {
+                return fail("missing \"end\" of " + procedures[procedure].name);
+            }
+            if (!statement()) return false;
+        }
+        position++;
+        emit(BC_RETURN, 0, 0);
+        patch(skip, here());
+        procedure = -1;
+        return true;
+    }
+
+    /**
+     * Compiles a list of commands in brackets.
+     */
+    bool block() {
+        if (tokens[position].type != TOKEN_OPEN_BLOCK) {
+            return fail("expected [");
+        }
+        if (++nesting > SCRIPT_MAX_NESTING) {
+            return fail("brackets nested too deeply");
+        }
+        position++;
+        while (tokens[position].type != TOKEN_CLOSE_BLOCK) {
+            if (tokens[position].type == TOKEN_END) {
+                return fail("missing ]");
+            }
+            if (!statement()) return false;
+        }
+        position++;
+        nesting--;
+        return true;
+    }
+
+    static int precedence(const std::string &op) {
+        switch (op[0]) {
+            case '<': case '>': case '=': return 1;
+            case '+': case '-': return 2;
+            default: return 3;
+        }
+    }
+
+    /**
+     * Compiles an expression whose binary operators have at least the given precedence.
+     * Operations on constants are folded.
+     */
+    bool expression(int minimum) {
+        if (!unary()) return false;
+        while (tokens[position].type == TOKEN_OPERATOR && precedence(tokens[position].text) >= minimum) {
+            char op = tokens[position].text[0];
+            int level = precedence(tokens[position].text);
+            position++;
+            if (!expression(level + 1)) return false;
+
+            if (constantsOnTop(2)) {
+                double values[2];
+                popConstants(2, values);
+                double a = values[0];
+                double b = values[1];
+                double result = op == '+' ? a + b : op == '-' ? a - b : op == '*' ? a * b : op == '/' ? a / b :
+                                op == '<' ? (a < b ? 1 : 0) : op == '>' ? (a > b ? 1 : 0) : (a == b ? 1 : 0);
+                if (!pushConstant(result)) return false;
+                continue;
+            }
+            scriptBytecode bytecode = op == '+' ? BC_ADD : op == '-' ? BC_SUB : op == '*' ? BC_MUL :
+                                      op == '/' ? BC_DIV : op == '<' ? BC_LESS : op == '>' ? BC_GREATER : BC_EQUAL;
+            emit(bytecode, 0, -1);
+        }
+        return true;
+    }
+
+    bool unary() {
+        if (tokens[position].type != TOKEN_NEGATE) {
+            return primary();
+        }
+        position++;
+        if (!unary()) return false;
+        if (constantsOnTop(1)) {
+            constants.back() = -constants.back();
+        } else {
+            emit(BC_NEGATE, 0, 0);
+        }
+        return true;
+    }
+
+    bool primary() {
+        const scriptToken &token = tokens[position];
+        switch (token.type) {
+            case TOKEN_NUMBER:
+                position++;
+                return pushConstant(token.number);
+
+            case TOKEN_PARAMETER: {
+                if (procedure >= 0) {
+                    const std::vector<std::string> &parameters = procedures[procedure].parameters;
+                    for (size_t i = 0; i < parameters.size(); i++) {
+                        if (parameters[i] == token.text) {
+                            position++;
+                            emit(BC_PUSH_ARG, (uint32_t) i, 1);
+                            return true;
+                        }
+                    }
+                }
+                return fail(":" + token.text + " has no value here");
+            }
+
+            case TOKEN_OPEN_PAREN:
+                if (++nesting > SCRIPT_MAX_NESTING) {
+                    return fail("parentheses nested too deeply");
+                }
+                position++;
+                if (!expression(1)) return false;
+                if (tokens[position].type != TOKEN_CLOSE_PAREN) {
+                    return fail("expected )");
+                }
+                position++;
+                nesting--;
+                return true;
+
+            case TOKEN_WORD:
+                if (token.text == "repcount") {
+                    if (loops == 0) {
+                        return fail("repcount outside of repeat");
+                    }
+                    position++;
+                    emit(BC_PUSH_REPCOUNT, 0, 1);
+                    return true;
+                }
+                return fail("expected a value, found " + token.text);
+
+            case TOKEN_END:
+                return fail("expected a value at the end of the script");
+
+            default:
+                return fail("expected a value, found " + token.text);
+        }
+    }
+};
+
+#endif //TURTLEGRAPHICS_YATG_SCRIPT_HPP
@@ -0,0 +1,321 @@
+/*
+    turtle_server.cpp
+
+    Long-running render server. Accepts render requests (see turtle_service.hpp) over a Unix domain
+    socket and answers with the encoded image, or saves it and answers with its path.
+
+    The listening socket belongs to a supervisor process, which runs the renderer in a child process
+    and starts a new one if it dies. turtle.hpp ends the process on fatal errors, such as a corrupt
+    trace, so a bad request costs the connections open at the time and the warm state, not the service.
+    The renderer serves connections on a fixed set of threads; each thread keeps its own pool of
+    canvases and compiled scripts between requests. With --cache, the renderer threads share an
+    on-disk cache of encoded images (see turtleRenderCache), and a stats request reports its hit rate.
+
+    Usage: TurtleServer [--cache directory [--cache-size megabytes]] socket [threads]
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "turtle.hpp"
+#include "turtle_script.hpp"
+#include "turtle_service.hpp"
+
+#define SERVER_SCRIPTS 64   // compiled scripts a thread keeps
+#define SERVER_CACHE_MB 1024    // default size limit of the cache
+
+static volatile sig_atomic_t stopRequested = 0;
+static volatile pid_t renderer = 0;
+static turtleRenderCache *cache = nullptr;
+static std::atomic<unsigned long long> requestCount{0};
+
+static void requestStop(int) {
+    stopRequested = 1;
+    if (renderer > 0) {
+        kill(renderer, SIGTERM);
+    }
+}
+
+/**
+ * State a render thread keeps between requests.
+ */
+struct renderThread {
+    turtleCanvasPool canvases;
+    std::map<std::string, turtleScript> scripts;    // compiled scripts by source text
+    std::vector<unsigned char> encoded;             // buffer for the encoded image
+};
+
+/**
+ * Carries out one request.
+ * @param response status and body to send back
+ */
+static void render(renderThread &state, const serviceRequest &request, serviceResponse &response) {
+    response.status = 1;
+    response.body.clear();
+    requestCount++;
+
+    if (request.input == SERVICE_STATS) {
+        response.body = std::to_string(requestCount) + " requests\n" +
+                        (cache != nullptr ? cache->describe() : std::string("cache: off")) + "\n";
+        response.status = 0;
+        return;
+    }
+    unsigned long long fieldPixels = (unsigned long long) request.width * request.height *
+                                     request.supersample * request.supersample;
+    if (request.width == 0 || request.height == 0 || request.supersample < 1 ||
+        request.supersample > MAX_SUPERSAMPLE || fieldPixels > SERVICE_MAX_FIELD_PIXELS) {
+        response.body = "bad image size";
+        return;
+    }
+    if (request.input != SERVICE_SCRIPT && request.input != SERVICE_TRACE) {
+        response.body = "unknown input type";
+        return;
+    }
+    if ((request.flags & SERVICE_SAVE) && request.path.empty()) {
+        response.body = "no path to save to";
+        return;
+    }
+
+    turtleScript *script = nullptr;
+    if (request.input == SERVICE_SCRIPT) {
+        auto found = state.scripts.find(request.payload);
+        if (found == state.scripts.end()) {
+            if (state.scripts.size() >= SERVER_SCRIPTS) {
+                state.scripts.clear();
+            }
+            turtleScript compiled;
+            if (!compiled.compile(request.payload.c_str(), "request")) {
+                response.body = compiled.getError();
+                return;
+            }
+            found = state.scripts.emplace(request.payload, std::move(compiled)).first;
+        }
+        script = &found->second;
+    } else if (const char *corrupt = turtleTraceReader::check((const unsigned char *) request.payload.data(),
+                                                              request.payload.size())) {
+        // the reader would exit the server on it
+        response.body = std::string("corrupt turtle trace: ") + corrupt;
+        return;
+    }
+
+    // the measuring pass also records the commands, which key the cache
+    bool fit = (request.flags & SERVICE_FIT) != 0;
+    std::string key;
+    turtleMeasurement measurement{};
+    if (fit || cache != nullptr) {
+        auto start = std::chrono::steady_clock::now();
+        Turtle measure(1, 1);
+        measure.setMeasureMode(true);
+        turtleTraceWriter commands;
+        measure.setRecorder(cache != nullptr ? &commands : nullptr);
+        if (script != nullptr) {
+            if (!script->run(measure)) {
+                response.body = script->getError();
+                return;
+            }
+        } else {
+            measure.replayTrace((const unsigned char *) request.payload.data(), request.payload.size());
+        }
+        measure.setRecorder(nullptr);
+        measurement = measure.getMeasurement();
+        // a trace missing some drawing does not identify the image; render it uncached
+        if (cache != nullptr && commands.isComplete()) {
+            key = turtleRenderCache::makeKey(commands.getBytes(), request.width, request.height, request.supersample,
+                                             fit ? SERVICE_FIT : 0, "bmp");
+            cache->addKeyTime((unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    if (key.empty() || !cache->load(key, state.encoded)) {
+        auto start = std::chrono::steady_clock::now();
+        Turtle &canvas = state.canvases.acquire(request.width, request.height, request.supersample);
+        if (fit) {
+            unsigned int side = request.width < request.height ? request.width : request.height;
+            canvas.fitToImage(measurement, side / 32.0);
+        }
+        if (script != nullptr) {
+            if (!script->run(canvas)) {
+                response.body = script->getError();
+                return;
+            }
+        } else {
+            canvas.replayTrace((const unsigned char *) request.payload.data(), request.payload.size());
+        }
+        canvas.encodeBMP(state.encoded);
+        if (!key.empty()) {
+            cache->store(key, state.encoded, (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+        }
+    }
+
+    if (request.flags & SERVICE_SAVE) {
+        FILE *file = fopen(request.path.c_str(), "wb");
+        bool written = file != nullptr &&
+                       fwrite(state.encoded.data(), 1, state.encoded.size(), file) == state.encoded.size();
+        if (file != nullptr && fclose(file) != 0) {
+            written = false;
+        }
+        if (!written) {
+            response.body = "could not write to file: " + request.path;
+            return;
+        }
+        response.body = request.path;
+    } else {
+        response.body.assign((const char *) state.encoded.data(), state.encoded.size());
+    }
+    response.status = 0;
+}
+
+/**
+ * Serves connections, one at a time, until the process ends.
+ */
+static void serve(int listener) {
+    renderThread state;
+    serviceRequest request;
+    serviceResponse response;
+    std::string error;
+
+    for (;;) {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            exit(EXIT_FAILURE);
+        }
+
+        while (serviceReceiveRequest(connection, request, error)) {
+            render(state, request, response);
+            if (!serviceSendResponse(connection, response.status, response.body.data(), response.body.size())) {
+                break;
+            }
+        }
+        if (!error.empty()) {
+            serviceSendResponse(connection, 1, error.data(), error.size());
+        }
+        close(connection);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *cacheDirectory = nullptr;
+    unsigned long long cacheMegabytes = SERVER_CACHE_MB;
+    while (argc > 2 && strncmp(argv[1], "--cache", 7) == 0) {
+        if (strcmp(argv[1], "--cache") == 0) {
+            cacheDirectory = argv[2];
+        } else if (strcmp(argv[1], "--cache-size") == 0) {
+            cacheMegabytes = strtoull(argv[2], nullptr, 10);
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "Usage: TurtleServer [--cache directory [--cache-size megabytes]] socket [threads]\n");
+        return EXIT_FAILURE;
+    }
+    unsigned int threads = argc > 2 ? (unsigned int) atoi(argv[2]) : std::thread::hardware_concurrency() * 2;
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, argv[1]);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(argv[1]);
+    if (listener < 0 || bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 128) != 0) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    turtleRenderCache sharedCache;
+    if (cacheDirectory != nullptr) {
+        if (!sharedCache.open(cacheDirectory, cacheMegabytes << 20)) {
+            perror(cacheDirectory);
+            return EXIT_FAILURE;
+        }
+        cache = &sharedCache;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    printf("Serving on %s with %u threads\n", argv[1], threads);
+    if (cache != nullptr) {
+        printf("%s\n", cache->describe().c_str());
+    }
+    fflush(stdout);
+
+    // supervise the renderer, starting a new one whenever it dies
+    int quickDeaths = 0;
+    while (!stopRequested) {
+        time_t started = time(nullptr);
+        pid_t child = fork();
+        if (child < 0) {
+            perror("fork");
+            break;
+        }
+        if (child == 0) {
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            if (cache != nullptr) {
+                // index again, for the entries the previous renderer added
+                cache->open(cacheDirectory, cacheMegabytes << 20);
+            }
+            std::vector<std::thread> workers;
+            for (unsigned int i = 1; i < threads; i++) {
+                workers.emplace_back(serve, listener);
+            }
+            serve(listener);
+        }
+        renderer = child;
+        if (stopRequested) {
+            kill(child, SIGTERM);
+        }
+
+        int status = 0;
+        while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+        }
+        renderer = 0;
+        if (stopRequested) {
+            break;
+        }
+        fprintf(stderr, "Renderer %s %d, restarting\n", WIFSIGNALED(status) ? "killed by signal" : "exited with status",
+                WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+        quickDeaths = time(nullptr) - started < 2 ? quickDeaths + 1 : 0;
+        if (quickDeaths >= 3) {
+            sleep(1);   // don't spin if the renderer keeps dying right away
+        }
+    }
+
+    close(listener);
+    unlink(argv[1]);
+    return 0;
+}
@@ -0,0 +1,474 @@
+/*
+    turtle_service.hpp
+
+    Pieces shared by the rendering tools: a pool of reusable canvases, an on-disk cache of encoded
+    images, and the messages that TurtleServer and TurtleClient exchange over a Unix domain socket.
+
+    A request is "YTRQ", then little-endian 32-bit words: input (serviceInput), flags (serviceFlags),
+    width, height, supersample, payload size and path size, followed by the payload (script text or
+    binary trace) and the path. A response is "YTRS", then the status (0 for success) and the body size,
+    followed by the body: the BMP file, the path it was saved to (SERVICE_SAVE), or an error message.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TURTLEGRAPHICS_YATG_SERVICE_HPP
+#define TURTLEGRAPHICS_YATG_SERVICE_HPP
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "turtle.hpp"
+
+#define SERVICE_CANVASES 8                  // canvases a pool keeps warm
+#define SERVICE_MAX_PAYLOAD (256u << 20)    // largest script or trace a request may carry
+#define SERVICE_MAX_PATH 4096               // longest save path
+#define SERVICE_MAX_FIELD_PIXELS (1u << 26) // largest field (width * height * supersample^2) a request may ask for
+#define CACHE_SIGNATURE "YTCACHE1"          // start of a cache file, followed by the 8-byte render time
+#define CACHE_HEADER 16                     // bytes before the cached image
+#define CACHE_RENDER_VERSION 2              // part of every key; bump it when the same commands draw or encode
+                                            // differently, so that older entries are no longer found
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0                      // platforms without it ignore SIGPIPE instead
+#endif
+
+enum serviceInput {
+    SERVICE_SCRIPT,     // payload is a script (see turtle_script.hpp)
+    SERVICE_TRACE,      // payload is a binary trace (see turtleTraceWriter)
+    SERVICE_STATS       // no payload; the server answers with its statistics
+};
+
+enum serviceFlags {
+    SERVICE_FIT = 1,    // scale the drawing to fill the image (see Turtle::fitToImage())
+    SERVICE_SAVE = 2    // save the image to the request path instead of returning it
+};
+
+struct serviceRequest {
+    unsigned int input = SERVICE_SCRIPT;
+    unsigned int flags = 0;
+    unsigned int width = 0;
+    unsigned int height = 0;
+    unsigned int supersample = 1;
+    std::string payload;
+    std::string path;
+};
+
+struct serviceResponse {
+    unsigned int status = 0;    // 0 on success
+    std::string body;           // BMP file, saved path or error message
+};
+
+/**
+ * Canvases of recently used sizes, handed out cleared and reset so a new image can be drawn
+ * without allocating a field. Not thread-safe: every thread keeps its own pool.
+ */
+class turtleCanvasPool {
+    struct canvasEntry {
+        unsigned int width;
+        unsigned int height;
+        unsigned int supersample;
+        unsigned long long lastUse;
+        std::unique_ptr<Turtle> turtle;
+    };
+
+    std::vector<canvasEntry> canvases;
+    size_t capacity;
+    unsigned long long clock = 0;
+
+public:
+    unsigned long long reused = 0;      // canvases handed out again
+    unsigned long long created = 0;     // canvases allocated
+
+    explicit turtleCanvasPool(size_t canvasCount = SERVICE_CANVASES) : capacity(canvasCount > 0 ? canvasCount : 1) {
+    }
+
+    /**
+     * Returns a white canvas of the given size with the turtle in its initial state, like a new Turtle.
+     * The canvas belongs to the pool and is valid until the next call.
+     */
+    Turtle &acquire(unsigned int width, unsigned int height, unsigned int supersample) {
+        clock++;
+        for (canvasEntry &entry : canvases) {
+            if (entry.width == width && entry.height == height && entry.supersample == supersample) {
+                entry.lastUse = clock;
+                reused++;
+                Turtle &turtle = *entry.turtle;
+                turtle.setRecorder(nullptr);
+                turtle.setMeasureMode(false);
+                turtle.reset();
+                turtle.setFillAntialiasing(false);
+                turtle.setLineAntialiasing(false);
+                turtle.clear();
+                turtle.backup();
+                return turtle;
+            }
+        }
+
+        // make room by dropping the least recently used canvas
+        if (canvases.size() >= capacity) {
+            size_t oldest = 0;
+            for (size_t i = 1; i < canvases.size(); i++) {
+                if (canvases[i].lastUse < canvases[oldest].lastUse) oldest = i;
+            }
+            canvases.erase(canvases.begin() + (long) oldest);
+        }
+
+        created++;
+        canvasEntry entry{width, height, supersample, clock, std::unique_ptr<Turtle>(new Turtle(width, height, supersample))};
+        entry.turtle->setThreads(1);
+        canvases.push_back(std::move(entry));
+        return *canvases.back().turtle;
+    }
+};
+
+/**
+ * Cache of encoded images in a directory, keyed by a hash of the drawing's normalized command stream
+ * (its binary trace, see turtleTraceWriter) and the output parameters, so the same drawing made by
+ * different scripts or traces is rendered once. Each entry is a file holding CACHE_SIGNATURE, the time
+ * the image took to render and encode, and the encoded image. When the files exceed the size limit, the
+ * least recently used ones are deleted. Entries are written under temporary names and renamed, so several
+ * processes can share a directory; each process keeps the entries it knows of within the limit.
+ * Thread-safe.
+ */
+class turtleRenderCache {
+    struct cacheEntry {
+        unsigned long long size;        // file size in bytes
+        unsigned long long lastUse;     // position in the use order
+    };
+
+    std::string directory;
+    unsigned long long limit = 0;       // most bytes the entries may take
+    std::mutex lock;
+    std::map<std::string, cacheEntry> entries;
+    unsigned long long totalBytes = 0;
+    unsigned long long clock = 0;
+    unsigned long long temporaryCount = 0;
+
+public:
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+    unsigned long long evictions = 0;
+    unsigned long long savedNanoseconds = 0;    // render and encode time of the images found in the cache
+    unsigned long long keyNanoseconds = 0;      // time spent recording command streams for keys
+
+    /**
+     * Opens a cache directory, creating it if needed, and indexes the entries already in it.
+     * @param path directory
+     * @param maxBytes size limit of the entries
+     * @return false if the directory can't be created or read
+     */
+    bool open(const char *path, unsigned long long maxBytes) {
+        std::lock_guard<std::mutex> guard(lock);
+        directory = path;
+        limit = maxBytes;
+        entries.clear();
+        totalBytes = 0;
+        mkdir(path, 0755);
+        DIR *listing = opendir(path);
+        if (listing == nullptr) {
+            return false;
+        }
+
+        // existing entries are used in the order of their modification times
+        std::vector<std::pair<long long, std::string>> found;
+        while (dirent *file = readdir(listing)) {
+            std::string name = file->d_name;
+            struct stat status{};
+            if (name.size() != 38 || name.compare(32, 6, ".cache") != 0 ||
+                stat((directory + "/" + name).c_str(), &status) != 0) {
+                continue;
+            }
+            std::string key = name.substr(0, 32);
+            entries[key] = {(unsigned long long) status.st_size, 0};
+            totalBytes += (unsigned long long) status.st_size;
+            found.emplace_back((long long) status.st_mtime, key);
+        }
+        closedir(listing);
+        std::sort(found.begin(), found.end());
+        for (const auto &file : found) {
+            entries[file.second].lastUse = ++clock;
+        }
+        evict();
+        return true;
+    }
+
+    /**
+     * Returns the key of a drawing: 32 hex digits hashing its command stream, output parameters and
+     * CACHE_RENDER_VERSION.
+     * @param commands normalized command stream, a trace written by turtleTraceWriter
+     * @param format name of the output format
+     */
+    static std::string makeKey(const std::vector<unsigned char> &commands, unsigned int width, unsigned int height,
+                               unsigned int supersample, unsigned int flags, const char *format) {
+        char parameters[64];
+        int length = snprintf(parameters, sizeof(parameters), "%u %u %u %u %s %d", width, height, supersample, flags,
+                              format, CACHE_RENDER_VERSION);
+        unsigned long long seed = Turtle::hashBytes((const unsigned char *) parameters, (size_t) length, 0);
+        unsigned long long first = Turtle::hashBytes(commands.data(), commands.size(), seed);
+        unsigned long long second = Turtle::hashBytes(commands.data(), commands.size(), ~seed);
+        char key[33];
+        snprintf(key, sizeof(key), "%016llx%016llx", first, second);
+        return key;
+    }
+
+    /**
+     * Looks an image up.
+     * @param bytes receives the encoded image if found
+     * @return true if found
+     */
+    bool load(const std::string &key, std::vector<unsigned char> &bytes) {
+        std::string path = pathOf(key);
+        FILE *file = fopen(path.c_str(), "rb");
+        unsigned char header[CACHE_HEADER];
+        bool found = file != nullptr && fread(header, 1, CACHE_HEADER, file) == CACHE_HEADER &&
+                     memcmp(header, CACHE_SIGNATURE, 8) == 0;
+        unsigned long long cost = 0;
+        if (found) {
+            for (int b = 0; b < 8; b++) {
+                cost |= (unsigned long long) header[8 + b] << (8 * b);
+            }
+            fseek(file, 0, SEEK_END);
+            long size = ftell(file);
+            fseek(file, CACHE_HEADER, SEEK_SET);
+            bytes.resize(size > CACHE_HEADER ? (size_t) size - CACHE_HEADER : 0);
+            found = size >= CACHE_HEADER && fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        }
+        if (file != nullptr) {
+            fclose(file);
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (!found) {
+            misses++;
+            return false;
+        }
+        hits++;
+        savedNanoseconds += cost;
+        cacheEntry &entry = entries[key];
+        if (entry.size == 0) {
+            // written by another process
+            entry.size = bytes.size() + CACHE_HEADER;
+            totalBytes += entry.size;
+        }
+        entry.lastUse = ++clock;
+        utimes(path.c_str(), nullptr);
+        return true;
+    }
+
+    /**
+     * Adds an image, evicting the least recently used ones if the cache grows over its limit.
+     * @param renderNanoseconds time it took to render and encode the image
+     */
+    void store(const std::string &key, const std::vector<unsigned char> &bytes, unsigned long long renderNanoseconds) {
+        unsigned long long size = bytes.size() + CACHE_HEADER;
+        if (size > limit) {
+            return;
+        }
+
+        std::string temporary;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            temporary = directory + "/" + key + "." + std::to_string(getpid()) + "." +
+                        std::to_string(++temporaryCount) + ".tmp";
+        }
+        unsigned char header[CACHE_HEADER];
+        memcpy(header, CACHE_SIGNATURE, 8);
+        for (int b = 0; b < 8; b++) {
+            header[8 + b] = (unsigned char) (renderNanoseconds >> (8 * b));
+        }
+        FILE *file = fopen(temporary.c_str(), "wb");
+        bool written = file != nullptr && fwrite(header, 1, CACHE_HEADER, file) == CACHE_HEADER &&
+                       fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        if (file != nullptr && fclose(file) != 0) {
+            written = false;
+        }
+        if (!written || rename(temporary.c_str(), pathOf(key).c_str()) != 0) {
+            unlink(temporary.c_str());
+            return;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        cacheEntry &entry = entries[key];
+        totalBytes += size - entry.size;
+        entry.size = size;
+        entry.lastUse = ++clock;
+        evict();
+    }
+
+    /**
+     * Adds time spent computing keys to the statistics.
+     */
+    void addKeyTime(unsigned long long nanoseconds) {
+        std::lock_guard<std::mutex> guard(lock);
+        keyNanoseconds += nanoseconds;
+    }
+
+    /**
+     * Describes the cache statistics in one line.
+     */
+    std::string describe() {
+        std::lock_guard<std::mutex> guard(lock);
+        unsigned long long lookups = hits + misses;
+        char text[256];
+        snprintf(text, sizeof(text),
+                 "cache: %llu hits, %llu misses (%.1f%% hit rate), saved %.3f s of rendering, keys took %.3f s, "
+                 "%zu entries, %.1f MB, %llu evicted",
+                 hits, misses, lookups > 0 ? 100.0 * hits / lookups : 0.0, savedNanoseconds * 1e-9,
+                 keyNanoseconds * 1e-9, entries.size(), totalBytes * 1e-6, evictions);
+        return text;
+    }
+
+private:
+    std::string pathOf(const std::string &key) const {
+        return directory + "/" + key + ".cache";
+    }
+
+    /**
+     * Deletes the least recently used entries until the entries fit the limit. Called with the lock held.
+     */
+    void evict() {
+        while (totalBytes > limit && !entries.empty()) {
+            auto oldest = entries.begin();
+            for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+                if (entry->second.lastUse < oldest->second.lastUse) oldest = entry;
+            }
+            unlink(pathOf(oldest->first).c_str());
+            totalBytes -= oldest->second.size;
+            entries.erase(oldest);
+            evictions++;
+        }
+    }
+};
+
+/**
+ * Writes all bytes to a socket.
+ * @return false if the connection failed
+ */
+inline bool serviceSend(int socket, const void *data, size_t size) {
+    const char *bytes = (const char *) data;
+    while (size > 0) {
+        ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= (size_t) sent;
+    }
+    return true;
+}
+
+/**
+ * Reads exactly size bytes from a socket.
+ * @return false if the connection closed or failed first
+ */
+inline bool serviceReceive(int socket, void *data, size_t size) {
+    char *bytes = (char *) data;
+    while (size > 0) {
+        ssize_t received = recv(socket, bytes, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        bytes += received;
+        size -= (size_t) received;
+    }
+    return true;
+}
+
+inline void servicePutWord(unsigned char *out, unsigned int value) {
+    for (int b = 0; b < 4; b++) {
+        out[b] = (unsigned char) (value >> (8 * b));
+    }
+}
+
+inline unsigned int serviceGetWord(const unsigned char *in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (unsigned int) in[3] << 24;
+}
+
+inline bool serviceSendRequest(int socket, const serviceRequest &request) {
+    unsigned char header[32];
+    memcpy(header, "YTRQ", 4);
+    unsigned int words[7] = {request.input, request.flags, request.width, request.height, request.supersample,
+                             (unsigned int) request.payload.size(), (unsigned int) request.path.size()};
+    for (int i = 0; i < 7; i++) {
+        servicePutWord(header + 4 + 4 * i, words[i]);
+    }
+    return serviceSend(socket, header, sizeof(header)) &&
+           serviceSend(socket, request.payload.data(), request.payload.size()) &&
+           serviceSend(socket, request.path.data(), request.path.size());
+}
+
+/**
+ * Reads a request.
+ * @param error set to a message if the request is malformed; the connection can't be used after that
+ * @return false if the connection closed or the request is malformed
+ */
+inline bool serviceReceiveRequest(int socket, serviceRequest &request, std::string &error) {
+    unsigned char header[32];
+    error.clear();
+    if (!serviceReceive(socket, header, sizeof(header))) {
+        return false;
+    }
+    if (memcmp(header, "YTRQ", 4) != 0) {
+        error = "not a render request";
+        return false;
+    }
+    request.input = serviceGetWord(header + 4);
+    request.flags = serviceGetWord(header + 8);
+    request.width = serviceGetWord(header + 12);
+    request.height = serviceGetWord(header + 16);
+    request.supersample = serviceGetWord(header + 20);
+    unsigned int payloadSize = serviceGetWord(header + 24);
+    unsigned int pathSize = serviceGetWord(header + 28);
+    if (payloadSize > SERVICE_MAX_PAYLOAD || pathSize > SERVICE_MAX_PATH) {
+        error = "request too large";
+        return false;
+    }
+    request.payload.resize(payloadSize);
+    request.path.resize(pathSize);
+    return serviceReceive(socket, &request.payload[0], payloadSize) &&
+           serviceReceive(socket, &request.path[0], pathSize);
+}
+
+inline bool serviceSendResponse(int socket, unsigned int status, const void *body, size_t size) {
+    unsigned char header[12];
+    memcpy(header, "YTRS", 4);
+    servicePutWord(header + 4, status);
+    servicePutWord(header + 8, (unsigned int) size);
+    return serviceSend(socket, header, sizeof(header)) && serviceSend(socket, body, size);
+}
+
+inline bool serviceReceiveResponse(int socket, serviceResponse &response) {
+    unsigned char header[12];
+    if (!serviceReceive(socket, header, sizeof(header)) || memcmp(header, "YTRS", 4) != 0) {
+        return false;
+    }
+    response.status = serviceGetWord(header + 4);
+    response.body.resize(serviceGetWord(header + 8));
+    return serviceReceive(socket, &response.body[0], response.body.size());
+}
+
+#endif //TURTLEGRAPHICS_YATG_SERVICE_HPP